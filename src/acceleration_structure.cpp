@@ -1,67 +1,101 @@
 #include "acceleration_structure.h"
 #include "gpu_mesh.h"
 #include "lib.h"
+#include "profiler.h"
+
+// BLASes are built in batches. Each batch is a single vkCmdBuildAccelerationStructuresKHR call that
+// uses one scratch buffer, so scenes with thousands of meshes do not pay per-mesh submission cost.
+static std::vector<BLAS_Info> create_BLASes(const std::vector<GPU_Mesh>& meshes, uint32_t scratch_alignment) {
+    PROFILE_SCOPE("create_BLASes");
+    constexpr VkDeviceSize max_batch_scratch_size = 256 * 1024 * 1024;
+
+    const size_t mesh_count = meshes.size();
+    std::vector<VkAccelerationStructureGeometryKHR> geometries(mesh_count);
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> build_infos(mesh_count);
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> build_range_infos(mesh_count);
+    std::vector<VkDeviceSize> scratch_sizes(mesh_count);
+    std::vector<BLAS_Info> blases(mesh_count);
+
+    for (size_t i = 0; i < mesh_count; i++) {
+        const GPU_Mesh& mesh = meshes[i];
+        VkAccelerationStructureGeometryKHR& geometry = geometries[i];
+        geometry = VkAccelerationStructureGeometryKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+        geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+
+        auto& trianglesData = geometry.geometry.triangles;
+        trianglesData = VkAccelerationStructureGeometryTrianglesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
+        trianglesData.vertexFormat = mesh.vertex_layout.get_position_format();
+        trianglesData.vertexData.deviceAddress = mesh.vertex_buffer.device_address + mesh.vertex_layout.position_offset;
+        trianglesData.vertexStride = mesh.vertex_layout.position_stride;
+        trianglesData.maxVertex = mesh.vertex_count - 1;
+        trianglesData.indexType = mesh.index_type;
+        trianglesData.indexData.deviceAddress = mesh.index_buffer.device_address;
+
+        VkAccelerationStructureBuildGeometryInfoKHR& build_info = build_infos[i];
+        build_info = VkAccelerationStructureBuildGeometryInfoKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+        build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        build_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+        build_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        build_info.geometryCount = 1;
+        build_info.pGeometries = &geometry;
+
+        VkAccelerationStructureBuildSizesInfoKHR build_sizes{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+        uint32_t triangle_count = mesh.index_count / 3;
+        vkGetAccelerationStructureBuildSizesKHR(vk.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &build_info, &triangle_count, &build_sizes);
+
+        // Create buffer to hold acceleration structure data.
+        BLAS_Info& blas = blases[i];
+        blas.buffer = vk_create_buffer(build_sizes.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, nullptr, "blas_buffer");
+
+        // Create acceleration structure.
+        VkAccelerationStructureCreateInfoKHR create_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+        create_info.buffer = blas.buffer.handle;
+        create_info.offset = 0;
+        create_info.size = build_sizes.accelerationStructureSize;
+        create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        VK_CHECK(vkCreateAccelerationStructureKHR(vk.device, &create_info, nullptr, &blas.acceleration_structure));
+        vk_set_debug_name(blas.acceleration_structure, "blas");
+
+        // Get acceleration structure address.
+        VkAccelerationStructureDeviceAddressInfoKHR device_address_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+        device_address_info.accelerationStructure = blas.acceleration_structure;
+        blas.device_address = vkGetAccelerationStructureDeviceAddressKHR(vk.device, &device_address_info);
+
+        build_info.dstAccelerationStructure = blas.acceleration_structure;
+        build_range_infos[i].primitiveCount = triangle_count;
+        scratch_sizes[i] = round_up(build_sizes.buildScratchSize, VkDeviceSize(scratch_alignment));
+    }
 
-static BLAS_Info create_BLAS(const GPU_Mesh& mesh, uint32_t scratch_alignment) {
-    VkAccelerationStructureGeometryKHR geometry { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-    geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-
-    auto& trianglesData = geometry.geometry.triangles;
-    trianglesData = VkAccelerationStructureGeometryTrianglesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR };
-    trianglesData.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-    trianglesData.vertexData.deviceAddress = mesh.vertex_buffer.device_address;
-    trianglesData.vertexStride = sizeof(Vertex);
-    trianglesData.maxVertex = mesh.vertex_count - 1;
-    trianglesData.indexType = VK_INDEX_TYPE_UINT32;
-    trianglesData.indexData.deviceAddress = mesh.index_buffer.device_address;
-
-    VkAccelerationStructureBuildGeometryInfoKHR build_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-    build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    build_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-    build_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-    build_info.geometryCount = 1;
-    build_info.pGeometries = &geometry;
-
-    VkAccelerationStructureBuildSizesInfoKHR build_sizes{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
-    uint32_t triangle_count = mesh.index_count / 3;
-    vkGetAccelerationStructureBuildSizesKHR(vk.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &build_info, &triangle_count, &build_sizes);
-
-    // Create buffer to hold acceleration structure data.
-    BLAS_Info blas;
-    blas.buffer = vk_create_buffer(build_sizes.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, nullptr, "blas_buffer");
-
-    // Create acceleration structure.
-    VkAccelerationStructureCreateInfoKHR create_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
-    create_info.buffer = blas.buffer.handle;
-    create_info.offset = 0;
-    create_info.size = build_sizes.accelerationStructureSize;
-    create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    VK_CHECK(vkCreateAccelerationStructureKHR(vk.device, &create_info, nullptr, &blas.acceleration_structure));
-    vk_set_debug_name(blas.acceleration_structure, "blas");
-
-    // Get acceleration structure address.
-    VkAccelerationStructureDeviceAddressInfoKHR device_address_info{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-    device_address_info.accelerationStructure = blas.acceleration_structure;
-    blas.device_address = vkGetAccelerationStructureDeviceAddressKHR(vk.device, &device_address_info);
-
-    // Build acceleration structure.
-    Vk_Buffer scratch_buffer = vk_create_buffer_with_alignment(build_sizes.buildScratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scratch_alignment);
-    build_info.dstAccelerationStructure = blas.acceleration_structure;
-    build_info.scratchData.deviceAddress = scratch_buffer.device_address;
-
-    VkAccelerationStructureBuildRangeInfoKHR build_range_info{};
-    build_range_info.primitiveCount = mesh.index_count / 3;
-    const VkAccelerationStructureBuildRangeInfoKHR* p_build_range_infos[1] = { &build_range_info };
+    // Build acceleration structures.
+    for (size_t batch_begin = 0; batch_begin < mesh_count;) {
+        VkDeviceSize scratch_size = scratch_sizes[batch_begin];
+        size_t batch_end = batch_begin + 1;
+        while (batch_end < mesh_count && scratch_size + scratch_sizes[batch_end] <= max_batch_scratch_size)
+            scratch_size += scratch_sizes[batch_end++];
+
+        Vk_Buffer scratch_buffer = vk_create_buffer_with_alignment(scratch_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scratch_alignment);
+        std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> p_build_range_infos;
+        VkDeviceSize scratch_offset = 0;
+        for (size_t i = batch_begin; i < batch_end; i++) {
+            build_infos[i].scratchData.deviceAddress = scratch_buffer.device_address + scratch_offset;
+            scratch_offset += scratch_sizes[i];
+            p_build_range_infos.push_back(&build_range_infos[i]);
+        }
 
-    vk_execute(vk.command_pools[0], vk.queue, [&build_info, p_build_range_infos](VkCommandBuffer command_buffer)
-    {
-        vkCmdBuildAccelerationStructuresKHR(command_buffer, 1, &build_info, p_build_range_infos);
-    });
-    scratch_buffer.destroy();
-    return blas;
+        const uint32_t batch_size = uint32_t(batch_end - batch_begin);
+        const VkAccelerationStructureBuildGeometryInfoKHR* p_build_infos = &build_infos[batch_begin];
+        vk_execute(vk.command_pools[0], vk.queue, [batch_size, p_build_infos, &p_build_range_infos](VkCommandBuffer command_buffer)
+        {
+            vkCmdBuildAccelerationStructuresKHR(command_buffer, batch_size, p_build_infos, p_build_range_infos.data());
+        });
+        scratch_buffer.destroy();
+        batch_begin = batch_end;
+    }
+    return blases;
 }
 
 static TLAS_Info create_TLAS(uint32_t instance_count, VkDeviceAddress instances_device_address, uint32_t scratch_alignment) {
+    PROFILE_SCOPE("create_TLAS");
     VkAccelerationStructureGeometryKHR geometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
     geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
     geometry.geometry.instances = VkAccelerationStructureGeometryInstancesDataKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
@@ -108,7 +142,7 @@ static TLAS_Info create_TLAS(uint32_t instance_count, VkDeviceAddress instances_
 }
 
 Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GPU_Mesh>& gpu_meshes) {
-    Timestamp t;
+    PROFILE_SCOPE("create_intersection_accelerator");
     Vk_Intersection_Accelerator accelerator;
 
     auto accel_properties = VkPhysicalDeviceAccelerationStructurePropertiesKHR{
@@ -122,10 +156,7 @@ Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GP
     const uint32_t scratch_alignment = accel_properties.minAccelerationStructureScratchOffsetAlignment;
 
     // Create BLASes.
-    accelerator.bottom_level_accels.resize(gpu_meshes.size());
-    for (int i = 0; i < (int)gpu_meshes.size(); i++) {
-        accelerator.bottom_level_accels[i] = create_BLAS(gpu_meshes[i], scratch_alignment);
-    }
+    accelerator.bottom_level_accels = create_BLASes(gpu_meshes, scratch_alignment);
     // Create instance buffer.
     {
         std::vector<VkAccelerationStructureInstanceKHR> instances(gpu_meshes.size());
@@ -141,11 +172,10 @@ Vk_Intersection_Accelerator create_intersection_accelerator(const std::vector<GP
         accelerator.instance_buffer = vk_create_mapped_buffer(instance_buffer_size,
             VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
             &(void*&)accelerator.mapped_instance_buffer, "instance_buffer");
+        memcpy(accelerator.mapped_instance_buffer, instances.data(), instance_buffer_size);
     }
     // Create TLAS.
     accelerator.top_level_accel = create_TLAS((uint32_t)gpu_meshes.size(), accelerator.instance_buffer.device_address, scratch_alignment);
-
-    printf("\nAcceleration structures build time = %lld microseconds\n", elapsed_nanoseconds(t) / 1000);
     return accelerator;
 }
 
@@ -0,0 +1,247 @@
+#include "benchmark.h"
+#include "lib.h"
+#include "obj_parser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+// Nearest-rank percentile of the sorted samples.
+static float get_percentile(const std::vector<float>& sorted_samples, float percentile) {
+    size_t rank = (size_t)std::ceil(percentile * float(sorted_samples.size()));
+    return sorted_samples[std::clamp(rank, size_t(1), sorted_samples.size()) - 1];
+}
+
+Sample_Statistics compute_sample_statistics(std::vector<float> samples) {
+    Sample_Statistics stats;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.median = get_percentile(samples, 0.50f);
+    stats.p95 = get_percentile(samples, 0.95f);
+    stats.p99 = get_percentile(samples, 0.99f);
+
+    double sum = 0.0;
+    for (float sample : samples)
+        sum += sample;
+    stats.mean = float(sum / double(samples.size()));
+    return stats;
+}
+
+struct Metric {
+    std::string name;
+    Sample_Statistics stats;
+};
+
+static std::vector<Metric> get_run_metrics(const Benchmark_Run& run) {
+    std::vector<Metric> metrics;
+    metrics.push_back({"cpu_frame_ms", compute_sample_statistics(run.cpu_frame_ms)});
+    for (size_t i = 0; i < run.gpu_interval_names.size(); i++) {
+        // Skip intervals of the passes that are not used by this configuration.
+        if (run.gpu_interval_ms[i].empty())
+            continue;
+        metrics.push_back({"gpu_" + run.gpu_interval_names[i] + "_ms", compute_sample_statistics(run.gpu_interval_ms[i])});
+    }
+    for (size_t i = 0; i < run.counter_names.size(); i++) {
+        Sample_Statistics stats = compute_sample_statistics(run.counter_values[i]);
+        // Skip counters of the shader stages that are not used by the pass.
+        if (stats.max == 0.f)
+            continue;
+        metrics.push_back({run.counter_names[i], stats});
+    }
+    if (!run.mrays_per_second.empty()) {
+        metrics.push_back({"mrays_per_second", compute_sample_statistics(run.mrays_per_second)});
+    }
+    return metrics;
+}
+
+void write_benchmark_report(const std::vector<Benchmark_Run>& runs, const std::string& file_name_without_extension) {
+    const std::string json_file_name = file_name_without_extension + ".json";
+    const std::string csv_file_name = file_name_without_extension + ".csv";
+
+    FILE* json = fopen(json_file_name.c_str(), "w");
+    if (!json)
+        error("failed to open file for writing: " + json_file_name);
+
+    FILE* csv = fopen(csv_file_name.c_str(), "w");
+    if (!csv) {
+        fclose(json);
+        error("failed to open file for writing: " + csv_file_name);
+    }
+
+    fprintf(json, "{\n  \"runs\": [\n");
+    fprintf(csv, "run,metric,min,median,p95,p99,max,mean\n");
+
+    for (size_t r = 0; r < runs.size(); r++) {
+        const Benchmark_Run& run = runs[r];
+        const std::vector<Metric> metrics = get_run_metrics(run);
+
+        fprintf(json, "    {\n");
+        fprintf(json, "      \"name\": \"%s\",\n", run.name.c_str());
+        fprintf(json, "      \"ray_tracing\": %s,\n", run.ray_tracing ? "true" : "false");
+        fprintf(json, "      \"spp4\": %s,\n", run.spp4 ? "true" : "false");
+        fprintf(json, "      \"frames\": %zu,\n", run.cpu_frame_ms.size());
+        fprintf(json, "      \"rays_per_frame\": %llu,\n", (unsigned long long)run.rays_per_frame);
+        fprintf(json, "      \"metrics\": {\n");
+
+        printf("\n%s (%zu frames)\n", run.name.c_str(), run.cpu_frame_ms.size());
+        printf("  %-24s %10s %10s %10s %10s\n", "metric", "min", "median", "p95", "p99");
+
+        for (size_t m = 0; m < metrics.size(); m++) {
+            const Metric& metric = metrics[m];
+            const Sample_Statistics& s = metric.stats;
+
+            fprintf(json, "        \"%s\": { \"min\": %s, \"median\": %s, \"p95\": %s, \"p99\": %s, \"max\": %s, \"mean\": %s }%s\n",
+                metric.name.c_str(), format_json_number(s.min, 4).c_str(), format_json_number(s.median, 4).c_str(),
+                format_json_number(s.p95, 4).c_str(), format_json_number(s.p99, 4).c_str(), format_json_number(s.max, 4).c_str(),
+                format_json_number(s.mean, 4).c_str(), (m + 1 < metrics.size()) ? "," : "");
+            fprintf(csv, "%s,%s,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                run.name.c_str(), metric.name.c_str(), s.min, s.median, s.p95, s.p99, s.max, s.mean);
+            printf("  %-24s %10.3f %10.3f %10.3f %10.3f\n", metric.name.c_str(), s.min, s.median, s.p95, s.p99);
+        }
+        fprintf(json, "      }\n");
+        fprintf(json, "    }%s\n", (r + 1 < runs.size()) ? "," : "");
+    }
+    fprintf(json, "  ]\n}\n");
+
+    fclose(json);
+    fclose(csv);
+    printf("\nBenchmark report: %s, %s\n", json_file_name.c_str(), csv_file_name.c_str());
+}
+
+// Grid with per-quad texture seams: each position is shared by ~6 corners, and every 8th column
+// duplicates texture coordinates, so the result has both shared and split vertices like real meshes.
+static std::vector<Obj_Index> create_dedup_benchmark_indices(size_t target_index_count) {
+    const uint32_t grid_size = std::max(2u, (uint32_t)std::sqrt(double(target_index_count) / 6.0) + 1);
+    std::vector<Obj_Index> indices;
+    indices.reserve(size_t(grid_size - 1) * (grid_size - 1) * 6);
+
+    auto corner = [grid_size](uint32_t x, uint32_t y, uint32_t quad_x) {
+        int32_t position = int32_t(y * grid_size + x);
+        int32_t texcoord = (x % 8 == 0 && x != quad_x) ? position + int32_t(grid_size * grid_size) : position;
+        return Obj_Index{ position, texcoord, -1 };
+    };
+    for (uint32_t y = 0; y + 1 < grid_size; y++) {
+        for (uint32_t x = 0; x + 1 < grid_size; x++) {
+            indices.push_back(corner(x, y, x));
+            indices.push_back(corner(x + 1, y, x));
+            indices.push_back(corner(x + 1, y + 1, x));
+            indices.push_back(corner(x, y, x));
+            indices.push_back(corner(x + 1, y + 1, x));
+            indices.push_back(corner(x, y + 1, x));
+        }
+    }
+    return indices;
+}
+
+namespace {
+struct Dedup_Method {
+    Obj_Dedup_Method method;
+    const char* name;
+};
+const Dedup_Method dedup_methods[] = {
+    { Obj_Dedup_Method::unordered_map, "unordered_map" },
+    { Obj_Dedup_Method::flat_hash, "flat_hash" },
+    { Obj_Dedup_Method::sort, "sort" },
+};
+} // namespace
+
+static bool is_same_obj_index(const Obj_Index& a, const Obj_Index& b) {
+    return a.position == b.position && a.texcoord == b.texcoord && a.normal == b.normal;
+}
+
+// Simple quadratic reference: vertices are numbered in the order of the first occurrence.
+static Obj_Vertex_Mapping deduplicate_obj_vertices_reference(const std::vector<Obj_Index>& indices) {
+    Obj_Vertex_Mapping mapping;
+    for (const Obj_Index& index : indices) {
+        auto it = std::find_if(mapping.unique_vertices.begin(), mapping.unique_vertices.end(),
+            [&index](const Obj_Index& vertex) { return is_same_obj_index(vertex, index); });
+        mapping.indices.push_back(uint32_t(it - mapping.unique_vertices.begin()));
+        if (it == mapping.unique_vertices.end())
+            mapping.unique_vertices.push_back(index);
+    }
+    return mapping;
+}
+
+static bool is_same_vertex_mapping(const Obj_Vertex_Mapping& a, const Obj_Vertex_Mapping& b) {
+    return a.indices == b.indices && std::equal(a.unique_vertices.begin(), a.unique_vertices.end(),
+        b.unique_vertices.begin(), b.unique_vertices.end(), is_same_obj_index);
+}
+
+// Checks all methods against the reference on small inputs, including the ones that make the flat hash table
+// grow past its initial estimate and the ones that make the parallel sort use several chunks.
+static void check_vertex_dedup_methods() {
+    std::mt19937 rng(42);
+    std::vector<std::vector<Obj_Index>> inputs;
+    inputs.push_back({});
+    inputs.push_back({ { 0, -1, -1 } });
+    inputs.push_back(std::vector<Obj_Index>(1000, Obj_Index{ 7, 3, -1 }));
+    for (size_t attribute_count : { size_t(4), size_t(300), size_t(100'000) }) {
+        std::vector<Obj_Index> indices(300'000);
+        std::uniform_int_distribution<int32_t> attribute(-1, int32_t(attribute_count) - 1);
+        for (Obj_Index& index : indices)
+            index = Obj_Index{ std::max(0, attribute(rng)), attribute(rng), attribute(rng) % 2 };
+        inputs.push_back(std::move(indices));
+    }
+    std::vector<Obj_Index> all_unique(200'000);
+    for (size_t i = 0; i < all_unique.size(); i++)
+        all_unique[i] = Obj_Index{ int32_t(i), -1, -1 };
+    inputs.push_back(std::move(all_unique));
+
+    for (const std::vector<Obj_Index>& indices : inputs) {
+        // The reference is quadratic in the vertex count, so only the hash table result is checked against it
+        // for the inputs with many vertices. The other methods are compared with the hash table.
+        const Obj_Vertex_Mapping hash_mapping = deduplicate_obj_vertices(indices, Obj_Dedup_Method::flat_hash);
+        if (hash_mapping.indices.size() != indices.size())
+            error("vertex deduplication check failed: flat_hash index count");
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (hash_mapping.indices[i] >= hash_mapping.unique_vertices.size() ||
+                !is_same_obj_index(hash_mapping.unique_vertices[hash_mapping.indices[i]], indices[i]))
+                error("vertex deduplication check failed: flat_hash maps corner to a different vertex");
+        }
+        if (hash_mapping.unique_vertices.size() <= 1000 &&
+            !is_same_vertex_mapping(hash_mapping, deduplicate_obj_vertices_reference(indices)))
+            error("vertex deduplication check failed: flat_hash differs from the reference");
+
+        for (const Dedup_Method& method : dedup_methods) {
+            if (!is_same_vertex_mapping(deduplicate_obj_vertices(indices, method.method), hash_mapping))
+                error(std::string("vertex deduplication check failed: ") + method.name + " differs from flat_hash");
+        }
+    }
+    printf("Vertex deduplication check passed (%zu inputs)\n\n", inputs.size());
+}
+
+void run_vertex_dedup_benchmark() {
+    check_vertex_dedup_methods();
+
+    const size_t index_counts[] = { 1'000'000, 5'000'000, 10'000'000, 50'000'000 };
+
+    printf("%-12s %-12s %-16s %10s %12s\n", "indices", "vertices", "method", "ms", "Mindices/s");
+    for (size_t target_index_count : index_counts) {
+        const std::vector<Obj_Index> indices = create_dedup_benchmark_indices(target_index_count);
+
+        Obj_Vertex_Mapping reference;
+        for (const Dedup_Method& method : dedup_methods) {
+            // Best of 3 to reduce the influence of page faults on the first run.
+            uint64_t best_ns = UINT64_MAX;
+            Obj_Vertex_Mapping mapping;
+            for (int i = 0; i < 3; i++) {
+                mapping = Obj_Vertex_Mapping();
+                Timestamp t;
+                mapping = deduplicate_obj_vertices(indices, method.method);
+                best_ns = std::min(best_ns, elapsed_nanoseconds(t));
+            }
+            printf("%-12zu %-12zu %-16s %10.2f %12.1f\n", indices.size(), mapping.unique_vertices.size(),
+                method.name, double(best_ns) * 1e-6, double(indices.size()) * 1e3 / double(best_ns));
+
+            if (&method == &dedup_methods[0]) {
+                reference = std::move(mapping);
+            } else if (!is_same_vertex_mapping(mapping, reference)) {
+                error(std::string("vertex deduplication result mismatch: ") + method.name);
+            }
+        }
+    }
+}
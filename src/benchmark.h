@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Benchmark_Params {
+    // Warmup frames are rendered but not measured. GPU timestamps are read back with two frames
+    // of latency, so at least two warmup frames are needed to not mix results of different runs.
+    int warmup_frames = 100;
+    int measured_frames = 500;
+    std::string report_file = "benchmark"; // .json and .csv extensions are appended
+};
+
+// Measurements of a single benchmark configuration (render mode and settings).
+struct Benchmark_Run {
+    std::string name;
+    bool ray_tracing = false;
+    bool spp4 = false;
+    uint64_t rays_per_frame = 0; // 0 for rasterization runs
+
+    std::vector<float> cpu_frame_ms;
+    std::vector<float> mrays_per_second; // empty for rasterization runs
+    std::vector<std::string> gpu_interval_names;
+    std::vector<std::vector<float>> gpu_interval_ms; // [interval][frame], only frames where the interval was recorded
+
+    // Pipeline statistics counters, only frames where the corresponding interval was recorded.
+    std::vector<std::string> counter_names;
+    std::vector<std::vector<float>> counter_values; // [counter][frame]
+};
+
+struct Sample_Statistics {
+    float min = 0.f;
+    float median = 0.f;
+    float p95 = 0.f;
+    float p99 = 0.f;
+    float max = 0.f;
+    float mean = 0.f;
+};
+
+Sample_Statistics compute_sample_statistics(std::vector<float> samples);
+
+// Writes <file_name_without_extension>.json and <file_name_without_extension>.csv
+// and prints a short summary to stdout.
+void write_benchmark_report(const std::vector<Benchmark_Run>& runs, const std::string& file_name_without_extension);
+
+// CPU microbenchmark of OBJ vertex deduplication methods on synthetic meshes from 1M to 50M
+// face corners. Before the benchmark the methods are checked against the reference implementation on small
+// inputs. Prints timings and checks that all methods produce identical results.
+void run_vertex_dedup_benchmark();
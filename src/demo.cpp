@@ -1,5 +1,10 @@
 #include "demo.h"
+#include "gltf_loader.h"
 #include "lib.h"
+#include "mesh_cache.h"
+#include "profiler.h"
+#include "startup_timer.h"
+#include "texture_cache.h"
 
 #include "glfw/glfw3.h"
 #include "imgui/imgui.h"
@@ -7,7 +12,11 @@
 #include "imgui/imgui_impl_vulkan.h"
 #include "imgui/imgui_impl_glfw.h"
 
+#include <algorithm>
 #include <array>
+#include <cfloat>
+#include <filesystem>
+#include <future>
 
 static VkFormat render_target_format = VK_FORMAT_R16G16B16A16_SFLOAT;
 
@@ -24,27 +33,253 @@ static VkFormat get_depth_image_format() {
     return VK_FORMAT_UNDEFINED;
 }
 
-void Vk_Demo::initialize(GLFWwindow* window) {
+static const char* get_texture_format_name(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_SRGB: return "VK_FORMAT_R8G8B8A8_SRGB";
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return "VK_FORMAT_BC1_RGB_SRGB_BLOCK";
+    case VK_FORMAT_BC7_SRGB_BLOCK: return "VK_FORMAT_BC7_SRGB_BLOCK";
+    default: return "unknown format";
+    }
+}
+
+static const VkBufferUsageFlags geometry_buffer_usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+
+namespace {
+// Loads diffuse textures of the materials on the worker pool, so texture loading runs in parallel
+// with geometry loading and acceleration structure building. The number of textures in flight is
+// limited by the pool size, mip filtering and block encoding of a texture fan out to the idle workers.
+struct Material_Texture_Loader {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    Mip_Filter_Params mip_filter;
+    std::vector<std::string> files; // unique texture files
+    std::vector<std::future<Texture_Mips>> loaded_files;
+    std::vector<int32_t> material_files; // index in files for each material, -1 if there is no texture
+
+    void start(const std::vector<Mesh_Material>& materials) {
+        material_files.resize(materials.size(), -1);
+        for (size_t i = 0; i < materials.size(); i++) {
+            const std::string& file = materials[i].diffuse_texture;
+            if (file.empty())
+                continue;
+            auto it = std::find(files.begin(), files.end(), file);
+            if (it == files.end()) {
+                if (!std::filesystem::exists(file)) {
+                    printf("texture file not found: %s\n", file.c_str());
+                    continue;
+                }
+                files.push_back(file);
+                loaded_files.push_back(run_async([file, format = format, mip_filter = mip_filter] { return load_texture_cached(file, format, mip_filter); }));
+                it = files.end() - 1;
+            }
+            material_files[i] = int32_t(it - files.begin());
+        }
+    }
+};
+} // namespace
+
+// Writes vertices starting at first_vertex to the position and uv streams of the mesh's split layout.
+// Vertices are converted in batches, so no full-size conversion buffer is needed.
+static void upload_vertices(Vk_Buffer_Uploader& uploader, const GPU_Mesh& mesh, uint64_t first_vertex, std::span<const Vertex> vertices) {
+    const GPU_Vertex_Layout& layout = mesh.vertex_layout;
+    const size_t batch_size = std::min<size_t>(vertices.size(), 64 * 1024);
+    std::vector<Vector3> positions;
+    std::vector<Vector2> uvs;
+    std::vector<Quantized_Position> quantized_positions;
+    std::vector<Quantized_UV> quantized_uvs;
+    if (layout.quantized) {
+        quantized_positions.resize(batch_size);
+        quantized_uvs.resize(batch_size);
+    }
+    else {
+        positions.resize(batch_size);
+        uvs.resize(batch_size);
+    }
+    for (size_t i = 0; i < vertices.size(); i += batch_size) {
+        const std::span<const Vertex> batch = vertices.subspan(i, std::min(batch_size, vertices.size() - i));
+        const uint64_t position_offset = layout.position_offset + (first_vertex + i) * layout.position_stride;
+        const uint64_t uv_offset = layout.uv_offset + (first_vertex + i) * layout.uv_stride;
+        if (layout.quantized) {
+            quantize_vertices(batch, layout.position_quantization, quantized_positions.data(), quantized_uvs.data());
+            uploader.write(mesh.vertex_buffer.handle, position_offset, quantized_positions.data(), batch.size() * sizeof(Quantized_Position));
+            uploader.write(mesh.vertex_buffer.handle, uv_offset, quantized_uvs.data(), batch.size() * sizeof(Quantized_UV));
+        }
+        else {
+            for (size_t k = 0; k < batch.size(); k++) {
+                positions[k] = batch[k].pos;
+                uvs[k] = batch[k].uv;
+            }
+            uploader.write(mesh.vertex_buffer.handle, position_offset, positions.data(), batch.size() * sizeof(Vector3));
+            uploader.write(mesh.vertex_buffer.handle, uv_offset, uvs.data(), batch.size() * sizeof(Vector2));
+        }
+    }
+}
+
+// Meshes with up to 65536 vertices use 16-bit indices. The buffer size is rounded up to 4 bytes, since
+// the closest hit shader reads indices as 32-bit words.
+static void set_index_format(GPU_Mesh& mesh, uint32_t index_count) {
+    mesh.index_count = index_count;
+    mesh.index_type = (mesh.vertex_count <= 65536) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    const uint64_t index_size = (mesh.index_type == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+    mesh.index_buffer_size = round_up(index_count * index_size, uint64_t(4));
+}
+
+// Writes indices starting at first_index in the mesh's index format.
+static void upload_indices(Vk_Buffer_Uploader& uploader, const GPU_Mesh& mesh, uint64_t first_index, std::span<const uint32_t> indices) {
+    if (mesh.index_type == VK_INDEX_TYPE_UINT32) {
+        uploader.write(mesh.index_buffer.handle, first_index * sizeof(uint32_t), indices.data(), indices.size_bytes());
+        return;
+    }
+    const size_t batch_size = std::min<size_t>(indices.size(), 64 * 1024);
+    std::vector<uint16_t> indices16(batch_size);
+    for (size_t i = 0; i < indices.size(); i += batch_size) {
+        const size_t count = std::min(batch_size, indices.size() - i);
+        for (size_t k = 0; k < count; k++)
+            indices16[k] = uint16_t(indices[i + k]);
+        uploader.write(mesh.index_buffer.handle, (first_index + i) * sizeof(uint16_t), indices16.data(), count * sizeof(uint16_t));
+    }
+}
+
+// Creates one mesh per shape of the OBJ or PLY model, shapes[i] describes meshes[i]. PLY models have a single shape.
+// Loading of material textures is started as soon as the materials are known.
+// All shapes are quantized relative to the model bounds, so shared edges stay watertight.
+static std::vector<GPU_Mesh> create_gpu_meshes_cached(const std::string& model_file, bool quantize_vertices,
+    std::vector<Mesh_Shape>* shapes, Material_Texture_Loader* texture_loader, bool* from_cache)
+{
+    // The mesh is streamed to GPU buffers in chunks, so it's never fully resident in host memory.
+    // The stream delivers vertices and indices of all shapes consecutively, chunks are split
+    // between shape buffers according to shape ranges.
+    std::vector<GPU_Mesh> meshes;
+    Vk_Buffer_Uploader uploader;
+    size_t vertex_shape = 0;
+    size_t index_shape = 0;
+    uint64_t vertex_position = 0;
+    uint64_t index_position = 0;
+
+    Mesh_Stream stream;
+    stream.begin = [&meshes, &uploader, shapes, texture_loader, quantize_vertices, &model_file](const Mesh_Stream_Info& info) {
+        if (info.index_count == 0)
+            error("mesh has no triangles: " + model_file);
+        *shapes = info.shapes;
+        texture_loader->start(info.materials);
+        meshes.resize(info.shapes.size());
+        for (size_t i = 0; i < info.shapes.size(); i++) {
+            const Mesh_Shape& shape = info.shapes[i];
+            GPU_Mesh& mesh = meshes[i];
+            mesh.vertex_layout = GPU_Vertex_Layout::get_split_layout(shape.vertex_count, quantize_vertices,
+                get_vertex_quantization(info.bounds_min, info.bounds_max));
+            mesh.vertex_buffer_size = mesh.vertex_layout.get_split_vertex_buffer_size(shape.vertex_count);
+            mesh.vertex_buffer = vk_create_buffer(mesh.vertex_buffer_size, geometry_buffer_usage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, nullptr, "vertex_buffer");
+            mesh.vertex_count = shape.vertex_count;
+            set_index_format(mesh, shape.index_count);
+            mesh.index_buffer = vk_create_buffer(mesh.index_buffer_size, geometry_buffer_usage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, nullptr, "index_buffer");
+        }
+        uploader.begin();
+    };
+    stream.write_vertices = [&meshes, shapes, &uploader, &vertex_shape, &vertex_position](std::span<const Vertex> vertices) {
+        while (!vertices.empty()) {
+            const Mesh_Shape& shape = (*shapes)[vertex_shape];
+            const uint64_t shape_offset = vertex_position - shape.first_vertex;
+            const size_t count = (size_t)std::min<uint64_t>(vertices.size(), shape.vertex_count - shape_offset);
+            upload_vertices(uploader, meshes[vertex_shape], shape_offset, vertices.first(count));
+            vertices = vertices.subspan(count);
+            vertex_position += count;
+            if (vertex_position == uint64_t(shape.first_vertex) + shape.vertex_count)
+                vertex_shape++;
+        }
+    };
+    stream.write_indices = [&meshes, shapes, &uploader, &index_shape, &index_position](std::span<const uint32_t> indices) {
+        while (!indices.empty()) {
+            const Mesh_Shape& shape = (*shapes)[index_shape];
+            const uint64_t shape_offset = index_position - shape.first_index;
+            const size_t count = (size_t)std::min<uint64_t>(indices.size(), shape.index_count - shape_offset);
+            upload_indices(uploader, meshes[index_shape], shape_offset, indices.first(count));
+            indices = indices.subspan(count);
+            index_position += count;
+            if (index_position == uint64_t(shape.first_index) + shape.index_count)
+                index_shape++;
+        }
+    };
+
+    *from_cache = stream_mesh_cached(model_file, 1.25f, stream);
+    uploader.end();
+    return meshes;
+}
+
+static GPU_Mesh create_gpu_mesh_from_glb(const std::string& glb_file, Matrix3x4* normalization_transform) {
+    // Buffer views are copied from the memory-mapped file to the staging memory as is. Vertex layout
+    // and index type of the file are passed to the kernels, so there is no per-vertex conversion.
+    GLB_Mesh glb = load_glb_mesh(glb_file);
+    if (glb.vertices_converted)
+        printf("%s: vertex format is not supported directly, vertices were converted\n", glb_file.c_str());
+
+    GPU_Mesh mesh;
+    mesh.vertex_count = glb.vertex_count;
+    mesh.index_count = glb.index_count;
+    mesh.index_type = (glb.index_size == 2) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    mesh.vertex_layout.position_offset = glb.position_offset;
+    mesh.vertex_layout.position_stride = glb.position_stride;
+    mesh.vertex_layout.uv_offset = glb.uv_offset;
+    mesh.vertex_layout.uv_stride = glb.uv_stride;
+    *normalization_transform = get_normalization_transform(glb.bounds_min, glb.bounds_max, 1.25f);
+
+    // Shaders read buffers as arrays of 32-bit words, sizes are rounded up to cover the last 16-bit index.
+    mesh.vertex_buffer_size = round_up(glb.get_vertex_data_size(), uint64_t(4));
+    mesh.index_buffer_size = round_up(uint64_t(glb.index_data.size()), uint64_t(4));
+    mesh.vertex_buffer = vk_create_buffer(mesh.vertex_buffer_size, geometry_buffer_usage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, nullptr, "vertex_buffer");
+    mesh.index_buffer = vk_create_buffer(mesh.index_buffer_size, geometry_buffer_usage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, nullptr, "index_buffer");
+
+    Vk_Buffer_Uploader uploader;
+    uploader.begin();
+    VkDeviceSize vertex_offset = 0;
+    for (std::span<const uint8_t> range : glb.vertex_data) {
+        uploader.write(mesh.vertex_buffer.handle, vertex_offset, range.data(), range.size());
+        vertex_offset += range.size();
+    }
+    uploader.write(mesh.index_buffer.handle, 0, glb.index_data.data(), glb.index_data.size());
+    uploader.end();
+    return mesh;
+}
+
+void Vk_Demo::initialize(GLFWwindow* window, const Demo_Init_Params& params) {
+    PROFILE_SCOPE("Vk_Demo::initialize");
+    headless = params.headless;
+    startup_report_file = params.startup_report_file;
+    if (params.benchmark) {
+        vsync = false;
+        show_ui = false;
+    }
+
     Vk_Init_Params vk_init_params;
     vk_init_params.error_reporter = &error;
-
-    std::array instance_extensions = {
-        VK_KHR_SURFACE_EXTENSION_NAME,
+    vk_init_params.vsync = vsync;
+    vk_init_params.headless = headless;
+    vk_init_params.headless_surface_size = VkExtent2D{ params.headless_width, params.headless_height };
+    vk_init_params.capture_pipeline_statistics = !params.shader_statistics_file.empty();
+    vk_init_params.texture_compression_bc = (params.texture_format != VK_FORMAT_R8G8B8A8_SRGB);
+    vk_init_params.shader_clock = true; // traversal cost heatmap
+
+    std::vector<const char*> instance_extensions = {
         VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
+    };
+    if (!headless) {
+        instance_extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #ifdef VK_USE_PLATFORM_WIN32_KHR
-        VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+        instance_extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #endif
 #ifdef VK_USE_PLATFORM_XCB_KHR
-        VK_KHR_XCB_SURFACE_EXTENSION_NAME,
+        instance_extensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #endif
-    };
-    std::array device_extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    }
+    std::vector<const char*> device_extensions = {
         VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME,
         VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
         VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME, // required by VK_KHR_acceleration_structure
         VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
     };
+    if (!headless) {
+        device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
     vk_init_params.instance_extensions = std::span{ instance_extensions };
     vk_init_params.device_extensions = std::span{ device_extensions };
 
@@ -73,6 +308,12 @@ void Vk_Demo::initialize(GLFWwindow* window) {
     descriptor_buffer_features.descriptorBuffer = VK_TRUE;
     pnexer.next(descriptor_buffer_features);
 
+    VkPhysicalDeviceDescriptorIndexingFeatures descriptor_indexing_features{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+    descriptor_indexing_features.runtimeDescriptorArray = VK_TRUE;
+    descriptor_indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    pnexer.next(descriptor_indexing_features);
+
     VkPhysicalDeviceAccelerationStructureFeaturesKHR acceleration_structure_features{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
     acceleration_structure_features.accelerationStructure = VK_TRUE;
@@ -96,6 +337,20 @@ void Vk_Demo::initialize(GLFWwindow* window) {
         VK_IMAGE_USAGE_STORAGE_BIT;
 
     vk_initialize(window, vk_init_params);
+    startup_phase_done("vulkan initialization");
+
+    // BC formats are not supported by many mobile GPUs, uncompressed textures are used in this case.
+    VkFormat texture_format = params.texture_format;
+    if (texture_format != VK_FORMAT_R8G8B8A8_SRGB && !vk.texture_compression_bc) {
+        printf("textureCompressionBC is not supported, falling back to uncompressed textures\n");
+        texture_format = VK_FORMAT_R8G8B8A8_SRGB;
+    }
+    printf("Texture format: %s\n", get_texture_format_name(texture_format));
+
+    // The default texture is loaded on a worker thread during geometry initialization.
+    std::future<Texture_Mips> default_texture_mips = run_async([texture_format, mip_filter = params.mip_filter] {
+        return load_texture_cached(get_resource_path("model/diffuse.jpg"), texture_format, mip_filter);
+    });
 
     // Device properties.
     {
@@ -128,47 +383,36 @@ void Vk_Demo::initialize(GLFWwindow* window) {
     }
 
     // Geometry buffers.
+    std::vector<Mesh_Shape> shapes;
+    Material_Texture_Loader texture_loader;
+    texture_loader.format = texture_format;
+    texture_loader.mip_filter = params.mip_filter;
     {
-        Triangle_Mesh mesh = load_obj_model(get_resource_path("model/mesh.obj"), 1.25f);
-        {
-            VkDeviceSize size = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-            gpu_mesh.vertex_buffer = vk_create_buffer(size, usage, mesh.vertices.data(), "vertex_buffer");
-            gpu_mesh.vertex_count = uint32_t(mesh.vertices.size());
+        PROFILE_SCOPE("create geometry buffers");
+        const std::string model_file = params.model_file.empty() ? get_resource_path("model/mesh.obj") : params.model_file;
+        if (model_file.ends_with(".glb") || model_file.ends_with(".GLB")) {
+            gpu_meshes.push_back(create_gpu_mesh_from_glb(model_file, &mesh_normalization_transform));
+            startup_phase_done("load mesh");
         }
-        {
-            VkDeviceSize size = mesh.indices.size() * sizeof(mesh.indices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-            gpu_mesh.index_buffer = vk_create_buffer(size, usage, mesh.indices.data(), "index_buffer");
-            gpu_mesh.index_count = uint32_t(mesh.indices.size());
+        else {
+            // OBJ and PLY models go through the mesh cache.
+            bool from_cache = false;
+            gpu_meshes = create_gpu_meshes_cached(model_file, params.quantize_vertices, &shapes, &texture_loader, &from_cache);
+            startup_phase_done(from_cache ? "load mesh (cached)" : "load mesh");
+        }
+        // Texture 0 is the default texture used by the shapes without diffuse texture.
+        for (size_t i = 0; i < shapes.size(); i++) {
+            if (shapes[i].material_index >= 0)
+                gpu_meshes[i].texture_index = uint32_t(texture_loader.material_files[shapes[i].material_index] + 1);
         }
     }
 
-    // Texture.
-    {
-        texture = vk_load_texture(get_resource_path("model/diffuse.jpg"));
-
-        VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-        create_info.magFilter = VK_FILTER_LINEAR;
-        create_info.minFilter = VK_FILTER_LINEAR;
-        create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-        create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        create_info.mipLodBias = 0.0f;
-        create_info.anisotropyEnable = VK_FALSE;
-        create_info.maxAnisotropy = 1;
-        create_info.minLod = 0.0f;
-        create_info.maxLod = 12.0f;
-
-        VK_CHECK(vkCreateSampler(vk.device, &create_info, nullptr, &sampler));
-        vk_set_debug_name(sampler, "diffuse_texture_sampler");
-    }
+    // Acceleration structures are built while the textures are still loading.
+    raytrace_scene.create(gpu_meshes);
 
     // ImGui setup.
-    {
+    if (!headless) {
+        PROFILE_SCOPE("ImGui setup");
         ImGui::CreateContext();
         ImGui_ImplGlfw_InitForVulkan(window, true);
 
@@ -189,32 +433,86 @@ void Vk_Demo::initialize(GLFWwindow* window) {
         ImGui_ImplVulkan_Init(&init_info);
         ImGui::StyleColorsDark();
         ImGui_ImplVulkan_CreateFontsTexture();
+        startup_phase_done("ImGui setup");
+    }
+
+    // Textures.
+    {
+        PROFILE_SCOPE("create textures");
+        {
+            Texture_Mips mips = default_texture_mips.get();
+            textures.push_back(vk_create_texture_from_mips(mips.width, mips.height, mips.format, mips.levels, "model/diffuse.jpg"));
+        }
+        for (size_t i = 0; i < texture_loader.files.size(); i++) {
+            Texture_Mips mips = texture_loader.loaded_files[i].get();
+            textures.push_back(vk_create_texture_from_mips(mips.width, mips.height, mips.format, mips.levels, texture_loader.files[i].c_str()));
+        }
+
+        VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        create_info.magFilter = VK_FILTER_LINEAR;
+        create_info.minFilter = VK_FILTER_LINEAR;
+        create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        create_info.mipLodBias = 0.0f;
+        create_info.anisotropyEnable = VK_FALSE;
+        create_info.maxAnisotropy = 1;
+        create_info.minLod = 0.0f;
+        create_info.maxLod = 12.0f;
+
+        VK_CHECK(vkCreateSampler(vk.device, &create_info, nullptr, &sampler));
+        vk_set_debug_name(sampler, "diffuse_texture_sampler");
+        startup_phase_done("load texture");
     }
 
-    draw_mesh.create(render_target_format, get_depth_image_format(), texture.view, sampler);
-    raytrace_scene.create(gpu_mesh, texture.view, sampler);
-    copy_to_swapchain.create();
+    std::vector<VkImageView> texture_views;
+    for (const Vk_Image& texture : textures)
+        texture_views.push_back(texture.view);
+
+    draw_mesh.create(render_target_format, get_depth_image_format(), texture_views, sampler);
+    startup_phase_done("draw_mesh pipeline");
+    raytrace_scene.create_pipeline(texture_views, sampler);
+    startup_phase_done("raytrace_scene pipeline");
+    if (!headless) {
+        copy_to_swapchain.create();
+        startup_phase_done("copy_to_swapchain pipeline");
+    }
     restore_resolution_dependent_resources();
 
-    gpu_times.frame = time_keeper.allocate_time_interval();
-    gpu_times.draw = time_keeper.allocate_time_interval();
-    gpu_times.compute_copy = time_keeper.allocate_time_interval();
+    if (vk.pipeline_executable_info) {
+        vk_write_pipeline_executable_statistics(params.shader_statistics_file);
+    }
+
+    gpu_times.frame = time_keeper.allocate_time_interval("frame");
+    gpu_times.tlas_build = time_keeper.allocate_time_interval("tlas_build");
+    gpu_times.trace_rays = time_keeper.allocate_time_interval("trace_rays");
+    gpu_times.rasterization = time_keeper.allocate_time_interval("rasterization", true);
+    gpu_times.ui = time_keeper.allocate_time_interval("ui", true);
+    gpu_times.swapchain_copy = time_keeper.allocate_time_interval("swapchain_copy", true);
     time_keeper.initialize_time_intervals();
+    startup_phase_done("render targets and queries");
 }
 
 void Vk_Demo::shutdown() {
     VK_CHECK(vkDeviceWaitIdle(vk.device));
 
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
+    if (!headless) {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+    }
 
     release_resolution_dependent_resources();
     vkDestroySampler(vk.device, sampler, nullptr);
 
-    gpu_mesh.destroy();
-    texture.destroy();
-    copy_to_swapchain.destroy();
+    for (GPU_Mesh& mesh : gpu_meshes)
+        mesh.destroy();
+    for (Vk_Image& texture : textures)
+        texture.destroy();
+    if (!headless) {
+        copy_to_swapchain.destroy();
+    }
     draw_mesh.destroy();
     raytrace_scene.destroy();
     
@@ -244,12 +542,15 @@ void Vk_Demo::restore_resolution_dependent_resources() {
     output_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, render_target_format,
         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, "output_image");
     raytrace_scene.update_output_image_descriptor(output_image.view);
-    copy_to_swapchain.update_resolution_dependent_descriptors(output_image.view);
+    if (!headless) {
+        copy_to_swapchain.update_resolution_dependent_descriptors(output_image.view);
+    }
 
     last_frame_time = Clock::now();
 }
 
 void Vk_Demo::run_frame() {
+    PROFILE_SCOPE("run_frame");
     Time current_time = Clock::now();
     if (animate) {
         double time_delta = std::chrono::duration_cast<std::chrono::microseconds>(current_time - last_frame_time).count() / 1e6;
@@ -257,7 +558,7 @@ void Vk_Demo::run_frame() {
     }
     last_frame_time = current_time;
 
-    Matrix3x4 object_to_world = rotate_y(Matrix3x4::identity, (float)sim_time * radians(20.0f));
+    Matrix3x4 object_to_world = rotate_y(Matrix3x4::identity, (float)sim_time * radians(20.0f)) * mesh_normalization_transform;
     Matrix3x4 world_to_camera = look_at_transform(camera_pos, Vector3(0), Vector3(0, 1, 0));
     Matrix3x4 object_to_camera = world_to_camera * object_to_world;
     Matrix3x4 camera_to_world = get_inverse(world_to_camera);
@@ -265,28 +566,148 @@ void Vk_Demo::run_frame() {
     draw_mesh.update(object_to_camera);
     raytrace_scene.update(object_to_world, camera_to_world);
 
-    do_imgui();
+    if (!headless) {
+        PROFILE_SCOPE("do_imgui");
+        do_imgui();
+    }
     draw_frame();
+
+    if (!first_frame_finished) {
+        // Include GPU time of the first frame in time-to-first-frame.
+        VK_CHECK(vkQueueWaitIdle(vk.queue));
+        startup_timer_finish("first frame", startup_report_file);
+        first_frame_finished = true;
+    }
+}
+
+// Deterministic camera path used by the benchmark: the model makes a full revolution
+// while the camera moves closer to the model and back. t is in [0, 1] range.
+static void get_benchmark_camera_state(float t, double* sim_time, Vector3* camera_pos) {
+    const double revolution_time = 360.0 / 20.0; // the model rotates 20 degrees per second
+    *sim_time = t * revolution_time;
+    *camera_pos = Vector3(0, 0.5f, 3.0f - 1.5f * std::sin(t * Pi));
+}
+
+std::vector<Benchmark_Run> Vk_Demo::run_benchmark(const Benchmark_Params& params) {
+    struct Benchmark_Config {
+        const char* name;
+        bool ray_tracing;
+        bool spp4;
+    };
+    const Benchmark_Config configs[] = {
+        { "ray_tracing",        true,   false },
+        { "ray_tracing_spp4",   true,   true  },
+        { "rasterization",      false,  false },
+    };
+
+    const bool saved_animate = animate;
+    const bool saved_ray_tracing_active = ray_tracing_active;
+    const bool saved_spp4 = spp4;
+    const double saved_sim_time = sim_time;
+    const Vector3 saved_camera_pos = camera_pos;
+    animate = false;
+
+    std::vector<Benchmark_Run> runs;
+    for (const Benchmark_Config& config : configs) {
+        printf("Benchmark: %s\n", config.name);
+        ray_tracing_active = config.ray_tracing;
+        spp4 = config.spp4;
+
+        Benchmark_Run run;
+        run.name = config.name;
+        run.ray_tracing = config.ray_tracing;
+        run.spp4 = config.spp4;
+        if (config.ray_tracing) {
+            run.rays_per_frame = uint64_t(vk.surface_size.width) * vk.surface_size.height * (config.spp4 ? 4 : 1);
+        }
+        for (uint32_t k = 0; k < time_keeper.time_interval_count; k++) {
+            const Vk_GPU_Time_Interval& interval = time_keeper.time_intervals[k];
+            run.gpu_interval_names.push_back(interval.name);
+            if (interval.pipeline_statistics_query != uint32_t(-1)) {
+                run.counter_names.push_back(std::string(interval.name) + "_vertex_invocations");
+                run.counter_names.push_back(std::string(interval.name) + "_fragment_invocations");
+                run.counter_names.push_back(std::string(interval.name) + "_compute_invocations");
+            }
+        }
+        run.gpu_interval_ms.resize(time_keeper.time_interval_count);
+        run.counter_values.resize(run.counter_names.size());
+
+        const int frame_count = params.warmup_frames + params.measured_frames;
+        for (int i = 0; i < frame_count; i++) {
+            const int path_frame = std::max(0, i - params.warmup_frames);
+            get_benchmark_camera_state(float(path_frame) / float(std::max(1, params.measured_frames - 1)), &sim_time, &camera_pos);
+
+            Timestamp t;
+            run_frame();
+            float cpu_frame_ms = float(double(elapsed_nanoseconds(t)) * 1e-6);
+
+            if (!headless) {
+                glfwPollEvents();
+            }
+            if (i < params.warmup_frames)
+                continue;
+
+            run.cpu_frame_ms.push_back(cpu_frame_ms);
+            for (uint32_t k = 0, counter = 0; k < time_keeper.time_interval_count; k++) {
+                const Vk_GPU_Time_Interval& interval = time_keeper.time_intervals[k];
+                const bool has_statistics = interval.pipeline_statistics_query != uint32_t(-1);
+                if (interval.last_frame_measured) {
+                    run.gpu_interval_ms[k].push_back(interval.last_length_ms);
+                    if (has_statistics) {
+                        const Vk_Pipeline_Statistics& statistics = interval.last_pipeline_statistics;
+                        run.counter_values[counter + 0].push_back(float(statistics.vertex_shader_invocations));
+                        run.counter_values[counter + 1].push_back(float(statistics.fragment_shader_invocations));
+                        run.counter_values[counter + 2].push_back(float(statistics.compute_shader_invocations));
+                    }
+                }
+                if (has_statistics) {
+                    counter += 3;
+                }
+            }
+            if (config.ray_tracing && gpu_times.trace_rays->last_frame_measured && gpu_times.trace_rays->last_length_ms > 0.f) {
+                run.mrays_per_second.push_back(float(double(run.rays_per_frame) / (double(gpu_times.trace_rays->last_length_ms) * 1e3)));
+            }
+        }
+        runs.push_back(std::move(run));
+    }
+    VK_CHECK(vkDeviceWaitIdle(vk.device));
+
+    animate = saved_animate;
+    ray_tracing_active = saved_ray_tracing_active;
+    spp4 = saved_spp4;
+    sim_time = saved_sim_time;
+    camera_pos = saved_camera_pos;
+    return runs;
 }
 
 void Vk_Demo::draw_frame() {
-    vk_begin_frame();
-    time_keeper.next_frame();
-    gpu_times.frame->begin();
-    if (ray_tracing_active) {
-        render_frame_ray_tracing();
+    PROFILE_SCOPE("draw_frame");
+    {
+        PROFILE_SCOPE("vk_begin_frame");
+        vk_begin_frame();
     }
-    else {
-        render_frame_rasterization();
+    {
+        PROFILE_SCOPE("record_commands");
+        time_keeper.next_frame();
+        gpu_times.frame->begin();
+        if (ray_tracing_active) {
+            render_frame_ray_tracing();
+        }
+        else {
+            render_frame_rasterization();
+        }
+        if (!headless) {
+            copy_output_image_to_swapchain();
+        }
+        gpu_times.frame->end();
+    }
+    {
+        PROFILE_SCOPE("vk_end_frame");
+        vk_end_frame();
     }
-    copy_output_image_to_swapchain();
-    gpu_times.frame->end();
-    vk_end_frame();
 }
 
 void Vk_Demo::render_frame_rasterization() {
-    VK_GPU_TIME_SCOPE(gpu_times.draw);
-
     vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
@@ -324,19 +745,34 @@ void Vk_Demo::render_frame_rasterization() {
     rendering_info.pDepthAttachment = &depth_attachment;
 
     vkCmdBeginRendering(vk.command_buffer, &rendering_info);
-    draw_mesh.dispatch(gpu_mesh, show_texture_lod);
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), vk.command_buffer);
+    {
+        VK_GPU_TIME_SCOPE(gpu_times.rasterization);
+        draw_mesh.dispatch(gpu_meshes, show_texture_lod);
+    }
+    if (!headless) {
+        VK_GPU_TIME_SCOPE(gpu_times.ui);
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), vk.command_buffer);
+    }
     vkCmdEndRendering(vk.command_buffer);
 }
 
 void Vk_Demo::render_frame_ray_tracing() {
-    VK_GPU_TIME_SCOPE(gpu_times.draw);
+    {
+        VK_GPU_TIME_SCOPE(gpu_times.tlas_build);
+        raytrace_scene.accelerator.rebuild_top_level_accel(vk.command_buffer);
+    }
+    {
+        VK_GPU_TIME_SCOPE(gpu_times.trace_rays);
+        vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
 
-    vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+        raytrace_scene.dispatch(spp4, show_texture_lod, show_traversal_cost);
+    }
+    if (headless)
+        return;
 
-    raytrace_scene.dispatch(spp4, show_texture_lod);
+    VK_GPU_TIME_SCOPE(gpu_times.ui);
 
     vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
@@ -360,7 +796,7 @@ void Vk_Demo::render_frame_ray_tracing() {
 }
 
 void Vk_Demo::copy_output_image_to_swapchain() {
-    VK_GPU_TIME_SCOPE(gpu_times.compute_copy);
+    VK_GPU_TIME_SCOPE(gpu_times.swapchain_copy);
 
     vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
@@ -415,9 +851,38 @@ void Vk_Demo::do_imgui() {
             ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav))
         {
             ImGui::Text("%.1f FPS (%.3f ms/frame)", ImGui::GetIO().Framerate, 1000.0f / ImGui::GetIO().Framerate);
-            ImGui::Text("Frame time         : %.2f ms", gpu_times.frame->length_ms);
-            ImGui::Text("Draw time          : %.2f ms", gpu_times.draw->length_ms);
-            ImGui::Text("Compute copy time  : %.2f ms", gpu_times.compute_copy->length_ms);
+            for (uint32_t i = 0; i < time_keeper.time_interval_count; i++) {
+                const Vk_GPU_Time_Interval& interval = time_keeper.time_intervals[i];
+                if (interval.last_frame_measured) {
+                    ImGui::Text("%-18s : %.2f ms", interval.name, interval.length_ms);
+                }
+            }
+            {
+                const Vk_GPU_Time_Interval& frame = *gpu_times.frame;
+                Vk_GPU_Time_Stats stats = frame.get_stats();
+                ImGui::PlotLines("##frame_time_history", frame.history_ms, (int)frame.history_count,
+                    (int)frame.get_history_offset(), nullptr, 0.f, 2.f * stats.p99_ms, ImVec2(0, 40));
+                ImGui::Text("min %.2f  median %.2f  p99 %.2f  max %.2f ms", stats.min_ms, stats.median_ms, stats.p99_ms, stats.max_ms);
+                ImGui::Text("Hitches            : %u", frame.hitch_count);
+                if (ImGui::Button("Save GPU time history")) {
+                    const char* file_name = "gpu_time_history.csv";
+                    time_keeper.write_history(file_name);
+                    printf("GPU time history saved to %s\n", file_name);
+                }
+            }
+            if (vk.pipeline_statistics && ImGui::CollapsingHeader("Shader invocations")) {
+                for (uint32_t i = 0; i < time_keeper.time_interval_count; i++) {
+                    const Vk_GPU_Time_Interval& interval = time_keeper.time_intervals[i];
+                    if (interval.pipeline_statistics_query == uint32_t(-1) || !interval.last_frame_measured)
+                        continue;
+                    const Vk_Pipeline_Statistics& statistics = interval.last_pipeline_statistics;
+                    ImGui::Text("%-18s : vs %llu  fs %llu  cs %llu", interval.name,
+                        (unsigned long long)statistics.vertex_shader_invocations,
+                        (unsigned long long)statistics.fragment_shader_invocations,
+                        (unsigned long long)statistics.compute_shader_invocations);
+                }
+                // Pipeline statistics queries do not count ray tracing shader invocations, so trace_rays is not listed here.
+            }
             ImGui::Separator();
             ImGui::Spacing();
             ImGui::Checkbox("Vertical sync", &vsync);
@@ -426,6 +891,21 @@ void Vk_Demo::do_imgui() {
 
             ImGui::Checkbox("Ray tracing", &ray_tracing_active);
             ImGui::Checkbox("4 rays per pixel", &spp4);
+            // The heatmap is not available without shader clock support.
+            if (ray_tracing_active && vk.shader_clock) {
+                ImGui::Checkbox("Show traversal cost", &show_traversal_cost);
+            }
+            if (ray_tracing_active && show_traversal_cost) {
+                const Traversal_Cost_Histogram& histogram = raytrace_scene.traversal_cost_histogram;
+                float bins[Traversal_Cost_Histogram::bin_count];
+                for (uint32_t i = 0; i < Traversal_Cost_Histogram::bin_count; i++) {
+                    bins[i] = float(histogram.bins[i]);
+                }
+                ImGui::PlotHistogram("##traversal_cost_histogram", bins, (int)std::size(bins), 0, nullptr, 0.f, FLT_MAX, ImVec2(0, 40));
+                ImGui::Text("Cost (clock ticks): median %llu  p99 %llu  max %u",
+                    (unsigned long long)histogram.get_percentile_cost(0.5f),
+                    (unsigned long long)histogram.get_percentile_cost(0.99f), histogram.max_cost);
+            }
 
             if (ImGui::BeginPopupContextWindow()) {
                 if (ImGui::MenuItem("Custom",       NULL, corner == -1)) corner = -1;
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "benchmark.h"
 #include "gpu_mesh.h"
 #include "lib.h"
+#include "texture_compression.h"
 
 #include "kernels/copy_to_swapchain.h"
 #include "kernels/draw_mesh.h"
@@ -11,9 +13,40 @@
 
 struct GLFWwindow;
 
+struct Demo_Init_Params {
+    // Headless mode renders into output_image without a window, swapchain and UI.
+    bool headless = false;
+    uint32_t headless_width = 0;
+    uint32_t headless_height = 0;
+
+    // Benchmark mode disables vsync and UI.
+    bool benchmark = false;
+
+    // Time-to-first-frame breakdown is saved to this JSON file. Not saved if empty.
+    std::string startup_report_file;
+
+    // Mesh file (.obj, .ply or .glb). The default model is used if empty.
+    std::string model_file;
+
+    // Texture format: VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_BC1_RGB_SRGB_BLOCK or VK_FORMAT_BC7_SRGB_BLOCK.
+    // Textures are converted to this format once and loaded from the texture cache afterwards.
+    // If the device does not support BC formats, VK_FORMAT_R8G8B8A8_SRGB is used.
+    VkFormat texture_format = VK_FORMAT_BC7_SRGB_BLOCK;
+
+    // Kernel used to build texture mips on a texture cache miss.
+    Mip_Filter_Params mip_filter;
+
+    // OBJ and PLY vertices are uploaded as Quantized_Position and Quantized_UV. GLB buffers are always used as is.
+    bool quantize_vertices = false;
+
+    // Shader statistics of the demo pipelines are saved to this JSON file. Not saved if empty.
+    std::string shader_statistics_file;
+};
+
 class Vk_Demo {
 public:
-    void initialize(GLFWwindow* glfw_window);
+    // glfw_window is ignored in headless mode.
+    void initialize(GLFWwindow* glfw_window, const Demo_Init_Params& params);
     void shutdown();
 
     void release_resolution_dependent_resources();
@@ -21,6 +54,9 @@ public:
     bool vsync_enabled() const { return vsync; }
     void run_frame();
 
+    // Renders each benchmark configuration along the same deterministic camera path.
+    std::vector<Benchmark_Run> run_benchmark(const Benchmark_Params& params);
+
 private:
     void draw_frame();
     void render_frame_rasterization();
@@ -32,11 +68,15 @@ private:
     using Clock = std::chrono::high_resolution_clock;
     using Time  = std::chrono::time_point<Clock>;
 
+    bool headless = false;
+    std::string startup_report_file;
+    bool first_frame_finished = false;
     bool show_ui = true;
     bool vsync = true;
     bool animate = false;
     bool ray_tracing_active = true;
     bool show_texture_lod = false;
+    bool show_traversal_cost = false;
     bool spp4 = false;
 
     Time last_frame_time;
@@ -46,14 +86,18 @@ private:
     Vk_GPU_Time_Keeper time_keeper;
     struct {
         Vk_GPU_Time_Interval* frame;
-        Vk_GPU_Time_Interval* draw;
-        Vk_GPU_Time_Interval* compute_copy;
+        Vk_GPU_Time_Interval* tlas_build;
+        Vk_GPU_Time_Interval* trace_rays;
+        Vk_GPU_Time_Interval* rasterization;
+        Vk_GPU_Time_Interval* ui;
+        Vk_GPU_Time_Interval* swapchain_copy;
     } gpu_times;
 
     Vk_Image depth_buffer_image;
     Vk_Image output_image;
-    GPU_Mesh gpu_mesh;
-    Vk_Image texture;
+    std::vector<GPU_Mesh> gpu_meshes;
+    Matrix3x4 mesh_normalization_transform = Matrix3x4::identity;
+    std::vector<Vk_Image> textures;
     VkSampler sampler;
     Copy_To_Swapchain copy_to_swapchain;
     Draw_Mesh draw_mesh;
@@ -0,0 +1,531 @@
+#include "gltf_loader.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+constexpr uint32_t glb_magic = 0x46546c67; // "glTF"
+constexpr uint32_t glb_chunk_json = 0x4e4f534a; // "JSON"
+constexpr uint32_t glb_chunk_bin = 0x004e4942; // "BIN\0"
+
+constexpr uint32_t component_type_byte = 5120;
+constexpr uint32_t component_type_unsigned_byte = 5121;
+constexpr uint32_t component_type_short = 5122;
+constexpr uint32_t component_type_unsigned_short = 5123;
+constexpr uint32_t component_type_unsigned_int = 5125;
+constexpr uint32_t component_type_float = 5126;
+
+constexpr uint32_t primitive_mode_triangles = 4;
+
+// Minimal JSON DOM that is sufficient to read glTF structure.
+struct Json_Value {
+    enum class Type { null, boolean, number, string, array, object };
+    Type type = Type::null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json_Value> array;
+    std::vector<std::pair<std::string, Json_Value>> object;
+
+    // Returns nullptr if the key is not found or the value is not an object.
+    const Json_Value* find(const char* key) const {
+        for (const auto& [name, value] : object) {
+            if (name == key)
+                return &value;
+        }
+        return nullptr;
+    }
+};
+
+struct Json_Parser {
+    // Arrays and objects are parsed recursively, the limit prevents stack overflow on malformed files.
+    static constexpr int max_depth = 64;
+
+    const char* p;
+    const char* end;
+    int depth = 0;
+
+    void fail(const char* message) {
+        error(std::string("failed to parse glb json: ") + message);
+    }
+
+    void skip_whitespace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    void expect(char c) {
+        skip_whitespace();
+        if (p == end || *p != c)
+            fail("unexpected character");
+        p++;
+    }
+
+    bool consume(const char* literal) {
+        size_t length = strlen(literal);
+        if (size_t(end - p) < length || memcmp(p, literal, length) != 0)
+            return false;
+        p += length;
+        return true;
+    }
+
+    std::string parse_string() {
+        expect('"');
+        std::string result;
+        while (true) {
+            if (p == end)
+                fail("unterminated string");
+            char c = *p++;
+            if (c == '"')
+                break;
+            if (c != '\\') {
+                result.push_back(c);
+                continue;
+            }
+            if (p == end)
+                fail("unterminated string");
+            c = *p++;
+            switch (c) {
+            case 'b': result.push_back('\b'); break;
+            case 'f': result.push_back('\f'); break;
+            case 'n': result.push_back('\n'); break;
+            case 'r': result.push_back('\r'); break;
+            case 't': result.push_back('\t'); break;
+            case 'u': {
+                if (end - p < 4)
+                    fail("invalid unicode escape");
+                uint32_t code = (uint32_t)strtoul(std::string(p, 4).c_str(), nullptr, 16);
+                p += 4;
+                // UTF-8 encoding. Surrogate pairs are not combined, names with such characters are not used for lookups.
+                if (code < 0x80) {
+                    result.push_back(char(code));
+                } else if (code < 0x800) {
+                    result.push_back(char(0xc0 | (code >> 6)));
+                    result.push_back(char(0x80 | (code & 0x3f)));
+                } else {
+                    result.push_back(char(0xe0 | (code >> 12)));
+                    result.push_back(char(0x80 | ((code >> 6) & 0x3f)));
+                    result.push_back(char(0x80 | (code & 0x3f)));
+                }
+                break;
+            }
+            default: result.push_back(c); break; // '"', '\\', '/'
+            }
+        }
+        return result;
+    }
+
+    void parse_value(Json_Value& value) {
+        if (depth == max_depth)
+            fail("nesting is too deep");
+        depth++;
+        parse_value_impl(value);
+        depth--;
+    }
+
+    void parse_value_impl(Json_Value& value) {
+        skip_whitespace();
+        if (p == end)
+            fail("unexpected end of data");
+
+        if (*p == '{') {
+            p++;
+            value.type = Json_Value::Type::object;
+            skip_whitespace();
+            if (p < end && *p == '}') {
+                p++;
+                return;
+            }
+            while (true) {
+                std::string key = parse_string();
+                expect(':');
+                value.object.emplace_back(std::move(key), Json_Value{});
+                parse_value(value.object.back().second);
+                skip_whitespace();
+                if (p < end && *p == ',') {
+                    p++;
+                    continue;
+                }
+                expect('}');
+                return;
+            }
+        } else if (*p == '[') {
+            p++;
+            value.type = Json_Value::Type::array;
+            skip_whitespace();
+            if (p < end && *p == ']') {
+                p++;
+                return;
+            }
+            while (true) {
+                value.array.emplace_back();
+                parse_value(value.array.back());
+                skip_whitespace();
+                if (p < end && *p == ',') {
+                    p++;
+                    continue;
+                }
+                expect(']');
+                return;
+            }
+        } else if (*p == '"') {
+            value.type = Json_Value::Type::string;
+            value.string = parse_string();
+        } else if (consume("true")) {
+            value.type = Json_Value::Type::boolean;
+            value.boolean = true;
+        } else if (consume("false")) {
+            value.type = Json_Value::Type::boolean;
+            value.boolean = false;
+        } else if (consume("null")) {
+            value.type = Json_Value::Type::null;
+        } else {
+            const char* number_end = p;
+            while (number_end < end && strchr("+-0123456789.eE", *number_end))
+                number_end++;
+            if (number_end == p)
+                fail("unexpected character");
+            value.type = Json_Value::Type::number;
+            value.number = strtod(std::string(p, number_end).c_str(), nullptr);
+            p = number_end;
+        }
+    }
+};
+
+struct Accessor {
+    const uint8_t* data = nullptr; // first element
+    uint32_t count = 0;
+    uint32_t component_type = 0;
+    uint32_t component_count = 0;
+    uint32_t component_size = 0;
+    uint32_t stride = 0;
+    bool normalized = false;
+
+    bool has_bounds = false;
+    float min[3] = {};
+    float max[3] = {};
+
+    uint32_t get_element_size() const { return component_count * component_size; }
+    uint64_t get_byte_size() const { return count == 0 ? 0 : uint64_t(count - 1) * stride + get_element_size(); }
+};
+} // namespace
+
+static const Json_Value& get_member(const Json_Value& value, const char* key) {
+    const Json_Value* member = value.find(key);
+    if (member == nullptr)
+        error(std::string("glb: missing required property: ") + key);
+    return *member;
+}
+
+static const Json_Value& get_array_element(const Json_Value& value, const char* array_name, uint32_t index) {
+    const Json_Value& array = get_member(value, array_name);
+    if (index >= array.array.size())
+        error(std::string("glb: invalid index in ") + array_name);
+    return array.array[index];
+}
+
+static uint32_t get_uint(const Json_Value& value, const char* key, uint32_t default_value) {
+    const Json_Value* member = value.find(key);
+    if (member == nullptr)
+        return default_value;
+    // Values that do not fit into 32 bits are rejected, otherwise they would wrap around and pass the bounds checks.
+    if (member->type != Json_Value::Type::number || member->number < 0.0 || member->number > double(UINT32_MAX) ||
+        member->number != std::floor(member->number))
+        error(std::string("glb: invalid value of ") + key);
+    return uint32_t(member->number);
+}
+
+static uint32_t get_component_size(uint32_t component_type) {
+    switch (component_type) {
+    case component_type_byte:
+    case component_type_unsigned_byte:
+        return 1;
+    case component_type_short:
+    case component_type_unsigned_short:
+        return 2;
+    case component_type_unsigned_int:
+    case component_type_float:
+        return 4;
+    default:
+        error("glb: unsupported accessor component type");
+        return 0;
+    }
+}
+
+static uint32_t get_component_count(const std::string& type) {
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    error("glb: unsupported accessor type: " + type);
+    return 0;
+}
+
+static Accessor get_accessor(const Json_Value& json, uint32_t accessor_index, std::span<const uint8_t> bin) {
+    const Json_Value& accessor_json = get_array_element(json, "accessors", accessor_index);
+    if (accessor_json.find("sparse"))
+        error("glb: sparse accessors are not supported");
+
+    Accessor accessor;
+    accessor.count = get_uint(accessor_json, "count", 0);
+    accessor.component_type = get_uint(accessor_json, "componentType", 0); // 0 is rejected by get_component_size
+    accessor.component_size = get_component_size(accessor.component_type);
+    accessor.component_count = get_component_count(get_member(accessor_json, "type").string);
+    if (const Json_Value* normalized = accessor_json.find("normalized"))
+        accessor.normalized = normalized->boolean;
+
+    const Json_Value* min = accessor_json.find("min");
+    const Json_Value* max = accessor_json.find("max");
+    if (min && max && min->array.size() >= 3 && max->array.size() >= 3) {
+        accessor.has_bounds = true;
+        for (int i = 0; i < 3; i++) {
+            accessor.min[i] = float(min->array[i].number);
+            accessor.max[i] = float(max->array[i].number);
+        }
+    }
+
+    const Json_Value& buffer_view = get_array_element(json, "bufferViews", get_uint(accessor_json, "bufferView", UINT32_MAX));
+    if (get_uint(buffer_view, "buffer", 0) != 0)
+        error("glb: only the binary chunk buffer is supported");
+
+    const uint64_t view_offset = get_uint(buffer_view, "byteOffset", 0);
+    const uint64_t view_length = get_uint(buffer_view, "byteLength", 0);
+    const uint64_t accessor_offset = get_uint(accessor_json, "byteOffset", 0);
+    accessor.stride = get_uint(buffer_view, "byteStride", accessor.get_element_size());
+
+    if (view_offset + view_length > bin.size() || accessor_offset + accessor.get_byte_size() > view_length)
+        error("glb: accessor data is out of bounds");
+
+    accessor.data = bin.data() + view_offset + accessor_offset;
+    return accessor;
+}
+
+// Reads component as float. Normalized integer components are converted to [0, 1] or [-1, 1] range.
+static float read_component(const Accessor& accessor, uint32_t element, uint32_t component) {
+    const uint8_t* ptr = accessor.data + size_t(element) * accessor.stride + component * accessor.component_size;
+    switch (accessor.component_type) {
+    case component_type_float: {
+        float value;
+        memcpy(&value, ptr, 4);
+        return value;
+    }
+    case component_type_unsigned_byte:
+        return accessor.normalized ? float(*ptr) / 255.f : float(*ptr);
+    case component_type_byte: {
+        int8_t value = int8_t(*ptr);
+        return accessor.normalized ? std::max(float(value) / 127.f, -1.f) : float(value);
+    }
+    case component_type_unsigned_short: {
+        uint16_t value;
+        memcpy(&value, ptr, 2);
+        return accessor.normalized ? float(value) / 65535.f : float(value);
+    }
+    case component_type_short: {
+        int16_t value;
+        memcpy(&value, ptr, 2);
+        return accessor.normalized ? std::max(float(value) / 32767.f, -1.f) : float(value);
+    }
+    case component_type_unsigned_int: {
+        uint32_t value;
+        memcpy(&value, ptr, 4);
+        return float(value);
+    }
+    }
+    return 0.f;
+}
+
+static uint32_t read_index(const Accessor& accessor, uint32_t element) {
+    const uint8_t* ptr = accessor.data + size_t(element) * accessor.stride;
+    switch (accessor.component_size) {
+    case 1:
+        return *ptr;
+    case 2: {
+        uint16_t value;
+        memcpy(&value, ptr, 2);
+        return value;
+    }
+    default: {
+        uint32_t value;
+        memcpy(&value, ptr, 4);
+        return value;
+    }
+    }
+}
+
+static bool is_float_attribute(const Accessor& accessor, uint32_t component_count, std::span<const uint8_t> bin) {
+    return accessor.component_type == component_type_float && accessor.component_count == component_count &&
+        accessor.stride % 4 == 0 && (accessor.data - bin.data()) % 4 == 0;
+}
+
+uint64_t GLB_Mesh::get_vertex_data_size() const {
+    uint64_t size = 0;
+    for (std::span<const uint8_t> range : vertex_data)
+        size += range.size();
+    return size;
+}
+
+GLB_Mesh load_glb_mesh(const std::string& path) {
+    PROFILE_SCOPE("load_glb_mesh");
+    GLB_Mesh mesh;
+    if (!mesh.file.map(path))
+        error("failed to load glb file: " + path);
+
+    // Header and chunks.
+    std::span<const uint8_t> json_chunk;
+    std::span<const uint8_t> bin;
+    {
+        const uint8_t* data = mesh.file.data;
+        const size_t size = mesh.file.size;
+        uint32_t header[3];
+        if (size < sizeof(header))
+            error("invalid glb file: " + path);
+        memcpy(header, data, sizeof(header));
+        if (header[0] != glb_magic || header[1] != 2 || header[2] > size)
+            error("invalid glb file or unsupported version: " + path);
+
+        size_t offset = sizeof(header);
+        while (offset + 8 <= header[2]) {
+            uint32_t chunk_header[2]; // length, type
+            memcpy(chunk_header, data + offset, sizeof(chunk_header));
+            offset += 8;
+            if (offset + chunk_header[0] > header[2])
+                error("invalid glb chunk: " + path);
+            if (chunk_header[1] == glb_chunk_json && json_chunk.empty())
+                json_chunk = { data + offset, chunk_header[0] };
+            else if (chunk_header[1] == glb_chunk_bin && bin.empty())
+                bin = { data + offset, chunk_header[0] };
+            offset += round_up(size_t(chunk_header[0]), size_t(4));
+        }
+        if (json_chunk.empty())
+            error("glb file does not have json chunk: " + path);
+    }
+
+    Json_Value json;
+    {
+        PROFILE_SCOPE("parse glb json");
+        Json_Parser parser{ (const char*)json_chunk.data(), (const char*)json_chunk.data() + json_chunk.size() };
+        parser.parse_value(json);
+    }
+
+    const Json_Value& primitive = get_array_element(get_array_element(json, "meshes", 0), "primitives", 0);
+    if (get_uint(primitive, "mode", primitive_mode_triangles) != primitive_mode_triangles)
+        error("glb: only triangle primitives are supported");
+
+    const Json_Value& attributes = get_member(primitive, "attributes");
+    const Accessor position = get_accessor(json, get_uint(attributes, "POSITION", UINT32_MAX), bin);
+    if (position.component_count != 3)
+        error("glb: POSITION should have 3 components");
+
+    Accessor uv;
+    const bool has_uv = attributes.find("TEXCOORD_0") != nullptr;
+    if (has_uv) {
+        uv = get_accessor(json, get_uint(attributes, "TEXCOORD_0", UINT32_MAX), bin);
+        if (uv.count != position.count)
+            error("glb: TEXCOORD_0 and POSITION have different number of elements");
+    }
+    mesh.vertex_count = position.count;
+
+    // Vertices.
+    if (has_uv && is_float_attribute(position, 3, bin) && is_float_attribute(uv, 2, bin)) {
+        std::span<const uint8_t> position_range(position.data, position.get_byte_size());
+        std::span<const uint8_t> uv_range(uv.data, uv.get_byte_size());
+        mesh.position_stride = position.stride;
+        mesh.uv_stride = uv.stride;
+
+        // Interleaved attributes are uploaded as a single range, separate arrays as two ranges.
+        const uint8_t* begin = std::min(position_range.data(), uv_range.data());
+        const uint8_t* end = std::max(position_range.data() + position_range.size(), uv_range.data() + uv_range.size());
+        if (uint64_t(end - begin) <= position_range.size() + uv_range.size()) {
+            mesh.vertex_data.push_back({ begin, size_t(end - begin) });
+            mesh.position_offset = uint32_t(position_range.data() - begin);
+            mesh.uv_offset = uint32_t(uv_range.data() - begin);
+        } else {
+            mesh.vertex_data.push_back(position_range);
+            mesh.vertex_data.push_back(uv_range);
+            mesh.position_offset = 0;
+            mesh.uv_offset = uint32_t(position_range.size()); // multiple of 4 since stride is a multiple of 4
+        }
+    } else {
+        PROFILE_SCOPE("convert glb vertices");
+        mesh.vertices_converted = true;
+        mesh.converted_vertices.resize(position.count);
+        for (uint32_t i = 0; i < position.count; i++) {
+            Vertex& v = mesh.converted_vertices[i];
+            v.pos = Vector3(read_component(position, i, 0), read_component(position, i, 1), read_component(position, i, 2));
+            if (has_uv)
+                v.uv = Vector2(read_component(uv, i, 0), read_component(uv, i, 1));
+        }
+        mesh.vertex_data.push_back({ (const uint8_t*)mesh.converted_vertices.data(), mesh.converted_vertices.size() * sizeof(Vertex) });
+        mesh.position_offset = offsetof(Vertex, pos);
+        mesh.position_stride = sizeof(Vertex);
+        mesh.uv_offset = offsetof(Vertex, uv);
+        mesh.uv_stride = sizeof(Vertex);
+    }
+
+    // Indices.
+    if (primitive.find("indices")) {
+        const Accessor indices = get_accessor(json, get_uint(primitive, "indices", UINT32_MAX), bin);
+        // The specification allows only unsigned integer index types.
+        if (indices.component_count != 1 || (indices.component_type != component_type_unsigned_byte &&
+            indices.component_type != component_type_unsigned_short && indices.component_type != component_type_unsigned_int))
+            error("glb: invalid index accessor");
+        if (indices.count == 0)
+            error("glb: primitive has no indices");
+        mesh.index_count = indices.count;
+
+        // Indices are validated against the vertex count, so out of range values can't reach the GPU.
+        uint32_t max_index = 0;
+        const bool tightly_packed = (indices.stride == indices.component_size);
+        if (tightly_packed && (indices.component_size == 2 || indices.component_size == 4)) {
+            mesh.index_data = { indices.data, size_t(indices.get_byte_size()) };
+            mesh.index_size = indices.component_size;
+            for (uint32_t i = 0; i < indices.count; i++)
+                max_index = std::max(max_index, read_index(indices, i));
+        } else {
+            PROFILE_SCOPE("convert glb indices");
+            mesh.indices_converted = true;
+            mesh.index_size = (indices.component_size == 4) ? 4 : 2;
+            mesh.converted_indices.resize(size_t(indices.count) * mesh.index_size);
+            for (uint32_t i = 0; i < indices.count; i++) {
+                uint32_t index = read_index(indices, i);
+                max_index = std::max(max_index, index);
+                memcpy(&mesh.converted_indices[size_t(i) * mesh.index_size], &index, mesh.index_size); // little-endian
+            }
+            mesh.index_data = mesh.converted_indices;
+        }
+        if (max_index >= mesh.vertex_count)
+            error("glb: index out of range");
+    } else {
+        // Non-indexed geometry.
+        if (position.count == 0)
+            error("glb: primitive has no vertices");
+        mesh.indices_converted = true;
+        mesh.index_count = position.count;
+        mesh.index_size = 4;
+        mesh.converted_indices.resize(size_t(position.count) * 4);
+        for (uint32_t i = 0; i < position.count; i++)
+            memcpy(&mesh.converted_indices[size_t(i) * 4], &i, 4);
+        mesh.index_data = mesh.converted_indices;
+    }
+    if (mesh.index_count % 3 != 0)
+        error("glb: index count is not a multiple of 3");
+
+    // Bounds. POSITION accessor is required to have min/max by the specification.
+    if (position.has_bounds) {
+        mesh.bounds_min = Vector3(position.min[0], position.min[1], position.min[2]);
+        mesh.bounds_max = Vector3(position.max[0], position.max[1], position.max[2]);
+    } else {
+        mesh.bounds_min = Vector3(Infinity);
+        mesh.bounds_max = Vector3(-Infinity);
+        for (uint32_t i = 0; i < position.count; i++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                mesh.bounds_min[k] = std::min(mesh.bounds_min[k], read_component(position, i, k));
+                mesh.bounds_max[k] = std::max(mesh.bounds_max[k], read_component(position, i, k));
+            }
+        }
+    }
+    return mesh;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "lib.h"
+
+#include <span>
+
+// Geometry of the first primitive of the first mesh in a binary glTF 2.0 (.glb) file. Node transforms,
+// materials and other attributes are ignored.
+//
+// When positions are float3, texture coordinates are float2 and indices are 16 or 32 bit (the common case),
+// the data spans point directly into the memory-mapped file and are uploaded without per-vertex conversion.
+// Otherwise the vertices are converted to Vertex array and the indices to 16 or 32 bit format.
+struct GLB_Mesh {
+    // Byte ranges that should be copied consecutively into the vertex buffer.
+    std::vector<std::span<const uint8_t>> vertex_data;
+    // Attribute location in the vertex buffer, in bytes. Offsets and strides are multiples of 4.
+    uint32_t position_offset = 0;
+    uint32_t position_stride = 0;
+    uint32_t uv_offset = 0;
+    uint32_t uv_stride = 0;
+
+    std::span<const uint8_t> index_data;
+    uint32_t index_size = 4; // 2 or 4 bytes
+
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+    // Vertices are not normalized, get_normalization_transform can be used to center and scale the mesh.
+    Vector3 bounds_min;
+    Vector3 bounds_max;
+
+    bool vertices_converted = false;
+    bool indices_converted = false;
+
+    uint64_t get_vertex_data_size() const;
+
+private:
+    friend GLB_Mesh load_glb_mesh(const std::string& path);
+    Mapped_File file;
+    std::vector<Vertex> converted_vertices;
+    std::vector<uint8_t> converted_indices;
+};
+
+GLB_Mesh load_glb_mesh(const std::string& path);
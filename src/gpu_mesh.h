@@ -1,17 +1,59 @@
-#pragma once 
+#pragma once
 
+#include "lib.h"
 #include "vk.h"
 
+#include <cstddef>
+
+// Location and format of vertex attributes in the vertex buffer. The default layout is an array of
+// Vertex structures. Offsets and strides are multiples of 4.
+struct GPU_Vertex_Layout {
+    uint32_t position_offset = offsetof(Vertex, pos);
+    uint32_t position_stride = sizeof(Vertex);
+    uint32_t uv_offset = offsetof(Vertex, uv);
+    uint32_t uv_stride = sizeof(Vertex);
+    bool quantized = false; // R16G16B16A16_SNORM positions and R16G16_SFLOAT uvs instead of R32G32B32_SFLOAT and R32G32_SFLOAT
+    // Maps quantized positions to object space, identity for float positions.
+    Vertex_Quantization position_quantization;
+
+    // Positions of all vertices are followed by texture coordinates of all vertices, so BLAS builds and
+    // position-only passes read a tightly packed stream. quantization is used only if quantized is true.
+    static GPU_Vertex_Layout get_split_layout(uint32_t vertex_count, bool quantized, const Vertex_Quantization& quantization) {
+        GPU_Vertex_Layout layout;
+        layout.quantized = quantized;
+        if (quantized)
+            layout.position_quantization = quantization;
+        layout.position_offset = 0;
+        layout.position_stride = quantized ? sizeof(Quantized_Position) : sizeof(Vector3);
+        const uint64_t uv_offset = uint64_t(vertex_count) * layout.position_stride;
+        if (uv_offset > UINT32_MAX)
+            error("Too many vertices for 32-bit vertex attribute offsets: " + std::to_string(vertex_count));
+        layout.uv_offset = uint32_t(uv_offset);
+        layout.uv_stride = quantized ? sizeof(Quantized_UV) : sizeof(Vector2);
+        return layout;
+    }
+    // Size of the buffer with the split layout.
+    uint64_t get_split_vertex_buffer_size(uint32_t vertex_count) const {
+        return uv_offset + uint64_t(vertex_count) * uv_stride;
+    }
+    VkFormat get_position_format() const { return quantized ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT; }
+    VkFormat get_uv_format() const { return quantized ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT; }
+};
+
 struct GPU_Mesh {
     Vk_Buffer vertex_buffer;
     Vk_Buffer index_buffer;
+    VkDeviceSize vertex_buffer_size = 0;
+    VkDeviceSize index_buffer_size = 0;
     uint32_t vertex_count = 0;
     uint32_t index_count = 0;
+    VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+    GPU_Vertex_Layout vertex_layout;
+    uint32_t texture_index = 0; // index in the scene texture list
 
     void destroy() {
         vertex_buffer.destroy();
         index_buffer.destroy();
-        vertex_count = 0;
-        index_count = 0;
+        *this = GPU_Mesh{};
     }
 };
@@ -1,5 +1,6 @@
 #include "copy_to_swapchain.h"
 #include "lib.h"
+#include "profiler.h"
 
 void Copy_To_Swapchain::create()
 {
@@ -14,9 +15,11 @@ void Copy_To_Swapchain::create()
         { VkPushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0, 8 /*uint32 width + uint32 height*/} },
         "copy_to_swapchain_pipeline_layout");
 
-    Vk_Shader_Module compute_shader(get_resource_path("spirv/copy_to_swapchain.comp.spv"));
-
-    pipeline = vk_create_compute_pipeline(compute_shader.handle, pipeline_layout, "copy_to_swapchain_pipeline");
+    {
+        PROFILE_SCOPE("create copy_to_swapchain pipeline");
+        Vk_Shader_Module compute_shader(get_resource_path("spirv/copy_to_swapchain.comp.spv"));
+        pipeline = vk_create_compute_pipeline(compute_shader.handle, pipeline_layout, "copy_to_swapchain_pipeline");
+    }
 
     // point sampler
     {
@@ -1,8 +1,9 @@
 #include "draw_mesh.h"
 #include "gpu_mesh.h"
 #include "lib.h"
+#include "profiler.h"
 
-void Draw_Mesh::create(VkFormat color_attachment_format, VkFormat depth_attachment_format, VkImageView texture_view, VkSampler sampler) {
+void Draw_Mesh::create(VkFormat color_attachment_format, VkFormat depth_attachment_format, const std::vector<VkImageView>& texture_views, VkSampler sampler) {
     uniform_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(sizeof(Matrix4x4)),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &mapped_uniform_buffer, "raster_uniform_buffer");
 
@@ -14,41 +15,57 @@ void Draw_Mesh::create(VkFormat color_attachment_format, VkFormat depth_attachme
 
     pipeline_layout = vk_create_pipeline_layout(
         { descriptor_set_layout },
-        { VkPushConstantRange{VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4} },
+        { VkPushConstantRange{VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4}, VkPushConstantRange{VK_SHADER_STAGE_VERTEX_BIT, 16, 32} },
         "raster_pipeline_layout");
 
     // pipeline
     {
+        PROFILE_SCOPE("create draw_mesh pipeline");
         Vk_Shader_Module vertex_shader(get_resource_path("spirv/raster_mesh.vert.spv"));
         Vk_Shader_Module fragment_shader(get_resource_path("spirv/raster_mesh.frag.spv"));
 
         Vk_Graphics_Pipeline_State state = get_default_graphics_pipeline_state();
 
         // VkVertexInputBindingDescription
+        // Positions and texture coordinates use separate bindings, so they can be stored either interleaved
+        // or in separate arrays. The offsets and strides come from the mesh's vertex layout (dynamic stride).
         state.vertex_bindings[0].binding = 0;
-        state.vertex_bindings[0].stride = sizeof(Vertex);
+        state.vertex_bindings[0].stride = 0;
         state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        state.vertex_binding_count = 1;
+        state.vertex_bindings[1].binding = 1;
+        state.vertex_bindings[1].stride = 0;
+        state.vertex_bindings[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        state.vertex_binding_count = 2;
 
         // VkVertexInputAttributeDescription
         state.vertex_attributes[0].location = 0; // vertex
         state.vertex_attributes[0].binding = 0;
-        state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
         state.vertex_attributes[0].offset = 0;
 
         state.vertex_attributes[1].location = 1; // uv
-        state.vertex_attributes[1].binding = 0;
-        state.vertex_attributes[1].format = VK_FORMAT_R32G32_SFLOAT;
-        state.vertex_attributes[1].offset = 12;
+        state.vertex_attributes[1].binding = 1;
+        state.vertex_attributes[1].offset = 0;
 
         state.vertex_attribute_count = 2;
 
+        state.dynamic_state[state.dynamic_state_count++] = VK_DYNAMIC_STATE_VERTEX_INPUT_BINDING_STRIDE;
+
         state.color_attachment_formats[0] = color_attachment_format;
         state.color_attachment_count = 1;
         state.depth_attachment_format = depth_attachment_format;
 
+        // The pipelines differ only in vertex attribute formats.
+        GPU_Vertex_Layout layout;
+        state.vertex_attributes[0].format = layout.get_position_format();
+        state.vertex_attributes[1].format = layout.get_uv_format();
         pipeline = vk_create_graphics_pipeline(state, vertex_shader.handle, fragment_shader.handle,
             pipeline_layout, "draw_mesh_pipeline");
+
+        layout.quantized = true;
+        state.vertex_attributes[0].format = layout.get_position_format();
+        state.vertex_attributes[1].format = layout.get_uv_format();
+        quantized_pipeline = vk_create_graphics_pipeline(state, vertex_shader.handle, fragment_shader.handle,
+            pipeline_layout, "draw_mesh_quantized_pipeline");
     }
 
     // Descriptor buffer.
@@ -60,54 +77,59 @@ void Draw_Mesh::create(VkFormat color_attachment_format, VkFormat depth_attachme
 
         VkDeviceSize layout_size_in_bytes = 0;
         vkGetDescriptorSetLayoutSizeEXT(vk.device, descriptor_set_layout, &layout_size_in_bytes);
-        std::vector<uint8_t> descriptor_data(layout_size_in_bytes);
-
-        // Get descriptor 0 (uniform buffer)
-        {
-            VkDescriptorAddressInfoEXT address_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
-            address_info.address = uniform_buffer.device_address;
-            address_info.range = sizeof(Matrix4x4);
-
-            VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
-            descriptor_info.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptor_info.data.pUniformBuffer = &address_info;
-
-            VkDeviceSize offset;
-            vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 0, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.uniformBufferDescriptorSize,
-                descriptor_data.data() + offset);
-        }
-        // Get descriptor 1 (sampled image)
-        {
-            VkDescriptorImageInfo image_info;
-            image_info.imageView = texture_view;
-            image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-            VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
-            descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-            descriptor_info.data.pSampledImage = &image_info;
-
-            VkDeviceSize offset;
-            vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 1, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
-                descriptor_data.data() + offset);
-        }
-        // Get descriptor 2 (sampler)
-        {
-            VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
-            descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
-            descriptor_info.data.pSampler = &sampler;
-
-            VkDeviceSize offset;
-            vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 2, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
-                descriptor_data.data() + offset);
+        descriptor_set_size = round_up(layout_size_in_bytes, descriptor_buffer_properties.descriptorBufferOffsetAlignment);
+        std::vector<uint8_t> descriptor_data(descriptor_set_size * texture_views.size());
+
+        // The sets differ only in the sampled image descriptor.
+        for (size_t i = 0; i < texture_views.size(); i++) {
+            uint8_t* set_data = descriptor_data.data() + i * descriptor_set_size;
+            // Get descriptor 0 (uniform buffer)
+            {
+                VkDescriptorAddressInfoEXT address_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
+                address_info.address = uniform_buffer.device_address;
+                address_info.range = sizeof(Matrix4x4);
+
+                VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+                descriptor_info.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                descriptor_info.data.pUniformBuffer = &address_info;
+
+                VkDeviceSize offset;
+                vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 0, &offset);
+                vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.uniformBufferDescriptorSize,
+                    set_data + offset);
+            }
+            // Get descriptor 1 (sampled image)
+            {
+                VkDescriptorImageInfo image_info;
+                image_info.imageView = texture_views[i];
+                image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+                VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+                descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                descriptor_info.data.pSampledImage = &image_info;
+
+                VkDeviceSize offset;
+                vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 1, &offset);
+                vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
+                    set_data + offset);
+            }
+            // Get descriptor 2 (sampler)
+            {
+                VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+                descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+                descriptor_info.data.pSampler = &sampler;
+
+                VkDeviceSize offset;
+                vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 2, &offset);
+                vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
+                    set_data + offset);
+            }
         }
         VkBufferUsageFlags usage =
             VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
             VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT |
             VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        descriptor_buffer = vk_create_buffer_with_alignment(layout_size_in_bytes, usage,
+        descriptor_buffer = vk_create_buffer_with_alignment(descriptor_data.size(), usage,
             (uint32_t)descriptor_buffer_properties.descriptorBufferOffsetAlignment,
             descriptor_data.data(), "draw_mesh_descriptor_buffer");
     }
@@ -119,6 +141,7 @@ void Draw_Mesh::destroy() {
     vkDestroyDescriptorSetLayout(vk.device, descriptor_set_layout, nullptr);
     vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
     vkDestroyPipeline(vk.device, pipeline, nullptr);
+    vkDestroyPipeline(vk.device, quantized_pipeline, nullptr);
     *this = Draw_Mesh{};
 }
 
@@ -129,22 +152,36 @@ void Draw_Mesh::update(const Matrix3x4& object_to_camera_transform) {
     memcpy(mapped_uniform_buffer, &transform, sizeof(transform));
 }
 
-void Draw_Mesh::dispatch(const GPU_Mesh& mesh, bool show_texture_lod) {
-    const VkDeviceSize zero_offset = 0;
-    vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &mesh.vertex_buffer.handle, &zero_offset);
-    vkCmdBindIndexBuffer(vk.command_buffer, mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
-
+void Draw_Mesh::dispatch(const std::vector<GPU_Mesh>& meshes, bool show_texture_lod) {
     VkDescriptorBufferBindingInfoEXT descriptor_buffer_binding_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
     descriptor_buffer_binding_info.address = descriptor_buffer.device_address;
     descriptor_buffer_binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
     vkCmdBindDescriptorBuffersEXT(vk.command_buffer, 1, &descriptor_buffer_binding_info);
 
-    const uint32_t buffer_index = 0;
-    const VkDeviceSize set_offset = 0;
-    vkCmdSetDescriptorBufferOffsetsEXT(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &buffer_index, &set_offset);
-
     uint32_t show_texture_lod_uint = show_texture_lod;
     vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4, &show_texture_lod_uint);
-    vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdDrawIndexed(vk.command_buffer, mesh.index_count, 1, 0, 0, 0);
+
+    VkPipeline bound_pipeline = VK_NULL_HANDLE;
+    for (const GPU_Mesh& mesh : meshes) {
+        const VkPipeline mesh_pipeline = mesh.vertex_layout.quantized ? quantized_pipeline : pipeline;
+        if (mesh_pipeline != bound_pipeline) {
+            vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline);
+            bound_pipeline = mesh_pipeline;
+        }
+        const Vertex_Quantization& quantization = mesh.vertex_layout.position_quantization;
+        const Vector4 position_dequantization[2] = { Vector4(quantization.scale, 0.f), Vector4(quantization.bias, 0.f) };
+        vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 16, 32, position_dequantization);
+
+        const VkBuffer vertex_buffers[2] = { mesh.vertex_buffer.handle, mesh.vertex_buffer.handle };
+        const VkDeviceSize offsets[2] = { mesh.vertex_layout.position_offset, mesh.vertex_layout.uv_offset };
+        const VkDeviceSize strides[2] = { mesh.vertex_layout.position_stride, mesh.vertex_layout.uv_stride };
+        vkCmdBindVertexBuffers2(vk.command_buffer, 0, 2, vertex_buffers, offsets, nullptr, strides);
+        vkCmdBindIndexBuffer(vk.command_buffer, mesh.index_buffer.handle, 0, mesh.index_type);
+
+        const uint32_t buffer_index = 0;
+        const VkDeviceSize set_offset = mesh.texture_index * descriptor_set_size;
+        vkCmdSetDescriptorBufferOffsetsEXT(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &buffer_index, &set_offset);
+
+        vkCmdDrawIndexed(vk.command_buffer, mesh.index_count, 1, 0, 0, 0);
+    }
 }
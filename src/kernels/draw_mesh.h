@@ -9,12 +9,15 @@ struct Draw_Mesh {
     VkDescriptorSetLayout descriptor_set_layout;
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
+    VkPipeline quantized_pipeline; // for meshes with quantized vertex layout
     Vk_Buffer descriptor_buffer;
+    VkDeviceSize descriptor_set_size = 0; // descriptor buffer stores one set per texture
     Vk_Buffer uniform_buffer;
     void* mapped_uniform_buffer;
 
-    void create(VkFormat color_attachment_format, VkFormat depth_attachment_format, VkImageView texture_view, VkSampler sample);
+    void create(VkFormat color_attachment_format, VkFormat depth_attachment_format, const std::vector<VkImageView>& texture_views, VkSampler sampler);
     void destroy();
     void update(const Matrix3x4& object_to_camera_transform);
-    void dispatch(const GPU_Mesh& mesh, bool show_texture_lod);
+    // GPU_Mesh::texture_index selects the texture view.
+    void dispatch(const std::vector<GPU_Mesh>& meshes, bool show_texture_lod);
 };
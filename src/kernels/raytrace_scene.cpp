@@ -2,10 +2,33 @@
 #include "gpu_mesh.h"
 
 #include "lib.h"
+#include "profiler.h"
+#include "startup_timer.h"
 
 #include <cassert>
+#include <cmath>
+#include <optional>
+
+uint32_t Traversal_Cost_Histogram::get_pixel_count() const {
+    uint32_t pixel_count = 0;
+    for (uint32_t bin : bins)
+        pixel_count += bin;
+    return pixel_count;
+}
+
+uint64_t Traversal_Cost_Histogram::get_percentile_cost(float percentile) const {
+    const uint32_t pixel_count = get_pixel_count();
+    const uint64_t rank = (uint64_t)std::ceil(double(percentile) * pixel_count);
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < bin_count; i++) {
+        count += bins[i];
+        if (count >= rank && count > 0)
+            return 2ull << i;
+    }
+    return 0;
+}
 
-void Raytrace_Scene::create(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler) {
+void Raytrace_Scene::create(const std::vector<GPU_Mesh>& gpu_meshes) {
     descriptor_buffer_properties = VkPhysicalDeviceDescriptorBufferPropertiesEXT{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT };
 
@@ -17,29 +40,43 @@ void Raytrace_Scene::create(const GPU_Mesh& gpu_mesh, VkImageView texture_view,
     uniform_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(sizeof(Matrix3x4)),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &(void*&)mapped_uniform_buffer, "rt_uniform_buffer");
 
-    accelerator = create_intersection_accelerator({gpu_mesh});
-    create_pipeline(gpu_mesh, texture_view, sampler);
+    traversal_cost_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(2 * sizeof(Traversal_Cost_Histogram)),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &(void*&)mapped_traversal_cost_histograms, "traversal_cost_buffer");
+    memset(mapped_traversal_cost_histograms, 0, 2 * sizeof(Traversal_Cost_Histogram));
 
-    // shader binding table
     {
-        uint32_t miss_offset = round_up(properties.shaderGroupHandleSize /* raygen slot*/, properties.shaderGroupBaseAlignment);
-        uint32_t hit_offset = round_up(miss_offset + properties.shaderGroupHandleSize /* miss slot */, properties.shaderGroupBaseAlignment);
-        uint32_t sbt_buffer_size = hit_offset + properties.shaderGroupHandleSize;
-
-        std::vector<uint8_t> data(sbt_buffer_size);
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 0, 1, properties.shaderGroupHandleSize, data.data() + 0)); // raygen slot
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 1, 1, properties.shaderGroupHandleSize, data.data() + miss_offset)); // miss slot
-        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 2, 1, properties.shaderGroupHandleSize, data.data() + hit_offset)); // hit slot
-        const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        shader_binding_table = vk_create_buffer_with_alignment(sbt_buffer_size, usage, properties.shaderGroupBaseAlignment, data.data(), "shader_binding_table");
+        std::vector<RT_Instance_Info> instance_infos(gpu_meshes.size());
+        for (size_t i = 0; i < gpu_meshes.size(); i++) {
+            const GPU_Mesh& mesh = gpu_meshes[i];
+            RT_Instance_Info& info = instance_infos[i];
+            info.index_buffer_address = mesh.index_buffer.device_address;
+            info.vertex_buffer_address = mesh.vertex_buffer.device_address;
+            info.index_type_uint16 = (mesh.index_type == VK_INDEX_TYPE_UINT16);
+            info.position_offset = mesh.vertex_layout.position_offset;
+            info.position_stride = mesh.vertex_layout.position_stride;
+            info.uv_offset = mesh.vertex_layout.uv_offset;
+            info.uv_stride = mesh.vertex_layout.uv_stride;
+            info.texture_index = mesh.texture_index;
+            info.quantized_vertices = mesh.vertex_layout.quantized;
+        }
+        for (const GPU_Mesh& mesh : gpu_meshes)
+            dequantization_transforms.push_back(mesh.vertex_layout.position_quantization.get_dequantization_transform());
+        instance_info_buffer = vk_create_buffer(instance_infos.size() * sizeof(RT_Instance_Info),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, instance_infos.data(), "rt_instance_info_buffer");
     }
+
+    accelerator = create_intersection_accelerator(gpu_meshes);
+    startup_phase_done("build acceleration structures");
 }
 
 void Raytrace_Scene::destroy() {
     descriptor_buffer.destroy();
     uniform_buffer.destroy();
+    instance_info_buffer.destroy();
+    traversal_cost_buffer.destroy();
     shader_binding_table.destroy();
     accelerator.destroy();
+    dequantization_transforms.clear();
 
     vkDestroyDescriptorSetLayout(vk.device, descriptor_set_layout, nullptr);
     vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
@@ -65,44 +102,47 @@ void Raytrace_Scene::update_output_image_descriptor(VkImageView output_image_vie
 }
 
 void Raytrace_Scene::update(const Matrix3x4& model_transform, const Matrix3x4& camera_to_world_transform) {
-    assert(accelerator.bottom_level_accels.size() == 1);
-
-    VkAccelerationStructureInstanceKHR& instance = *accelerator.mapped_instance_buffer;
-    memcpy(&instance.transform.matrix[0][0], &model_transform.a[0][0], 12 * sizeof(float));
-    instance.instanceCustomIndex = 0;
-    instance.mask = 0xff;
-    instance.instanceShaderBindingTableRecordOffset = 0;
-    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    instance.accelerationStructureReference = accelerator.bottom_level_accels[0].device_address;
+    // Other instance parameters are initialized by create_intersection_accelerator.
+    for (size_t i = 0; i < accelerator.bottom_level_accels.size(); i++) {
+        VkAccelerationStructureInstanceKHR& instance = accelerator.mapped_instance_buffer[i];
+        const Matrix3x4 transform = model_transform * dequantization_transforms[i];
+        memcpy(&instance.transform.matrix[0][0], &transform.a[0][0], 12 * sizeof(float));
+    }
 
     memcpy(mapped_uniform_buffer, &camera_to_world_transform, sizeof(camera_to_world_transform));
 }
 
-void Raytrace_Scene::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler) {
+void Raytrace_Scene::create_pipeline(const std::vector<VkImageView>& texture_views, VkSampler sampler) {
     descriptor_set_layout = Vk_Descriptor_Set_Layout()
         .storage_image (0, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
         .accelerator (1, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
         .uniform_buffer (2, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
         .storage_buffer (3, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
-        .storage_buffer (4, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
-        .sampled_image (5, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
-        .sampler (6, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
+        .sampled_image_array (4, (uint32_t)texture_views.size(), VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
+        .sampler (5, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)
+        .storage_buffer (6, VK_SHADER_STAGE_RAYGEN_BIT_KHR)
         .create ("rt_set_layout");
 
     pipeline_layout = vk_create_pipeline_layout(
         { descriptor_set_layout },
-        { VkPushConstantRange{VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, 4}, 
-          VkPushConstantRange{VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 4, 4} },
+        { VkPushConstantRange{VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, 16}, 
+          VkPushConstantRange{VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 16, 4} },
         "rt_pipeline_layout"
     );
 
     // pipeline
     {
+        PROFILE_SCOPE("create raytrace_scene pipeline");
         Vk_Shader_Module rgen_shader(get_resource_path("spirv/rt_mesh.rgen.spv"));
         Vk_Shader_Module miss_shader(get_resource_path("spirv/rt_mesh.rmiss.spv"));
         Vk_Shader_Module chit_shader(get_resource_path("spirv/rt_mesh.rchit.spv"));
+        // The traversal cost raygen shader reads shader clock, so it's added to the pipeline only if the clock is supported.
+        std::optional<Vk_Shader_Module> traversal_cost_rgen_shader;
+        if (vk.shader_clock)
+            traversal_cost_rgen_shader.emplace(get_resource_path("spirv/rt_mesh_traversal_cost.rgen.spv"));
+        const uint32_t stage_count = vk.shader_clock ? 4 : 3;
 
-        VkPipelineShaderStageCreateInfo stage_infos[3] {};
+        VkPipelineShaderStageCreateInfo stage_infos[4] {};
         stage_infos[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         stage_infos[0].stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
         stage_infos[0].module = rgen_shader.handle;
@@ -118,7 +158,14 @@ void Raytrace_Scene::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView textu
         stage_infos[2].module = chit_shader.handle;
         stage_infos[2].pName = "main";
 
-        VkRayTracingShaderGroupCreateInfoKHR shader_groups[3];
+        if (traversal_cost_rgen_shader) {
+            stage_infos[3].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stage_infos[3].stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+            stage_infos[3].module = traversal_cost_rgen_shader->handle;
+            stage_infos[3].pName = "main";
+        }
+
+        VkRayTracingShaderGroupCreateInfoKHR shader_groups[4];
         {
             auto& group = shader_groups[0];
             group = VkRayTracingShaderGroupCreateInfoKHR { VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
@@ -146,19 +193,31 @@ void Raytrace_Scene::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView textu
             group.anyHitShader = VK_SHADER_UNUSED_KHR;
             group.intersectionShader = VK_SHADER_UNUSED_KHR;
         }
+        {
+            auto& group = shader_groups[3];
+            group = VkRayTracingShaderGroupCreateInfoKHR { VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
+            group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+            group.generalShader = 3;
+            group.closestHitShader = VK_SHADER_UNUSED_KHR;
+            group.anyHitShader = VK_SHADER_UNUSED_KHR;
+            group.intersectionShader = VK_SHADER_UNUSED_KHR;
+        }
 
         VkRayTracingPipelineCreateInfoKHR create_info { VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
         create_info.flags =
             VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT |
             VK_PIPELINE_CREATE_RAY_TRACING_NO_NULL_CLOSEST_HIT_SHADERS_BIT_KHR |
-            VK_PIPELINE_CREATE_RAY_TRACING_NO_NULL_MISS_SHADERS_BIT_KHR;
-        create_info.stageCount = (uint32_t)std::size(stage_infos);
+            VK_PIPELINE_CREATE_RAY_TRACING_NO_NULL_MISS_SHADERS_BIT_KHR |
+            vk_get_pipeline_capture_flags();
+        create_info.stageCount = stage_count;
         create_info.pStages = stage_infos;
-        create_info.groupCount = (uint32_t)std::size(shader_groups);
+        create_info.groupCount = stage_count; // one group per stage
         create_info.pGroups = shader_groups;
         create_info.maxPipelineRayRecursionDepth = 1;
         create_info.layout = pipeline_layout;
         VK_CHECK(vkCreateRayTracingPipelinesKHR(vk.device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+        vk_set_debug_name(pipeline, "rt_pipeline");
+        vk_collect_pipeline_executable_statistics(pipeline, "rt_pipeline");
     }
 
     // Descriptor buffer.
@@ -199,11 +258,11 @@ void Raytrace_Scene::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView textu
             vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.uniformBufferDescriptorSize,
                 (uint8_t*)mapped_descriptor_buffer_ptr + offset);
         }
-        // Write descriptor 3 (index buffer)
+        // Write descriptor 3 (instance infos)
         {
             VkDescriptorAddressInfoEXT address_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
-            address_info.address = gpu_mesh.index_buffer.device_address;
-            address_info.range = gpu_mesh.index_count * 4 /*VK_INDEX_TYPE_UINT32*/;
+            address_info.address = instance_info_buffer.device_address;
+            address_info.range = accelerator.bottom_level_accels.size() * sizeof(RT_Instance_Info);
 
             VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
             descriptor_info.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -214,52 +273,92 @@ void Raytrace_Scene::create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView textu
             vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.storageBufferDescriptorSize,
                 (uint8_t*)mapped_descriptor_buffer_ptr + offset);
         }
-        // Write descriptor 4 (vertex buffer)
+        // Write descriptor 4 (sampled image array)
         {
-            VkDescriptorAddressInfoEXT address_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
-            address_info.address = gpu_mesh.vertex_buffer.device_address;
-            address_info.range = gpu_mesh.vertex_count * sizeof(Vertex);
-
-            VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
-            descriptor_info.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            descriptor_info.data.pStorageBuffer = &address_info;
-
             VkDeviceSize offset;
             vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 4, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.storageBufferDescriptorSize,
-                (uint8_t*)mapped_descriptor_buffer_ptr + offset);
+
+            for (size_t i = 0; i < texture_views.size(); i++) {
+                VkDescriptorImageInfo image_info;
+                image_info.imageView = texture_views[i];
+                image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+                VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+                descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                descriptor_info.data.pSampledImage = &image_info;
+
+                vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
+                    (uint8_t*)mapped_descriptor_buffer_ptr + offset + i * descriptor_buffer_properties.sampledImageDescriptorSize);
+            }
         }
-        // Write descriptor 5 (sampled image)
+        // Write descriptor 5 (sampler)
         {
-            VkDescriptorImageInfo image_info;
-            image_info.imageView = texture_view;
-            image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
             VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
-            descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-            descriptor_info.data.pSampledImage = &image_info;
+            descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+            descriptor_info.data.pSampler = &sampler;
 
             VkDeviceSize offset;
             vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 5, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
+            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
                 (uint8_t*)mapped_descriptor_buffer_ptr + offset);
         }
-        // Write descriptor 6 (sampler)
+        // Write descriptor 6 (traversal cost histograms)
         {
+            VkDescriptorAddressInfoEXT address_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
+            address_info.address = traversal_cost_buffer.device_address;
+            address_info.range = 2 * sizeof(Traversal_Cost_Histogram);
+
             VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
-            descriptor_info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
-            descriptor_info.data.pSampler = &sampler;
+            descriptor_info.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptor_info.data.pStorageBuffer = &address_info;
 
             VkDeviceSize offset;
             vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, descriptor_set_layout, 6, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
+            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.storageBufferDescriptorSize,
                 (uint8_t*)mapped_descriptor_buffer_ptr + offset);
         }
     }
+
+    // shader binding table
+    {
+        sbt_miss_offset = round_up(properties.shaderGroupHandleSize /* raygen slot*/, properties.shaderGroupBaseAlignment);
+        sbt_hit_offset = round_up(sbt_miss_offset + properties.shaderGroupHandleSize /* miss slot */, properties.shaderGroupBaseAlignment);
+        uint32_t sbt_buffer_size = sbt_hit_offset + properties.shaderGroupHandleSize;
+        if (vk.shader_clock) {
+            sbt_traversal_cost_raygen_offset = round_up(sbt_buffer_size, properties.shaderGroupBaseAlignment);
+            sbt_buffer_size = sbt_traversal_cost_raygen_offset + properties.shaderGroupHandleSize;
+        }
+
+        std::vector<uint8_t> data(sbt_buffer_size);
+        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 0, 1, properties.shaderGroupHandleSize, data.data() + 0)); // raygen slot
+        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 1, 1, properties.shaderGroupHandleSize, data.data() + sbt_miss_offset)); // miss slot
+        VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 2, 1, properties.shaderGroupHandleSize, data.data() + sbt_hit_offset)); // hit slot
+        if (vk.shader_clock) {
+            VK_CHECK(vkGetRayTracingShaderGroupHandlesKHR(vk.device, pipeline, 3, 1, properties.shaderGroupHandleSize,
+                data.data() + sbt_traversal_cost_raygen_offset)); // traversal cost raygen slot
+        }
+        const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        shader_binding_table = vk_create_buffer_with_alignment(sbt_buffer_size, usage, properties.shaderGroupBaseAlignment, data.data(), "shader_binding_table");
+    }
 }
 
-void Raytrace_Scene::dispatch(bool spp4, bool show_texture_lod) {
-    accelerator.rebuild_top_level_accel(vk.command_buffer);
+void Raytrace_Scene::dispatch(bool spp4, bool show_texture_lod, bool show_traversal_cost) {
+    show_traversal_cost = show_traversal_cost && sbt_traversal_cost_raygen_offset != 0;
+    const uint32_t histogram_index = vk.frame_index;
+    float traversal_cost_scale = 0.f;
+    if (show_traversal_cost) {
+        // The frame fence for this frame index was waited in vk_begin_frame, so the histogram is complete.
+        Traversal_Cost_Histogram& histogram = mapped_traversal_cost_histograms[histogram_index];
+        if (traversal_cost_histogram_written[histogram_index]) {
+            traversal_cost_histogram = histogram;
+        }
+        memset(&histogram, 0, sizeof(Traversal_Cost_Histogram));
+        traversal_cost_histogram_written[histogram_index] = true;
+
+        // Normalize heatmap by the 99th percentile, so a few expensive pixels do not hide the rest.
+        uint64_t max_cost = traversal_cost_histogram.get_percentile_cost(0.99f);
+        traversal_cost_scale = max_cost > 0 ? 1.f / float(max_cost) : 0.f;
+    }
 
     VkDescriptorBufferBindingInfoEXT descriptor_buffer_binding_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
     descriptor_buffer_binding_info.address = descriptor_buffer.device_address;
@@ -272,27 +371,30 @@ void Raytrace_Scene::dispatch(bool spp4, bool show_texture_lod) {
 
     vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
 
-    uint32_t push_constants[2] = { spp4, show_texture_lod };
-    vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, 4, &push_constants[0]);
-    vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 4, 4, &push_constants[1]);
+    struct {
+        uint32_t spp4;
+        float traversal_cost_scale;
+        uint32_t histogram_index;
+        uint32_t padding;
+    } rgen_push_constants = { spp4, traversal_cost_scale, histogram_index, 0 };
+    uint32_t show_texture_lod_uint = show_texture_lod;
+    vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(rgen_push_constants), &rgen_push_constants);
+    vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 16, 4, &show_texture_lod_uint);
 
-    const VkBuffer sbt = shader_binding_table.handle;
     const uint32_t sbt_slot_size = properties.shaderGroupHandleSize;
-    const uint32_t miss_offset = round_up(sbt_slot_size /* raygen slot*/, properties.shaderGroupBaseAlignment);
-    const uint32_t hit_offset = round_up(miss_offset + sbt_slot_size /* miss slot */, properties.shaderGroupBaseAlignment);
 
     VkStridedDeviceAddressRegionKHR raygen_sbt{};
-    raygen_sbt.deviceAddress = shader_binding_table.device_address + 0;
+    raygen_sbt.deviceAddress = shader_binding_table.device_address + (show_traversal_cost ? sbt_traversal_cost_raygen_offset : 0);
     raygen_sbt.stride = sbt_slot_size;
     raygen_sbt.size = sbt_slot_size;
 
     VkStridedDeviceAddressRegionKHR miss_sbt{};
-    miss_sbt.deviceAddress = shader_binding_table.device_address + miss_offset;
+    miss_sbt.deviceAddress = shader_binding_table.device_address + sbt_miss_offset;
     miss_sbt.stride = sbt_slot_size;
     miss_sbt.size = sbt_slot_size;
 
     VkStridedDeviceAddressRegionKHR chit_sbt{};
-    chit_sbt.deviceAddress = shader_binding_table.device_address + hit_offset;
+    chit_sbt.deviceAddress = shader_binding_table.device_address + sbt_hit_offset;
     chit_sbt.stride = sbt_slot_size;
     chit_sbt.size = sbt_slot_size;
 
@@ -300,4 +402,18 @@ void Raytrace_Scene::dispatch(bool spp4, bool show_texture_lod) {
 
     vkCmdTraceRaysKHR(vk.command_buffer, &raygen_sbt, &miss_sbt, &chit_sbt, &callable_sbt,
         vk.surface_size.width, vk.surface_size.height, 1);
+
+    if (show_traversal_cost) {
+        // Make histogram available for reading on the host.
+        VkMemoryBarrier2 barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+        VkDependencyInfo dependency_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dependency_info.memoryBarrierCount = 1;
+        dependency_info.pMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(vk.command_buffer, &dependency_info);
+    }
 }
@@ -5,6 +5,35 @@
 
 struct GPU_Mesh;
 
+// Histogram of per-pixel traversal cost measured with shader realtime clock.
+// Should match Traversal_Cost_Histogram in rt_mesh_raygen.glsl.
+struct Traversal_Cost_Histogram {
+    // Bin i counts pixels with cost in [2^i, 2^(i+1)) clock ticks (bin 0 also counts zero cost).
+    static constexpr uint32_t bin_count = 32;
+    uint32_t bins[bin_count];
+    uint32_t max_cost;
+
+    uint32_t get_pixel_count() const;
+    // Upper bound of the bin that contains the given percentile (0..1) of pixels.
+    uint64_t get_percentile_cost(float percentile) const;
+};
+
+// Geometry and texture of the instance for closest hit shader. Indexed by instance custom index.
+// Should match Instance_Info in rt_mesh.rchit.glsl. Vertex layout parameters are in bytes and are multiples of 4.
+// Quantized positions are not dequantized in the shader, the instance transform includes dequantization.
+struct RT_Instance_Info {
+    VkDeviceAddress index_buffer_address;
+    VkDeviceAddress vertex_buffer_address;
+    uint32_t index_type_uint16;
+    uint32_t position_offset;
+    uint32_t position_stride;
+    uint32_t uv_offset;
+    uint32_t uv_stride;
+    uint32_t texture_index;
+    uint32_t quantized_vertices; // SNORM16 positions and half float uvs
+    uint32_t padding;
+};
+
 struct Raytrace_Scene {
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR properties;
     Vk_Intersection_Accelerator accelerator;
@@ -14,17 +43,37 @@ struct Raytrace_Scene {
     Vk_Buffer descriptor_buffer;
     void* mapped_descriptor_buffer_ptr = nullptr;
     Vk_Buffer shader_binding_table;
+    // Shader binding table contains raygen, miss, hit and traversal cost raygen slots.
+    uint32_t sbt_miss_offset = 0;
+    uint32_t sbt_hit_offset = 0;
+    uint32_t sbt_traversal_cost_raygen_offset = 0; // 0 if the traversal cost shader is not supported
     Vk_Buffer uniform_buffer;
     void* mapped_uniform_buffer;
+    Vk_Buffer instance_info_buffer;
+    // Maps quantized positions of each instance to object space.
+    std::vector<Matrix3x4> dequantization_transforms;
+
+    // Histograms for each frame in flight.
+    Vk_Buffer traversal_cost_buffer;
+    Traversal_Cost_Histogram* mapped_traversal_cost_histograms = nullptr;
+    bool traversal_cost_histogram_written[2] = {};
+    // The most recent histogram that was read back from the GPU (2 frames of latency).
+    Traversal_Cost_Histogram traversal_cost_histogram{};
 
     VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptor_buffer_properties{};
 
-    void create(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler);
+    // Creates buffers and acceleration structures. There is one instance (and BLAS) per mesh.
+    // The textures are not needed at this point, so they can be loaded while the BLASes are built.
+    void create(const std::vector<GPU_Mesh>& gpu_meshes);
+    // Should be called after create. GPU_Mesh::texture_index selects the texture view.
+    void create_pipeline(const std::vector<VkImageView>& texture_views, VkSampler sampler);
     void destroy();
     void update_output_image_descriptor(VkImageView output_image_view);
+    // model_transform is applied to all instances.
     void update(const Matrix3x4& model_transform, const Matrix3x4& camera_to_world_transform);
-    void dispatch(bool spp4, bool show_texture_lod);
-
-private:
-    void create_pipeline(const GPU_Mesh& gpu_mesh, VkImageView texture_view, VkSampler sampler);
+    // Top level acceleration structure should be rebuilt before dispatch (accelerator.rebuild_top_level_accel).
+    // show_traversal_cost replaces shading with a heatmap of the time spent in traceRayEXT calls
+    // (traversal and closest hit shader) and updates traversal_cost_histogram. It uses a separate
+    // raygen shader which is available only if vk.shader_clock is true, otherwise the flag is ignored.
+    void dispatch(bool spp4, bool show_texture_lod, bool show_traversal_cost);
 };
@@ -1,12 +1,30 @@
 #include "lib.h"
+#include "obj_parser.h"
+#include "profiler.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
-
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
-#include <fstream>
-#include <unordered_map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "stb_image.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 void error(const std::string& message)
 {
@@ -23,27 +41,337 @@ std::string get_resource_path(const std::string& path_relative_data_directory)
     return (std::filesystem::path(g_data_dir) / path_relative_data_directory).string();
 }
 
-std::vector<uint8_t> read_binary_file(const std::string& file_name)
+Mapped_File::Mapped_File(Mapped_File&& other) noexcept
 {
-    std::ifstream file(file_name, std::ios_base::in | std::ios_base::binary);
-    if (!file)
-    error("failed to open file: " + file_name);
+    *this = std::move(other);
+}
 
-    // get file size
-    file.seekg(0, std::ios_base::end);
-    std::streampos file_size = file.tellg();
-    file.seekg(0, std::ios_base::beg);
+Mapped_File& Mapped_File::operator=(Mapped_File&& other) noexcept
+{
+    if (this != &other) {
+        unmap();
+        data = other.data;
+        size = other.size;
+#ifdef _WIN32
+        file_handle = other.file_handle;
+        mapping_handle = other.mapping_handle;
+        other.file_handle = nullptr;
+        other.mapping_handle = nullptr;
+#endif
+        other.data = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
 
-    if (file_size == std::streampos(-1) || !file)
-    error("failed to read file stats: " + file_name);
+bool Mapped_File::map(const std::string& file_name, File_Access access)
+{
+    unmap();
+#ifdef _WIN32
+    const DWORD flags = (access == File_Access::random) ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN;
+    HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return false;
+    }
+    file_handle = file;
+    size = (size_t)file_size.QuadPart;
+    if (size == 0)
+        return true;
+    mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle)
+        data = (const uint8_t*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (data && access == File_Access::whole_file) {
+        WIN32_MEMORY_RANGE_ENTRY range{ (void*)data, size };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return false;
+    }
+    size = (size_t)file_stat.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file referenced
+    if (ptr != MAP_FAILED) {
+        data = (const uint8_t*)ptr;
+        const int advice = (access == File_Access::sequential) ? MADV_SEQUENTIAL :
+            (access == File_Access::random) ? MADV_RANDOM : MADV_WILLNEED;
+        madvise(ptr, size, advice);
+    }
+#endif
+    if (data == nullptr) {
+        unmap();
+        return false;
+    }
+    return true;
+}
 
-    // read file content
-    std::vector<uint8_t> file_content(static_cast<size_t>(file_size));
-    file.read(reinterpret_cast<char*>(file_content.data()), file_size);
-    if (!file)
-    error("failed to read file content: " + file_name);
+void Mapped_File::unmap()
+{
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+#else
+    if (data)
+        munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+}
 
-    return file_content;
+std::string get_unique_temp_path(const std::string& path)
+{
+#ifdef _WIN32
+    const unsigned long process_id = GetCurrentProcessId();
+#else
+    const unsigned long process_id = (unsigned long)getpid();
+#endif
+    const size_t thread_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%lu_%zx.tmp", process_id, thread_id);
+    return path + suffix;
+}
+
+std::string format_json_number(double value, int decimals)
+{
+    if (!std::isfinite(value))
+        return "null";
+    char str[64];
+    snprintf(str, sizeof(str), "%.*f", decimals, value);
+    return str;
+}
+
+Image_Pixels::Image_Pixels(Image_Pixels&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+Image_Pixels& Image_Pixels::operator=(Image_Pixels&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        width = other.width;
+        height = other.height;
+        rgba = other.rgba;
+        other.width = 0;
+        other.height = 0;
+        other.rgba = nullptr;
+    }
+    return *this;
+}
+
+void Image_Pixels::release()
+{
+    if (rgba)
+        stbi_image_free(rgba);
+    width = 0;
+    height = 0;
+    rgba = nullptr;
+}
+
+Image_Pixels decode_image(const std::string& file_name)
+{
+    PROFILE_SCOPE("decode_image");
+    Mapped_File file;
+    if (!file.map(file_name, File_Access::whole_file))
+        error("failed to open image file: " + file_name);
+
+    Image_Pixels image;
+    int component_count;
+    image.rgba = stbi_load_from_memory(file.data, (int)file.size, &image.width, &image.height, &component_count, STBI_rgb_alpha);
+    if (image.rgba == nullptr)
+        error("failed to decode image file: " + file_name);
+    return image;
+}
+
+std::future<Image_Pixels> decode_image_async(const std::string& file_name)
+{
+    return run_async([file_name] { return decode_image(file_name); });
+}
+
+// Processes 8 bytes per step with multiply-xorshift mixing (similar to wyhash/murmur finalizers).
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+    constexpr uint64_t k0 = 0x9e3779b97f4a7c15ull;
+    constexpr uint64_t k1 = 0xbf58476d1ce4e5b9ull;
+    constexpr uint64_t k2 = 0x94d049bb133111ebull;
+
+    auto mix = [](uint64_t h) {
+        h = (h ^ (h >> 30)) * k1;
+        h = (h ^ (h >> 27)) * k2;
+        return h ^ (h >> 31);
+    };
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    // Four independent lanes to hide multiplication latency.
+    uint64_t lanes[4] = { seed ^ k0, seed ^ k1, seed ^ k2, seed + size };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + 8 * k, 8);
+            lanes[k] = (lanes[k] ^ word) * k0;
+            lanes[k] ^= lanes[k] >> 29;
+        }
+    }
+    uint64_t h = mix(lanes[0]) ^ mix(lanes[1] + k1) ^ mix(lanes[2] + k2) ^ mix(lanes[3] + k0);
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = mix(h ^ word);
+    }
+    if (i < size) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, size - i);
+        h = mix(h ^ word ^ (uint64_t(size - i) << 56));
+    }
+    return mix(h ^ size);
+}
+
+namespace {
+// Fixed set of threads, one per hardware thread, created on first use and kept until exit.
+struct Worker_Pool {
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    bool stop = false;
+
+    Worker_Pool() {
+        const unsigned thread_count = std::max(1u, std::thread::hardware_concurrency());
+        threads.reserve(thread_count);
+        for (unsigned i = 0; i < thread_count; i++)
+            threads.emplace_back([this] { run_tasks(); });
+    }
+
+    ~Worker_Pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        task_available.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    // Urgent tasks are run before the queued ones (used by run_parallel helpers).
+    void submit(std::function<void()> task, bool urgent = false) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (urgent)
+                tasks.push_front(std::move(task));
+            else
+                tasks.push_back(std::move(task));
+        }
+        task_available.notify_one();
+    }
+
+    void run_tasks() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_available.wait(lock, [this] { return stop || !tasks.empty(); });
+                if (stop)
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+// Chunks are claimed from the shared counter by the calling thread and by the workers. The caller
+// does not depend on the workers to make progress, so nested run_parallel calls can't deadlock.
+struct Parallel_Job {
+    const std::function<void(size_t chunk_index)>* func = nullptr;
+    size_t chunk_count = 0;
+    std::atomic<size_t> next_chunk = 0;
+    std::atomic<size_t> completed_chunks = 0;
+    std::mutex mutex;
+    std::condition_variable completed;
+    std::exception_ptr exception;
+
+    void run_chunks() {
+        size_t chunk_index;
+        // func is accessed only after a chunk is claimed, the caller waits for claimed chunks to complete.
+        while ((chunk_index = next_chunk.fetch_add(1)) < chunk_count) {
+            try {
+                (*func)(chunk_index);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!exception)
+                    exception = std::current_exception();
+            }
+            if (completed_chunks.fetch_add(1) + 1 == chunk_count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.notify_all();
+            }
+        }
+    }
+};
+} // namespace
+
+static Worker_Pool& get_worker_pool()
+{
+    static Worker_Pool worker_pool;
+    return worker_pool;
+}
+
+void submit_worker_task(std::function<void()> task)
+{
+    get_worker_pool().submit(std::move(task));
+}
+
+void run_parallel(size_t chunk_count, const std::function<void(size_t chunk_index)>& func)
+{
+    if (chunk_count <= 1) {
+        for (size_t i = 0; i < chunk_count; i++)
+            func(i);
+        return;
+    }
+
+    // Workers can pick up the job after all chunks are done, so the job is shared with them.
+    auto job = std::make_shared<Parallel_Job>();
+    job->func = &func;
+    job->chunk_count = chunk_count;
+
+    Worker_Pool& worker_pool = get_worker_pool();
+    const size_t helper_count = std::min(chunk_count - 1, worker_pool.threads.size());
+    for (size_t i = 0; i < helper_count; i++)
+        worker_pool.submit([job] { job->run_chunks(); }, true);
+    job->run_chunks();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->completed.wait(lock, [&job] { return job->completed_chunks == job->chunk_count; });
+    if (job->exception)
+        std::rethrow_exception(job->exception);
+}
+
+size_t get_parallel_chunk_count(size_t item_count, size_t min_chunk_items)
+{
+    size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    return std::clamp(item_count / min_chunk_items, size_t(1), thread_count);
 }
 
 uint64_t elapsed_milliseconds(Timestamp timestamp)
@@ -272,76 +600,171 @@ Vector3 transform_vector(const Matrix3x4& m, Vector3 v) {
     return v2;
 }
 
-Triangle_Mesh load_obj_model(const std::string& path, float additional_scale) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()))
-        error("failed to load obj model: " + path);
-
-    assert(shapes.size() == 1);
-    const tinyobj::mesh_t& obj_mesh = shapes[0].mesh;
-
-    for (uint8_t num_face_vertices : obj_mesh.num_face_vertices)
-        assert(num_face_vertices == 3);
-
-    struct Index_Hasher {
-        size_t operator()(const tinyobj::index_t& index) const {
-            size_t hash = 0;
-            hash_combine(hash, index.vertex_index);
-            hash_combine(hash, index.normal_index);
-            hash_combine(hash, index.texcoord_index);
-            return hash;
-        }
+Matrix3x4 get_normalization_transform(Vector3 bounds_min, Vector3 bounds_max, float additional_scale) {
+    Vector3 diag = bounds_max - bounds_min;
+    float max_size = std::max(diag.x, std::max(diag.y, diag.z));
+    float scale = (2.f / max_size) * additional_scale;
+    Vector3 center = (bounds_min + bounds_max) * 0.5f;
+
+    Matrix3x4 m{};
+    m.a[0][0] = scale;
+    m.a[1][1] = scale;
+    m.a[2][2] = scale;
+    m.set_column(3, center * -scale);
+    return m;
+}
+
+Matrix3x4 Vertex_Quantization::get_dequantization_transform() const {
+    Matrix3x4 m{};
+    m.a[0][0] = scale.x;
+    m.a[1][1] = scale.y;
+    m.a[2][2] = scale.z;
+    m.set_column(3, bias);
+    return m;
+}
+
+Vertex_Quantization get_vertex_quantization(Vector3 bounds_min, Vector3 bounds_max) {
+    Vertex_Quantization quantization;
+    for (int i = 0; i < 3; i++) {
+        const float half_extent = (bounds_max[i] - bounds_min[i]) * 0.5f;
+        quantization.scale[i] = (half_extent > 0.f) ? half_extent : 1.f;
+        quantization.bias[i] = (bounds_min[i] + bounds_max[i]) * 0.5f;
+    }
+    return quantization;
+}
+
+void quantize_vertices(std::span<const Vertex> vertices, const Vertex_Quantization& quantization,
+    Quantized_Position* positions, Quantized_UV* uvs)
+{
+    const Vector3 inv_scale(1.f / quantization.scale.x, 1.f / quantization.scale.y, 1.f / quantization.scale.z);
+    auto quantize = [&quantization, &inv_scale](float value, int axis) {
+        const float normalized = std::clamp((value - quantization.bias[axis]) * inv_scale[axis], -1.f, 1.f);
+        return int16_t(std::lround(normalized * 32767.f));
     };
-    struct Index_Comparator {
-        bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
-            return
-                a.vertex_index == b.vertex_index &&
-                a.normal_index == b.normal_index &&
-                a.texcoord_index == b.texcoord_index;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Vertex& v = vertices[i];
+        positions[i] = Quantized_Position{ quantize(v.pos.x, 0), quantize(v.pos.y, 1), quantize(v.pos.z, 2), 0 };
+        uvs[i] = Quantized_UV{ float_to_half(v.uv.x), float_to_half(v.uv.y) };
+    }
+}
+
+// Round to nearest even. Values outside of the half range become infinity, NaN is preserved.
+uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    const uint16_t sign = uint16_t((x >> 16) & 0x8000);
+    const uint32_t abs_x = x & 0x7fffffff;
+
+    if (abs_x >= 0x7f800000) // inf or nan
+        return sign | 0x7c00 | (abs_x > 0x7f800000 ? 0x200 : 0);
+    if (abs_x >= 0x477ff000) // rounds to a value larger than the max half
+        return sign | 0x7c00;
+    if (abs_x < 0x38800000) { // denormal half or zero
+        if (abs_x < 0x33000000)
+            return sign;
+        const uint32_t mantissa = (abs_x & 0x7fffff) | 0x800000;
+        const uint32_t shift = 126 - (abs_x >> 23);
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+            half++;
+        return sign | uint16_t(half);
+    }
+    uint32_t half = ((abs_x - 0x38000000) >> 13);
+    const uint32_t remainder = abs_x & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++;
+    return sign | uint16_t(half);
+}
+
+// Missing MTL files are reported and skipped, shapes that use their materials get no material.
+static std::vector<Mesh_Material> load_obj_materials(const std::string& obj_path, const std::vector<std::string>& material_libraries) {
+    std::vector<Mesh_Material> materials;
+    const std::filesystem::path obj_directory = std::filesystem::path(obj_path).parent_path();
+    for (const std::string& material_library : material_libraries) {
+        const std::filesystem::path mtl_path = obj_directory / material_library;
+        Mapped_File file;
+        if (!file.map(mtl_path.string())) {
+            printf("Warning: failed to load material library: %s\n", mtl_path.string().c_str());
+            continue;
         }
-    };
-    std::unordered_map<tinyobj::index_t, int, Index_Hasher, Index_Comparator> index_mapping;
+        for (const Obj_Material& obj_material : parse_mtl((const char*)file.data, file.size)) {
+            Mesh_Material material;
+            material.name = obj_material.name;
+            if (!obj_material.diffuse_texture.empty())
+                material.diffuse_texture = (mtl_path.parent_path() / obj_material.diffuse_texture).string();
+            materials.push_back(material);
+        }
+    }
+    return materials;
+}
+
+Triangle_Mesh load_obj_model(const std::string& path, float additional_scale) {
+    PROFILE_SCOPE("load_obj_model");
+    Obj_Data obj;
+    {
+        Mapped_File file;
+        if (!file.map(path, File_Access::whole_file))
+            error("failed to load obj model: " + path);
+        obj = parse_obj((const char*)file.data, file.size);
+    }
+
+    Triangle_Mesh mesh;
+    mesh.materials = load_obj_materials(path, obj.material_libraries);
+    mesh.indices.resize(obj.indices.size());
+
+    // Vertices are deduplicated per shape, so each shape references only its own vertices.
+    std::vector<Obj_Index> unique_vertices;
+    for (const Obj_Shape& obj_shape : obj.shapes) {
+        Obj_Vertex_Mapping mapping = deduplicate_obj_vertices(std::span(obj.indices).subspan(obj_shape.first_index, obj_shape.index_count));
+        if (unique_vertices.size() + mapping.unique_vertices.size() >= size_t(UINT32_MAX))
+            error("obj file has too many vertices: " + path);
+
+        Mesh_Shape shape;
+        shape.first_vertex = uint32_t(unique_vertices.size());
+        shape.vertex_count = uint32_t(mapping.unique_vertices.size());
+        shape.first_index = uint32_t(obj_shape.first_index);
+        shape.index_count = uint32_t(obj_shape.index_count);
+        for (size_t i = 0; i < mesh.materials.size(); i++) {
+            if (mesh.materials[i].name == obj_shape.material) {
+                shape.material_index = int32_t(i);
+                break;
+            }
+        }
+        mesh.shapes.push_back(shape);
+
+        std::copy(mapping.indices.begin(), mapping.indices.end(), mesh.indices.begin() + obj_shape.first_index);
+        unique_vertices.insert(unique_vertices.end(), mapping.unique_vertices.begin(), mapping.unique_vertices.end());
+    }
 
     Vector3 mesh_min(Infinity);
     Vector3 mesh_max(-Infinity);
+    mesh.vertices.resize(unique_vertices.size());
 
-    Triangle_Mesh mesh;
-    mesh.indices.reserve(obj_mesh.indices.size());
-
-    for (const tinyobj::index_t& index : obj_mesh.indices) {
-        auto it = index_mapping.find(index);
-        if (it == index_mapping.end()) {
-            it = index_mapping.insert(std::make_pair(index, (int)mesh.vertices.size())).first;
-
-            // add new vertex
-            Vertex vertex;
-            assert(index.vertex_index != -1);
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
+    for (size_t i = 0; i < unique_vertices.size(); i++) {
+        const Obj_Index& index = unique_vertices[i];
+        Vertex& vertex = mesh.vertices[i];
+        assert(index.position != -1);
+        vertex.pos = {
+            obj.positions[3 * index.position + 0],
+            obj.positions[3 * index.position + 1],
+            obj.positions[3 * index.position + 2]
+        };
+        if (index.texcoord != -1) {
+            vertex.uv = {
+                obj.texcoords[2 * index.texcoord + 0],
+                1.f - obj.texcoords[2 * index.texcoord + 1]
             };
-            if (index.texcoord_index != -1) {
-                vertex.uv = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
-            }
-            mesh.vertices.push_back(vertex);
-
-            // update mesh bounds
-            mesh_min.x = std::min(mesh_min.x, vertex.pos.x);
-            mesh_min.y = std::min(mesh_min.y, vertex.pos.y);
-            mesh_min.z = std::min(mesh_min.z, vertex.pos.z);
-            mesh_max.x = std::max(mesh_max.x, vertex.pos.x);
-            mesh_max.y = std::max(mesh_max.y, vertex.pos.y);
-            mesh_max.z = std::max(mesh_max.z, vertex.pos.z);
         }
-        mesh.indices.push_back(it->second);
+
+        // update mesh bounds
+        mesh_min.x = std::min(mesh_min.x, vertex.pos.x);
+        mesh_min.y = std::min(mesh_min.y, vertex.pos.y);
+        mesh_min.z = std::min(mesh_min.z, vertex.pos.z);
+        mesh_max.x = std::max(mesh_max.x, vertex.pos.x);
+        mesh_max.y = std::max(mesh_max.y, vertex.pos.y);
+        mesh_max.z = std::max(mesh_max.z, vertex.pos.z);
     }
 
     // scale and center the mesh
@@ -356,3 +779,416 @@ Triangle_Mesh load_obj_model(const std::string& path, float additional_scale) {
     }
     return mesh;
 }
+
+namespace {
+enum class Ply_Type : uint8_t { int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+
+struct Ply_Property {
+    std::string name;
+    Ply_Type type = Ply_Type::float32;
+    bool is_list = false;
+    Ply_Type count_type = Ply_Type::uint8; // list properties only
+    // Offset in the element record. Valid only for properties that are located before the first list.
+    uint32_t offset = 0;
+};
+
+struct Ply_Element {
+    std::string name;
+    uint64_t count = 0;
+    std::vector<Ply_Property> properties;
+    int list_count = 0;
+    uint32_t non_list_size = 0; // total size of non-list properties (record size if there are no lists)
+
+    const Ply_Property* find_property(std::initializer_list<const char*> names) const {
+        for (const char* name : names) {
+            for (const Ply_Property& property : properties) {
+                if (property.name == name)
+                    return &property;
+            }
+        }
+        return nullptr;
+    }
+};
+} // namespace
+
+static uint32_t get_ply_type_size(Ply_Type type) {
+    static const uint32_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[int(type)];
+}
+
+static Ply_Type parse_ply_type(const std::string& name) {
+    if (name == "char" || name == "int8") return Ply_Type::int8;
+    if (name == "uchar" || name == "uint8") return Ply_Type::uint8;
+    if (name == "short" || name == "int16") return Ply_Type::int16;
+    if (name == "ushort" || name == "uint16") return Ply_Type::uint16;
+    if (name == "int" || name == "int32") return Ply_Type::int32;
+    if (name == "uint" || name == "uint32") return Ply_Type::uint32;
+    if (name == "float" || name == "float32") return Ply_Type::float32;
+    if (name == "double" || name == "float64") return Ply_Type::float64;
+    error("unsupported ply property type: " + name);
+    return Ply_Type::float32;
+}
+
+template <typename T>
+static T read_unaligned(const uint8_t* ptr) {
+    T value;
+    memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+static float read_ply_float(Ply_Type type, const uint8_t* ptr) {
+    switch (type) {
+    case Ply_Type::int8: return float(read_unaligned<int8_t>(ptr));
+    case Ply_Type::uint8: return float(read_unaligned<uint8_t>(ptr));
+    case Ply_Type::int16: return float(read_unaligned<int16_t>(ptr));
+    case Ply_Type::uint16: return float(read_unaligned<uint16_t>(ptr));
+    case Ply_Type::int32: return float(read_unaligned<int32_t>(ptr));
+    case Ply_Type::uint32: return float(read_unaligned<uint32_t>(ptr));
+    case Ply_Type::float32: return read_unaligned<float>(ptr);
+    case Ply_Type::float64: return float(read_unaligned<double>(ptr));
+    }
+    return 0.f;
+}
+
+static int64_t read_ply_int(Ply_Type type, const uint8_t* ptr) {
+    switch (type) {
+    case Ply_Type::int8: return read_unaligned<int8_t>(ptr);
+    case Ply_Type::uint8: return read_unaligned<uint8_t>(ptr);
+    case Ply_Type::int16: return read_unaligned<int16_t>(ptr);
+    case Ply_Type::uint16: return read_unaligned<uint16_t>(ptr);
+    case Ply_Type::int32: return read_unaligned<int32_t>(ptr);
+    case Ply_Type::uint32: return read_unaligned<uint32_t>(ptr);
+    case Ply_Type::float32: return int64_t(read_unaligned<float>(ptr));
+    case Ply_Type::float64: return int64_t(read_unaligned<double>(ptr));
+    }
+    return 0;
+}
+
+// Parses PLY header and returns the offset of the binary data.
+static size_t parse_ply_header(const Mapped_File& file, const std::string& path, std::vector<Ply_Element>& elements) {
+    const char* text = (const char*)file.data;
+    size_t pos = 0;
+    bool format_found = false;
+    for (int line_index = 0; ; line_index++) {
+        const char* newline = (const char*)memchr(text + pos, '\n', file.size - pos);
+        if (newline == nullptr)
+            error("invalid ply header: " + path);
+        std::string line(text + pos, newline);
+        pos = size_t(newline - text) + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (line_index == 0) {
+            if (keyword != "ply")
+                error("not a ply file: " + path);
+        }
+        else if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format != "binary_little_endian")
+                error("only binary_little_endian ply format is supported: " + path);
+            format_found = true;
+        }
+        else if (keyword == "element") {
+            Ply_Element element;
+            tokens >> element.name >> element.count;
+            if (!tokens)
+                error("invalid ply element declaration: " + path);
+            elements.push_back(element);
+        }
+        else if (keyword == "property") {
+            if (elements.empty())
+                error("ply property declared before element: " + path);
+            Ply_Element& element = elements.back();
+            Ply_Property property;
+            std::string type;
+            tokens >> type;
+            if (type == "list") {
+                std::string count_type, item_type;
+                tokens >> count_type >> item_type;
+                property.is_list = true;
+                property.count_type = parse_ply_type(count_type);
+                property.type = parse_ply_type(item_type);
+            } else {
+                property.type = parse_ply_type(type);
+            }
+            tokens >> property.name;
+            if (!tokens)
+                error("invalid ply property declaration: " + path);
+
+            if (element.list_count == 0)
+                property.offset = element.non_list_size;
+            if (property.is_list)
+                element.list_count++;
+            else
+                element.non_list_size += get_ply_type_size(property.type);
+            element.properties.push_back(property);
+        }
+        else if (keyword == "end_header") {
+            break;
+        }
+        // "comment" and "obj_info" lines are ignored.
+    }
+    if (!format_found)
+        error("ply format is not specified: " + path);
+    return pos;
+}
+
+// Returns pointer to the next property value or nullptr if the value is out of bounds.
+static const uint8_t* skip_ply_property(const Ply_Property& property, const uint8_t* ptr, const uint8_t* end) {
+    if (!property.is_list) {
+        if (uint64_t(end - ptr) < get_ply_type_size(property.type))
+            return nullptr;
+        return ptr + get_ply_type_size(property.type);
+    }
+    const uint32_t count_size = get_ply_type_size(property.count_type);
+    if (uint64_t(end - ptr) < count_size)
+        return nullptr;
+    int64_t count = read_ply_int(property.count_type, ptr);
+    ptr += count_size;
+    if (count < 0 || uint64_t(end - ptr) / get_ply_type_size(property.type) < uint64_t(count))
+        return nullptr;
+    return ptr + count * get_ply_type_size(property.type);
+}
+
+// Returns pointer to the next record or nullptr if the record is out of bounds.
+static const uint8_t* skip_ply_record(const Ply_Element& element, const uint8_t* ptr, const uint8_t* end) {
+    for (const Ply_Property& property : element.properties) {
+        ptr = skip_ply_property(property, ptr, end);
+        if (ptr == nullptr)
+            return nullptr;
+    }
+    return ptr;
+}
+
+static const uint8_t* skip_ply_element(const Ply_Element& element, const uint8_t* ptr, const uint8_t* end, const std::string& path) {
+    if (element.list_count == 0) {
+        if (uint64_t(end - ptr) / std::max(element.non_list_size, 1u) < element.count)
+            error("unexpected end of ply file: " + path);
+        return ptr + element.count * element.non_list_size;
+    }
+    for (uint64_t i = 0; i < element.count; i++) {
+        ptr = skip_ply_record(element, ptr, end);
+        if (ptr == nullptr)
+            error("unexpected end of ply file: " + path);
+    }
+    return ptr;
+}
+
+// Fast path for the common case when all faces are triangles and the index list is the only list property,
+// so face records have the same size and can be converted in parallel.
+// Returns false if a non-triangle face is found.
+static bool read_ply_triangles(const Ply_Element& face_element, const Ply_Property& index_list, const uint8_t* data, const uint8_t* end,
+    uint32_t vertex_count, std::vector<uint32_t>& indices, const std::string& path)
+{
+    const uint32_t count_size = get_ply_type_size(index_list.count_type);
+    const uint32_t index_size = get_ply_type_size(index_list.type);
+    const uint32_t record_size = face_element.non_list_size + count_size + 3 * index_size;
+    const uint64_t face_count = face_element.count;
+    if (face_element.list_count != 1 || uint64_t(end - data) / record_size < face_count)
+        return false;
+
+    indices.resize(face_count * 3);
+    std::atomic<bool> non_triangle_found = false;
+    std::atomic<bool> invalid_index_found = false;
+
+    const size_t chunk_count = get_parallel_chunk_count(face_count, 256 * 1024);
+    run_parallel(chunk_count, [&](size_t chunk_index) {
+        PROFILE_SCOPE("read ply faces chunk");
+        const uint64_t first_face = face_count * chunk_index / chunk_count;
+        const uint64_t last_face = face_count * (chunk_index + 1) / chunk_count;
+        for (uint64_t face = first_face; face < last_face; face++) {
+            const uint8_t* list = data + face * record_size + index_list.offset;
+            if (read_ply_int(index_list.count_type, list) != 3) {
+                non_triangle_found = true;
+                return;
+            }
+            for (int k = 0; k < 3; k++) {
+                int64_t index = read_ply_int(index_list.type, list + count_size + k * index_size);
+                if (index < 0 || index >= int64_t(vertex_count)) {
+                    invalid_index_found = true;
+                    return;
+                }
+                indices[face * 3 + k] = uint32_t(index);
+            }
+        }
+    });
+    if (non_triangle_found) {
+        indices.clear();
+        return false;
+    }
+    if (invalid_index_found)
+        error("invalid vertex index in ply file: " + path);
+    return true;
+}
+
+// Sequential reader for arbitrary polygons (triangulated as a fan) and face elements with multiple lists.
+static void read_ply_polygons(const Ply_Element& face_element, const Ply_Property& index_list, const uint8_t* data, const uint8_t* end,
+    uint32_t vertex_count, std::vector<uint32_t>& indices, const std::string& path)
+{
+    PROFILE_SCOPE("read ply polygons");
+    const uint32_t count_size = get_ply_type_size(index_list.count_type);
+    const uint32_t index_size = get_ply_type_size(index_list.type);
+    indices.reserve(face_element.count * 3);
+
+    auto get_index = [&](const uint8_t* ptr) {
+        int64_t index = read_ply_int(index_list.type, ptr);
+        if (index < 0 || index >= int64_t(vertex_count))
+            error("invalid vertex index in ply file: " + path);
+        return uint32_t(index);
+    };
+
+    const uint8_t* ptr = data;
+    for (uint64_t face = 0; face < face_element.count; face++) {
+        for (const Ply_Property& property : face_element.properties) {
+            const uint8_t* property_end = skip_ply_property(property, ptr, end);
+            if (property_end == nullptr)
+                error("unexpected end of ply file: " + path);
+            if (&property == &index_list) {
+                const int64_t count = read_ply_int(index_list.count_type, ptr);
+                const uint8_t* list = ptr + count_size;
+                for (int64_t k = 1; k + 1 < count; k++) {
+                    indices.push_back(get_index(list));
+                    indices.push_back(get_index(list + k * index_size));
+                    indices.push_back(get_index(list + (k + 1) * index_size));
+                }
+            }
+            ptr = property_end;
+        }
+    }
+}
+
+Triangle_Mesh load_ply_model(const std::string& path, float additional_scale) {
+    PROFILE_SCOPE("load_ply_model");
+    Mapped_File file;
+    if (!file.map(path, File_Access::whole_file))
+        error("failed to load ply model: " + path);
+
+    std::vector<Ply_Element> elements;
+    const uint8_t* data = file.data + parse_ply_header(file, path, elements);
+    const uint8_t* end = file.data + file.size;
+
+    // Locate vertex and face elements. Elements are stored sequentially, so elements that
+    // precede them have to be skipped.
+    const Ply_Element* vertex_element = nullptr;
+    const Ply_Element* face_element = nullptr;
+    const uint8_t* vertex_data = nullptr;
+    const uint8_t* face_data = nullptr;
+    for (const Ply_Element& element : elements) {
+        if (element.name == "vertex") {
+            vertex_element = &element;
+            vertex_data = data;
+        } else if (element.name == "face") {
+            face_element = &element;
+            face_data = data;
+        }
+        if (vertex_element && face_element)
+            break;
+        data = skip_ply_element(element, data, end, path);
+    }
+    if (vertex_element == nullptr || face_element == nullptr)
+        error("ply file should have vertex and face elements: " + path);
+
+    const Ply_Property* x = vertex_element->find_property({"x"});
+    const Ply_Property* y = vertex_element->find_property({"y"});
+    const Ply_Property* z = vertex_element->find_property({"z"});
+    const Ply_Property* u = vertex_element->find_property({"u", "s", "texture_u", "texture_s"});
+    const Ply_Property* v = vertex_element->find_property({"v", "t", "texture_v", "texture_t"});
+    const Ply_Property* index_list = face_element->find_property({"vertex_indices", "vertex_index"});
+    if (!x || !y || !z)
+        error("ply vertex element does not have x, y, z properties: " + path);
+    if (vertex_element->list_count != 0)
+        error("ply vertex element with list properties is not supported: " + path);
+    if (!index_list || !index_list->is_list)
+        error("ply face element does not have vertex_indices list: " + path);
+    if (vertex_element->count > std::numeric_limits<uint32_t>::max())
+        error("ply file has too many vertices: " + path);
+    // Empty mesh can't be normalized and would produce empty GPU buffers.
+    if (vertex_element->count == 0)
+        error("ply file has no vertices: " + path);
+    if (face_element->count == 0)
+        error("ply file has no faces: " + path);
+
+    Triangle_Mesh mesh;
+    const uint32_t vertex_count = uint32_t(vertex_element->count);
+    const uint32_t vertex_size = vertex_element->non_list_size;
+    if (uint64_t(end - vertex_data) / vertex_size < vertex_count)
+        error("unexpected end of ply file: " + path);
+
+    // Vertices.
+    Vector3 mesh_min(Infinity);
+    Vector3 mesh_max(-Infinity);
+    {
+        PROFILE_SCOPE("read ply vertices");
+        mesh.vertices.resize(vertex_count);
+        const size_t chunk_count = get_parallel_chunk_count(vertex_count, 256 * 1024);
+        std::vector<Vector3> chunk_min(chunk_count, Vector3(Infinity));
+        std::vector<Vector3> chunk_max(chunk_count, Vector3(-Infinity));
+
+        run_parallel(chunk_count, [&](size_t chunk_index) {
+            PROFILE_SCOPE("read ply vertices chunk");
+            const uint32_t first_vertex = uint32_t(uint64_t(vertex_count) * chunk_index / chunk_count);
+            const uint32_t last_vertex = uint32_t(uint64_t(vertex_count) * (chunk_index + 1) / chunk_count);
+            Vector3 bounds_min(Infinity);
+            Vector3 bounds_max(-Infinity);
+            for (uint32_t i = first_vertex; i < last_vertex; i++) {
+                const uint8_t* record = vertex_data + size_t(i) * vertex_size;
+                Vertex& vertex = mesh.vertices[i];
+                vertex.pos.x = read_ply_float(x->type, record + x->offset);
+                vertex.pos.y = read_ply_float(y->type, record + y->offset);
+                vertex.pos.z = read_ply_float(z->type, record + z->offset);
+                if (u && v) {
+                    vertex.uv.x = read_ply_float(u->type, record + u->offset);
+                    vertex.uv.y = 1.f - read_ply_float(v->type, record + v->offset);
+                }
+                for (int k = 0; k < 3; k++) {
+                    bounds_min[k] = std::min(bounds_min[k], vertex.pos[k]);
+                    bounds_max[k] = std::max(bounds_max[k], vertex.pos[k]);
+                }
+            }
+            chunk_min[chunk_index] = bounds_min;
+            chunk_max[chunk_index] = bounds_max;
+        });
+        for (size_t i = 0; i < chunk_count; i++) {
+            for (int k = 0; k < 3; k++) {
+                mesh_min[k] = std::min(mesh_min[k], chunk_min[i][k]);
+                mesh_max[k] = std::max(mesh_max[k], chunk_max[i][k]);
+            }
+        }
+    }
+
+    // Faces.
+    {
+        PROFILE_SCOPE("read ply faces");
+        if (!read_ply_triangles(*face_element, *index_list, face_data, end, vertex_count, mesh.indices, path))
+            read_ply_polygons(*face_element, *index_list, face_data, end, vertex_count, mesh.indices, path);
+    }
+    if (mesh.indices.size() >= size_t(UINT32_MAX))
+        error("ply file has too many faces: " + path);
+    if (mesh.indices.empty())
+        error("ply file has no triangles (all faces have less than 3 vertices): " + path);
+    mesh.shapes.push_back(Mesh_Shape{ 0, vertex_count, 0, uint32_t(mesh.indices.size()) });
+
+    // scale and center the mesh
+    {
+        PROFILE_SCOPE("normalize ply vertices");
+        Vector3 diag = mesh_max - mesh_min;
+        float max_size = std::max(diag.x, std::max(diag.y, diag.z));
+        float scale = (2.f / max_size) * additional_scale;
+        Vector3 center = (mesh_min + mesh_max) * 0.5f;
+
+        const size_t chunk_count = get_parallel_chunk_count(vertex_count, 256 * 1024);
+        run_parallel(chunk_count, [&](size_t chunk_index) {
+            const uint32_t first_vertex = uint32_t(uint64_t(vertex_count) * chunk_index / chunk_count);
+            const uint32_t last_vertex = uint32_t(uint64_t(vertex_count) * (chunk_index + 1) / chunk_count);
+            for (uint32_t i = first_vertex; i < last_vertex; i++) {
+                mesh.vertices[i].pos -= center;
+                mesh.vertices[i].pos *= scale;
+            }
+        });
+    }
+    return mesh;
+}
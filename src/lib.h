@@ -4,7 +4,11 @@
 #include <cmath>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <limits>
+#include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -23,7 +27,95 @@ inline float degrees(float radians) {
 
 void error(const std::string& message);
 std::string get_resource_path(const std::string& path_relative_data_directory);
-std::vector<uint8_t> read_binary_file(const std::string& file_name);
+
+// Access pattern hint for the OS paging of the mapped file.
+enum class File_Access {
+    sequential, // read front to back once, the pages can be reclaimed early
+    random,     // no read-ahead
+    whole_file, // the whole file is needed soon, possibly by several threads: starts reading it in
+};
+
+// Read-only memory mapping of the entire file. This is the common way to read assets: the pages are
+// loaded lazily and the data can be parsed or copied to staging memory without intermediate buffers.
+struct Mapped_File {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    Mapped_File() = default;
+    Mapped_File(Mapped_File&& other) noexcept;
+    Mapped_File& operator=(Mapped_File&& other) noexcept;
+    Mapped_File(const Mapped_File&) = delete;
+    Mapped_File& operator=(const Mapped_File&) = delete;
+    ~Mapped_File() { unmap(); }
+
+    // Returns false if the file can't be opened or mapped.
+    bool map(const std::string& file_name, File_Access access = File_Access::sequential);
+    void unmap();
+
+private:
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+// Returns path with a suffix that is unique for the calling process and thread. Used for the temporary files
+// that are renamed to path when complete, so concurrent writers of the same file do not share the temporary file.
+std::string get_unique_temp_path(const std::string& path);
+
+// Formats the number with the given number of decimals for JSON output. JSON can't represent infinity
+// and NaN, such values are written as null.
+std::string format_json_number(double value, int decimals);
+
+// RGBA8 pixels of the decoded image file (formats supported by stb_image).
+struct Image_Pixels {
+    int width = 0;
+    int height = 0;
+    uint8_t* rgba = nullptr;
+
+    Image_Pixels() = default;
+    Image_Pixels(Image_Pixels&& other) noexcept;
+    Image_Pixels& operator=(Image_Pixels&& other) noexcept;
+    Image_Pixels(const Image_Pixels&) = delete;
+    Image_Pixels& operator=(const Image_Pixels&) = delete;
+    ~Image_Pixels() { release(); }
+
+    void release();
+};
+
+// Can be called from any thread. Channels are expanded to RGBA.
+Image_Pixels decode_image(const std::string& file_name);
+
+// Runs decode_image on the worker pool (see run_async). Decoding errors are rethrown by get().
+std::future<Image_Pixels> decode_image_async(const std::string& file_name);
+
+// Fast non-cryptographic 64-bit hash.
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Runs func(chunk_index) for each chunk in parallel. The chunks are processed by the calling thread together
+// with the threads of the worker pool, which are created once and reused by all calls. Returns when all chunks
+// are processed. If func throws, the first exception is rethrown on the calling thread.
+// Can be called from a worker pool task: the helper tasks are queued ahead of the pending tasks, so idle
+// workers join the nested job, and the calling worker processes the chunks that no one else has claimed.
+void run_parallel(size_t chunk_count, const std::function<void(size_t chunk_index)>& func);
+
+// Queues the task to the worker pool. At most one task per hardware thread runs at a time, the rest wait in the queue.
+void submit_worker_task(std::function<void()> task);
+
+// Runs func on the worker pool. Use it instead of std::async to keep the number of threads and the memory
+// of the tasks in flight bounded. Exceptions are rethrown by get().
+template <typename Func>
+auto run_async(Func&& func) -> std::future<decltype(func())> {
+    using Result = decltype(func());
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+    std::future<Result> future = task->get_future();
+    submit_worker_task([task] { (*task)(); });
+    return future;
+}
+
+// Number of chunks to split item_count items into, so each chunk has at least min_chunk_items items.
+// Limited by the number of hardware threads.
+size_t get_parallel_chunk_count(size_t item_count, size_t min_chunk_items);
 
 struct Timestamp {
     Timestamp() : t(std::chrono::steady_clock::now()) {}
@@ -51,20 +143,6 @@ inline T round_up(T k, T alignment) {
     return (k + alignment - 1) & ~(alignment - 1);
 }
 
-#if 0
-#define START_TIMER { Timestamp t;
-#define STOP_TIMER(message) \
-    auto d = elapsed_nanoseconds(t); \
-    static Timestamp t0; \
-    if (elapsed_milliseconds(t0) > 1000) { \
-        t0 = Timestamp(); \
-        printf(message ## " time = %lld  microseconds\n", d / 1000); } }
-
-#else
-#define START_TIMER
-#define STOP_TIMER(...)
-#endif
-
 struct Vector4;
 
 struct Vector3 {
@@ -298,14 +376,84 @@ Matrix4x4 perspective_transform_opengl_z01(float fovy_radians, float aspect_rati
 Vector3 transform_point(const Matrix3x4& m, Vector3 p);
 Vector3 transform_vector(const Matrix3x4& m, Vector3 v);
 
+// Computes transform that centers the given bounds at the origin and scales them uniformly so the
+// largest dimension becomes 2 * additional_scale. This is the normalization load_obj_model applies to vertices.
+Matrix3x4 get_normalization_transform(Vector3 bounds_min, Vector3 bounds_max, float additional_scale);
+
 struct Vertex {
     Vector3 pos;
     Vector2 uv;
 };
 
+// Compact vertex attributes, 12 bytes per vertex instead of 20. Positions are SNORM16 relative to the
+// mesh bounds (see Vertex_Quantization), texture coordinates are half floats.
+struct Quantized_Position {
+    int16_t x, y, z;
+    int16_t w; // unused, 4 components keep the format usable for vertex input and BLAS builds
+};
+struct Quantized_UV {
+    uint16_t u, v;
+};
+
+// Maps positions within the bounds to [-1, 1]. Dequantization: pos = normalized_pos * scale + bias.
+struct Vertex_Quantization {
+    Vector3 scale = Vector3(1.f);
+    Vector3 bias = Vector3(0.f);
+
+    Matrix3x4 get_dequantization_transform() const;
+};
+
+Vertex_Quantization get_vertex_quantization(Vector3 bounds_min, Vector3 bounds_max);
+void quantize_vertices(std::span<const Vertex> vertices, const Vertex_Quantization& quantization,
+    Quantized_Position* positions, Quantized_UV* uvs);
+uint16_t float_to_half(float f);
+
+// Part of the mesh with a single material. Shape indices are relative to first_vertex.
+struct Mesh_Shape {
+    uint32_t first_vertex = 0;
+    uint32_t vertex_count = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+    int32_t material_index = -1; // -1 if the shape does not have a material
+};
+
+struct Mesh_Material {
+    std::string name;
+    std::string diffuse_texture; // file path, empty if not specified
+};
+
 struct Triangle_Mesh {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    // Shapes cover vertices and indices in order.
+    std::vector<Mesh_Shape> shapes;
+    std::vector<Mesh_Material> materials;
 };
 
+// Each OBJ shape (o/g and usemtl) gets its own vertices, so shapes can be uploaded as separate meshes.
+// Materials are loaded from the referenced MTL files. All shapes are scaled and centered together.
 Triangle_Mesh load_obj_model(const std::string& path, float additional_scale);
+
+// Loads binary little-endian PLY file. The vertex element should have x, y, z properties and optionally
+// texture coordinates (u/v, s/t, texture_u/texture_v). Faces are read from vertex_indices (or vertex_index)
+// list property, polygons are triangulated. The mesh is scaled and centered in the same way as in load_obj_model.
+// The mesh has a single shape without material.
+Triangle_Mesh load_ply_model(const std::string& path, float additional_scale);
+
+struct Mesh_Stream_Info {
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+    Vector3 bounds_min;
+    Vector3 bounds_max;
+    // Streamed indices are relative to the first vertex of their shape.
+    std::vector<Mesh_Shape> shapes;
+    std::vector<Mesh_Material> materials;
+};
+
+// Receives mesh data in chunks, so the consumer (e.g. GPU upload) does not require the whole mesh in memory.
+// begin is called once before the data, then all vertex chunks are written followed by all index chunks.
+struct Mesh_Stream {
+    std::function<void(const Mesh_Stream_Info& info)> begin;
+    std::function<void(std::span<const Vertex> vertices)> write_vertices;
+    std::function<void(std::span<const uint32_t> indices)> write_indices;
+};
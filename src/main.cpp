@@ -1,8 +1,21 @@
 #include "demo.h"
+#include "profiler.h"
+#include "startup_timer.h"
+#include "texture_cache.h"
 #include "glfw/glfw3.h"
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+static Demo_Init_Params demo_params;
+static Benchmark_Params benchmark_params;
+static int headless_frame_count = 1000;
+static std::string trace_file;
+static bool run_dedup_benchmark = false;
+static bool run_texture_checks = false;
+
 static bool parse_command_line(int argc, char** argv) {
     bool found_unknown_option = false;
     for (int i = 1; i < argc; i++) {
@@ -16,8 +29,173 @@ static bool parse_command_line(int argc, char** argv) {
                 i++;
             }
         }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            int width = 0, height = 0;
+            if (i == argc - 1 || sscanf(argv[i + 1], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                printf("--headless value is missing or has invalid format (expected WxH, for example 1920x1080)\n");
+            }
+            else {
+                demo_params.headless = true;
+                demo_params.headless_width = (uint32_t)width;
+                demo_params.headless_height = (uint32_t)height;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--frames") == 0) {
+            if (i == argc - 1 || atoi(argv[i + 1]) <= 0) {
+                printf("--frames value is missing or invalid\n");
+            }
+            else {
+                headless_frame_count = atoi(argv[i + 1]);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--trace") == 0) {
+            if (i == argc - 1) {
+                printf("--trace value is missing\n");
+            }
+            else {
+                trace_file = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--startup-report") == 0) {
+            if (i == argc - 1) {
+                printf("--startup-report value is missing\n");
+            }
+            else {
+                demo_params.startup_report_file = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--shader-stats") == 0) {
+            if (i == argc - 1) {
+                printf("--shader-stats value is missing\n");
+            }
+            else {
+                demo_params.shader_statistics_file = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            demo_params.benchmark = true;
+        }
+        else if (strcmp(argv[i], "--benchmark-warmup") == 0) {
+            if (i == argc - 1 || atoi(argv[i + 1]) < 0) {
+                printf("--benchmark-warmup value is missing or invalid\n");
+            }
+            else {
+                benchmark_params.warmup_frames = std::max(2, atoi(argv[i + 1]));
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--benchmark-frames") == 0) {
+            if (i == argc - 1 || atoi(argv[i + 1]) <= 0) {
+                printf("--benchmark-frames value is missing or invalid\n");
+            }
+            else {
+                benchmark_params.measured_frames = atoi(argv[i + 1]);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--benchmark-report") == 0) {
+            if (i == argc - 1) {
+                printf("--benchmark-report value is missing\n");
+            }
+            else {
+                benchmark_params.report_file = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--model") == 0) {
+            if (i == argc - 1) {
+                printf("--model value is missing\n");
+            }
+            else {
+                demo_params.model_file = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--texture-format") == 0) {
+            if (i == argc - 1) {
+                printf("--texture-format value is missing\n");
+            }
+            else {
+                if (strcmp(argv[i + 1], "rgba8") == 0)
+                    demo_params.texture_format = VK_FORMAT_R8G8B8A8_SRGB;
+                else if (strcmp(argv[i + 1], "bc1") == 0)
+                    demo_params.texture_format = VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+                else if (strcmp(argv[i + 1], "bc7") == 0)
+                    demo_params.texture_format = VK_FORMAT_BC7_SRGB_BLOCK;
+                else
+                    printf("--texture-format value is invalid: %s\n", argv[i + 1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--mip-filter") == 0) {
+            if (i == argc - 1) {
+                printf("--mip-filter value is missing\n");
+            }
+            else {
+                if (strcmp(argv[i + 1], "box") == 0)
+                    demo_params.mip_filter.filter = Mip_Filter::box;
+                else if (strcmp(argv[i + 1], "kaiser") == 0)
+                    demo_params.mip_filter.filter = Mip_Filter::kaiser;
+                else if (strcmp(argv[i + 1], "lanczos") == 0)
+                    demo_params.mip_filter.filter = Mip_Filter::lanczos;
+                else
+                    printf("--mip-filter value is invalid: %s\n", argv[i + 1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--mip-filter-radius") == 0) {
+            Mip_Filter_Params filter = demo_params.mip_filter;
+            if (i == argc - 1 || sscanf(argv[i + 1], "%f", &filter.radius) != 1 || !is_valid_mip_filter(filter)) {
+                printf("--mip-filter-radius value is missing or invalid (expected 1..8)\n");
+            }
+            else {
+                demo_params.mip_filter = filter;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--kaiser-alpha") == 0) {
+            Mip_Filter_Params filter = demo_params.mip_filter;
+            if (i == argc - 1 || sscanf(argv[i + 1], "%f", &filter.kaiser_alpha) != 1 || !is_valid_mip_filter(filter)) {
+                printf("--kaiser-alpha value is missing or invalid (expected 0..20)\n");
+            }
+            else {
+                demo_params.mip_filter = filter;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--quantize-vertices") == 0) {
+            demo_params.quantize_vertices = true;
+        }
+        else if (strcmp(argv[i], "--dedup-benchmark") == 0) {
+            run_dedup_benchmark = true;
+        }
+        else if (strcmp(argv[i], "--check-textures") == 0) {
+            run_texture_checks = true;
+        }
         else if (strcmp(argv[i], "--help") == 0) {
             printf("%-25s Path to the data directory. Default is ./data.\n", "--data-dir");
+            printf("%-25s Mesh file to load (.obj, .ply or .glb). Default is model/mesh.obj in the data directory.\n", "--model <file>");
+            printf("%-25s Texture format: rgba8, bc1 or bc7. Default is bc7.\n", "--texture-format <fmt>");
+            printf("%-25s Texture mip filter: box, kaiser or lanczos. Default is kaiser.\n", "--mip-filter <filter>");
+            printf("%-25s Kaiser and Lanczos kernel radius in destination pixels (1..8). Default is 3.\n", "--mip-filter-radius R");
+            printf("%-25s Kaiser window shape (0..20). Default is 4.\n", "--kaiser-alpha A");
+            printf("%-25s Stores OBJ and PLY vertices as SNORM16 positions and half float uvs (12 bytes per vertex).\n", "--quantize-vertices");
+            printf("%-25s Render offscreen with the given resolution without window and swapchain.\n", "--headless WxH");
+            printf("%-25s Number of frames to render in headless mode. Default is 1000.\n", "--frames N");
+            printf("%-25s Records CPU trace and saves it in Chrome trace format on exit.\n", "--trace <file>");
+            printf("%-25s Saves time-to-first-frame breakdown as JSON.\n", "--startup-report <file>");
+            printf("%-25s Saves driver's shader statistics (registers, spills, instructions) as JSON.\n", "--shader-stats <file>");
+            printf("%-25s Runs benchmark with vsync disabled and writes the report.\n", "--benchmark");
+            printf("%-25s Number of warmup frames per benchmark run. Default is 100.\n", "--benchmark-warmup N");
+            printf("%-25s Number of measured frames per benchmark run. Default is 500.\n", "--benchmark-frames N");
+            printf("%-25s Report file name without extension. Default is benchmark.\n", "--benchmark-report");
+            printf("%-25s Runs CPU benchmark of OBJ vertex deduplication methods and exits.\n", "--dedup-benchmark");
+            printf("%-25s Checks SIMD mip filter against the scalar implementation, checks that texture encoding uses several threads and exits.\n", "--check-textures");
             printf("%-25s Shows this information.\n", "--help");
             return false;
         }
@@ -61,22 +239,17 @@ static void glfw_error_callback(int error, const char* description) {
     fprintf(stderr, "GLFW error: %s\n", description);
 }
 
-int main(int argc, char** argv) {
-    if (!parse_command_line(argc, argv)) {
-        return 0;
+static void run_headless_frames(Vk_Demo& demo) {
+    Timestamp t;
+    for (int i = 0; i < headless_frame_count; i++) {
+        demo.run_frame();
     }
-    glfwSetErrorCallback(glfw_error_callback);
-    if (!glfwInit()) {
-        error("glfwInit failed");
-    }
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    GLFWwindow* glfw_window = glfwCreateWindow(window_width, window_height, "Vulkan demo", nullptr, nullptr);
-    assert(glfw_window != nullptr);
-    glfwSetKeyCallback(glfw_window, glfw_key_callback);
-
-    Vk_Demo demo{};
-    demo.initialize(glfw_window);
+    VK_CHECK(vkDeviceWaitIdle(vk.device));
+    double seconds = double(elapsed_nanoseconds(t)) * 1e-9;
+    printf("Rendered %d frames in %.3f seconds (%.1f FPS)\n", headless_frame_count, seconds, headless_frame_count / seconds);
+}
 
+static void run_window_loop(Vk_Demo& demo, GLFWwindow* glfw_window) {
     bool prev_vsync = demo.vsync_enabled();
 
     bool window_active = true;
@@ -85,7 +258,10 @@ int main(int argc, char** argv) {
         if (window_active)
             demo.run_frame();
 
-        glfwPollEvents();
+        {
+            PROFILE_SCOPE("glfwPollEvents");
+            glfwPollEvents();
+        }
 
         int width, height;
         glfwGetWindowSize(glfw_window, &width, &height);
@@ -106,6 +282,7 @@ int main(int argc, char** argv) {
             continue; 
 
         if (recreate_swapchain) {
+            PROFILE_SCOPE("recreate_swapchain");
             VK_CHECK(vkDeviceWaitIdle(vk.device));
             demo.release_resolution_dependent_resources();
             vk_destroy_swapchain();
@@ -114,8 +291,62 @@ int main(int argc, char** argv) {
             recreate_swapchain = false;
         }
     }
+}
+
+int main(int argc, char** argv) {
+    startup_timer_start();
+    if (!parse_command_line(argc, argv)) {
+        return 0;
+    }
+    if (run_dedup_benchmark) {
+        run_vertex_dedup_benchmark();
+        return 0;
+    }
+    if (run_texture_checks) {
+        check_mip_filter();
+        check_texture_encode_threads();
+        return 0;
+    }
+    // Benchmark runs also track startup regressions.
+    if (demo_params.benchmark && demo_params.startup_report_file.empty()) {
+        demo_params.startup_report_file = benchmark_params.report_file + "_startup.json";
+    }
+    if (!trace_file.empty()) {
+        profiler_enable(true);
+    }
+
+    GLFWwindow* glfw_window = nullptr;
+    if (!demo_params.headless) {
+        glfwSetErrorCallback(glfw_error_callback);
+        if (!glfwInit()) {
+            error("glfwInit failed");
+        }
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfw_window = glfwCreateWindow(window_width, window_height, "Vulkan demo", nullptr, nullptr);
+        assert(glfw_window != nullptr);
+        glfwSetKeyCallback(glfw_window, glfw_key_callback);
+        startup_phase_done("create window");
+    }
+
+    Vk_Demo demo{};
+    demo.initialize(glfw_window, demo_params);
+
+    if (demo_params.benchmark) {
+        write_benchmark_report(demo.run_benchmark(benchmark_params), benchmark_params.report_file);
+    }
+    else if (demo_params.headless) {
+        run_headless_frames(demo);
+    }
+    else {
+        run_window_loop(demo, glfw_window);
+    }
 
     demo.shutdown();
-    glfwTerminate();
+    if (glfw_window) {
+        glfwTerminate();
+    }
+    if (!trace_file.empty()) {
+        profiler_write_chrome_trace(trace_file);
+    }
     return 0;
 }
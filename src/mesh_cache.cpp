@@ -0,0 +1,338 @@
+#include "mesh_cache.h"
+#include "mesh_cleanup.h"
+#include "obj_parser.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr uint32_t mesh_cache_magic = 0x4853454d; // "MESH"
+// Increment when the file layout or the Vertex format changes.
+constexpr uint32_t mesh_cache_version = 3;
+
+struct Mesh_Cache_Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_size;
+    uint32_t index_size;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    float additional_scale;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t shape_count;
+    uint64_t vertices_offset;
+    uint64_t indices_offset;
+    uint64_t shapes_offset; // Mesh_Shape array
+    uint64_t materials_offset; // (length, name, length, diffuse texture) for each material
+    uint32_t material_count;
+    uint32_t padding[3];
+};
+static_assert(sizeof(Mesh_Cache_Header) % 16 == 0);
+
+// Smaller files are parsed in parallel in memory, which is faster. Larger files are streamed,
+// so the face data is not kept in memory (vertex attributes still are, see stream_obj_model).
+constexpr uint64_t obj_streaming_threshold = 256 * 1024 * 1024;
+
+struct Source_Info {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+} // namespace
+
+static bool get_source_info(const std::string& path, Source_Info& info) {
+    std::error_code ec;
+    info.size = fs::file_size(path, ec);
+    if (ec)
+        return false;
+    fs::file_time_type mtime = fs::last_write_time(path, ec);
+    if (ec)
+        return false;
+    info.mtime = (int64_t)mtime.time_since_epoch().count();
+    return true;
+}
+
+static uint64_t hash_source_file(const std::string& path) {
+    PROFILE_SCOPE("hash mesh source");
+    Mapped_File file;
+    if (!file.map(path))
+        return 0;
+    return hash_bytes(file.data, file.size);
+}
+
+static std::string get_cache_file_path(const std::string& path, float additional_scale) {
+    std::error_code ec;
+    std::string key = fs::absolute(path, ec).generic_string();
+    if (ec)
+        key = path;
+    uint64_t key_hash = hash_bytes(key.data(), key.size());
+    key_hash = hash_bytes(&additional_scale, sizeof(additional_scale), key_hash);
+
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016llx", (unsigned long long)key_hash);
+    std::string file_name = fs::path(path).stem().string() + "_" + hash_str + ".mesh";
+    return get_resource_path("cache/" + file_name);
+}
+
+// True if [offset, offset + size) is within [0, limit). Does not overflow for any values read from the file.
+static bool is_range_within(uint64_t offset, uint64_t size, uint64_t limit) {
+    return offset <= limit && size <= limit - offset;
+}
+
+static bool validate_cache_layout(const Mapped_File& file) {
+    if (file.size < sizeof(Mesh_Cache_Header))
+        return false;
+    const Mesh_Cache_Header* header = (const Mesh_Cache_Header*)file.data;
+    if (header->magic != mesh_cache_magic || header->version != mesh_cache_version ||
+        header->vertex_size != sizeof(Vertex) || header->index_size != sizeof(uint32_t))
+        return false;
+    uint64_t vertices_size = uint64_t(header->vertex_count) * sizeof(Vertex);
+    uint64_t indices_size = uint64_t(header->index_count) * sizeof(uint32_t);
+    uint64_t shapes_size = uint64_t(header->shape_count) * sizeof(Mesh_Shape);
+    return header->vertices_offset % alignof(Vertex) == 0 &&
+        header->indices_offset % alignof(uint32_t) == 0 &&
+        header->shapes_offset % alignof(Mesh_Shape) == 0 &&
+        is_range_within(header->vertices_offset, vertices_size, file.size) &&
+        is_range_within(header->indices_offset, indices_size, file.size) &&
+        is_range_within(header->shapes_offset, shapes_size, header->materials_offset) &&
+        header->materials_offset <= header->vertices_offset;
+}
+
+static bool validate_shapes(const std::vector<Mesh_Shape>& shapes, uint32_t vertex_count, uint32_t index_count) {
+    for (const Mesh_Shape& shape : shapes) {
+        if (uint64_t(shape.first_vertex) + shape.vertex_count > vertex_count ||
+            uint64_t(shape.first_index) + shape.index_count > index_count)
+            return false;
+    }
+    return true;
+}
+
+static void write_string(std::vector<uint8_t>& data, const std::string& str) {
+    const uint32_t length = uint32_t(str.size());
+    data.insert(data.end(), (const uint8_t*)&length, (const uint8_t*)&length + sizeof(length));
+    data.insert(data.end(), str.begin(), str.end());
+}
+
+static bool read_string(const uint8_t*& ptr, const uint8_t* end, std::string& str) {
+    uint32_t length;
+    if (size_t(end - ptr) < sizeof(length))
+        return false;
+    memcpy(&length, ptr, sizeof(length));
+    ptr += sizeof(length);
+    if (size_t(end - ptr) < length)
+        return false;
+    str.assign((const char*)ptr, length);
+    ptr += length;
+    return true;
+}
+
+static std::vector<uint8_t> serialize_materials(const std::vector<Mesh_Material>& materials) {
+    std::vector<uint8_t> data;
+    for (const Mesh_Material& material : materials) {
+        write_string(data, material.name);
+        write_string(data, material.diffuse_texture);
+    }
+    return data;
+}
+
+static bool deserialize_materials(const uint8_t* ptr, const uint8_t* end, uint32_t material_count, std::vector<Mesh_Material>& materials) {
+    materials.resize(material_count);
+    for (Mesh_Material& material : materials) {
+        if (!read_string(ptr, end, material.name) || !read_string(ptr, end, material.diffuse_texture))
+            return false;
+    }
+    return true;
+}
+
+// Updates stored modification time when the source was touched but its content did not change.
+// The cache file should not be mapped: on Windows the mapping does not allow write access to the file.
+static void update_cache_mtime(const std::string& cache_path, int64_t mtime) {
+    FILE* file = fopen(cache_path.c_str(), "r+b");
+    if (!file)
+        return;
+    if (fseek(file, offsetof(Mesh_Cache_Header, source_mtime), SEEK_SET) == 0)
+        fwrite(&mtime, sizeof(mtime), 1, file);
+    fclose(file);
+}
+
+namespace {
+// Writes the streamed data to a temporary file which is renamed to the cache file name when complete,
+// so other processes never observe partially written cache.
+struct Cache_Writer {
+    std::string cache_path;
+    std::string temp_path;
+    FILE* file = nullptr;
+    bool ok = true;
+
+    // Removes incomplete file if loading was interrupted by an exception.
+    ~Cache_Writer() {
+        if (file) {
+            fclose(file);
+            std::error_code ec;
+            fs::remove(temp_path, ec);
+        }
+    }
+
+    void begin(const std::string& path, const Mesh_Cache_Header& header) {
+        cache_path = path;
+        temp_path = get_unique_temp_path(path);
+        std::error_code ec;
+        fs::create_directories(fs::path(cache_path).parent_path(), ec);
+        file = fopen(temp_path.c_str(), "wb");
+        ok = (file != nullptr);
+        write(&header, sizeof(header));
+    }
+
+    void write(const void* data, size_t size) {
+        if (ok && size > 0)
+            ok = fwrite(data, size, 1, file) == 1;
+    }
+
+    void end() {
+        std::error_code ec;
+        if (file) {
+            ok = (fclose(file) == 0) && ok;
+            file = nullptr;
+            if (ok) {
+                fs::rename(temp_path, cache_path, ec);
+                ok = !ec;
+            }
+            if (!ok)
+                fs::remove(temp_path, ec);
+        }
+        if (!ok)
+            printf("Warning: failed to write mesh cache: %s\n", cache_path.c_str());
+    }
+};
+} // namespace
+
+bool stream_mesh_cached(const std::string& path, float additional_scale, const Mesh_Stream& stream) {
+    PROFILE_SCOPE("stream_mesh_cached");
+    const std::string cache_path = get_cache_file_path(path, additional_scale);
+
+    Source_Info source;
+    if (!get_source_info(path, source))
+        error("failed to load mesh: " + path);
+
+    uint64_t source_hash = 0;
+    {
+        bool update_mtime = false;
+        Mapped_File cache_file;
+        if (cache_file.map(cache_path) && validate_cache_layout(cache_file)) {
+            const Mesh_Cache_Header* header = (const Mesh_Cache_Header*)cache_file.data;
+            bool valid = header->source_size == source.size && header->additional_scale == additional_scale;
+
+            // Content hash is checked only when the timestamp does not match (e.g. after git checkout).
+            if (valid && header->source_mtime != source.mtime) {
+                source_hash = hash_source_file(path);
+                valid = header->source_hash == source_hash;
+                update_mtime = valid;
+            }
+            Mesh_Stream_Info info;
+            if (valid) {
+                const Mesh_Shape* shapes = (const Mesh_Shape*)(cache_file.data + header->shapes_offset);
+                info.shapes.assign(shapes, shapes + header->shape_count);
+                valid = validate_shapes(info.shapes, header->vertex_count, header->index_count) &&
+                    deserialize_materials(cache_file.data + header->materials_offset, cache_file.data + header->vertices_offset,
+                        header->material_count, info.materials);
+            }
+            if (valid) {
+                info.vertex_count = header->vertex_count;
+                info.index_count = header->index_count;
+                info.bounds_min = Vector3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+                info.bounds_max = Vector3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+                stream.begin(info);
+                stream.write_vertices({ (const Vertex*)(cache_file.data + header->vertices_offset), header->vertex_count });
+                stream.write_indices({ (const uint32_t*)(cache_file.data + header->indices_offset), header->index_count });
+                cache_file.unmap();
+                if (update_mtime)
+                    update_cache_mtime(cache_path, source.mtime);
+                return true;
+            }
+        }
+    }
+
+    // Cache miss.
+    if (source_hash == 0)
+        source_hash = hash_source_file(path);
+
+    Cache_Writer cache_writer;
+    Mesh_Stream caching_stream;
+    caching_stream.begin = [&](const Mesh_Stream_Info& info) {
+        Mesh_Cache_Header header{};
+        header.magic = mesh_cache_magic;
+        header.version = mesh_cache_version;
+        header.vertex_size = sizeof(Vertex);
+        header.index_size = sizeof(uint32_t);
+        header.source_size = source.size;
+        header.source_mtime = source.mtime;
+        header.source_hash = source_hash;
+        header.additional_scale = additional_scale;
+        header.vertex_count = info.vertex_count;
+        header.index_count = info.index_count;
+        for (int i = 0; i < 3; i++) {
+            header.bounds_min[i] = info.bounds_min[i];
+            header.bounds_max[i] = info.bounds_max[i];
+        }
+        const std::vector<uint8_t> materials_data = serialize_materials(info.materials);
+        header.shape_count = uint32_t(info.shapes.size());
+        header.material_count = uint32_t(info.materials.size());
+        header.shapes_offset = sizeof(Mesh_Cache_Header);
+        header.materials_offset = header.shapes_offset + info.shapes.size() * sizeof(Mesh_Shape);
+        header.vertices_offset = round_up(header.materials_offset + materials_data.size(), uint64_t(16));
+        header.indices_offset = header.vertices_offset + uint64_t(header.vertex_count) * sizeof(Vertex);
+
+        cache_writer.begin(cache_path, header);
+        cache_writer.write(info.shapes.data(), info.shapes.size() * sizeof(Mesh_Shape));
+        cache_writer.write(materials_data.data(), materials_data.size());
+        const uint8_t padding[16] = {};
+        cache_writer.write(padding, header.vertices_offset - header.materials_offset - materials_data.size());
+        stream.begin(info);
+    };
+    caching_stream.write_vertices = [&](std::span<const Vertex> vertices) {
+        cache_writer.write(vertices.data(), vertices.size_bytes());
+        stream.write_vertices(vertices);
+    };
+    caching_stream.write_indices = [&](std::span<const uint32_t> indices) {
+        cache_writer.write(indices.data(), indices.size_bytes());
+        stream.write_indices(indices);
+    };
+
+    const bool ply = path.ends_with(".ply") || path.ends_with(".PLY");
+    if (!ply && source.size >= obj_streaming_threshold) {
+        stream_obj_model(path, additional_scale, caching_stream);
+    } else {
+        Triangle_Mesh mesh = ply ? load_ply_model(path, additional_scale) : load_obj_model(path, additional_scale);
+        print_mesh_cleanup_stats(path, cleanup_mesh(mesh, normalized_mesh_weld_tolerance));
+        if (mesh.indices.empty())
+            error("mesh has no triangles left after cleanup: " + path);
+
+        Mesh_Stream_Info info;
+        info.vertex_count = uint32_t(mesh.vertices.size());
+        info.index_count = uint32_t(mesh.indices.size());
+        info.shapes = std::move(mesh.shapes);
+        info.materials = std::move(mesh.materials);
+        info.bounds_min = Vector3(Infinity);
+        info.bounds_max = Vector3(-Infinity);
+        for (const Vertex& v : mesh.vertices) {
+            for (int i = 0; i < 3; i++) {
+                info.bounds_min[i] = std::min(info.bounds_min[i], v.pos[i]);
+                info.bounds_max[i] = std::max(info.bounds_max[i], v.pos[i]);
+            }
+        }
+        caching_stream.begin(info);
+        caching_stream.write_vertices(mesh.vertices);
+        caching_stream.write_indices(mesh.indices);
+    }
+    cache_writer.end();
+    return false;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "lib.h"
+
+// Streams the mesh through a versioned binary cache stored in the "cache" resource directory.
+// The cache entry is keyed by the source path and additional_scale and is validated against
+// source file size, modification time and content hash. On a hit the data is streamed directly
+// from the memory-mapped cache file. On a miss the OBJ or PLY (.ply extension) file is parsed and a new
+// cache entry is written while the data is streamed. Failure to write the cache is not an error.
+// Shapes and materials are stored in the cache too. Changes in MTL files are not detected.
+// Meshes loaded with load_obj_model or load_ply_model are processed by cleanup_mesh before they are
+// cached, so the cleanup runs only on a cache miss.
+// Returns true if the mesh was loaded from the cache.
+bool stream_mesh_cached(const std::string& path, float additional_scale, const Mesh_Stream& stream);
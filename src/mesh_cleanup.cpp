@@ -0,0 +1,192 @@
+#include "mesh_cleanup.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+using Triangle = std::array<uint32_t, 3>;
+
+struct Cell_Vertex {
+    uint64_t cell_key;
+    uint32_t vertex;
+
+    bool operator<(const Cell_Vertex& other) const {
+        return cell_key < other.cell_key || (cell_key == other.cell_key && vertex < other.vertex);
+    }
+};
+
+// 21 bits per axis. Cells that alias each other only produce extra candidates, since the distance is checked.
+uint64_t get_cell_key(int64_t x, int64_t y, int64_t z) {
+    return (uint64_t(x & 0x1fffff) << 42) | (uint64_t(y & 0x1fffff) << 21) | uint64_t(z & 0x1fffff);
+}
+
+bool are_vertices_close(const Vertex& a, const Vertex& b, float tolerance) {
+    return std::abs(a.pos.x - b.pos.x) <= tolerance &&
+        std::abs(a.pos.y - b.pos.y) <= tolerance &&
+        std::abs(a.pos.z - b.pos.z) <= tolerance &&
+        std::abs(a.uv.x - b.uv.x) <= tolerance &&
+        std::abs(a.uv.y - b.uv.y) <= tolerance;
+}
+
+// Returns index of the welded vertex for each vertex. Vertices are welded to the earliest close
+// vertex that is not welded itself, so the result does not depend on the processing order.
+std::vector<uint32_t> weld_vertices(std::span<const Vertex> vertices, float tolerance) {
+    std::vector<uint32_t> remap(vertices.size());
+    for (uint32_t i = 0; i < (uint32_t)vertices.size(); i++)
+        remap[i] = i;
+    if (tolerance <= 0.f)
+        return remap;
+
+    // The cell is larger than the search box (2 * tolerance), so most searches touch a single cell.
+    const float cell_size = 8.f * tolerance;
+    auto get_cell = [cell_size](float x) { return int64_t(std::floor(x / cell_size)); };
+
+    std::vector<Cell_Vertex> cell_vertices(vertices.size());
+    for (uint32_t i = 0; i < (uint32_t)vertices.size(); i++) {
+        const Vector3& p = vertices[i].pos;
+        cell_vertices[i] = Cell_Vertex{ get_cell_key(get_cell(p.x), get_cell(p.y), get_cell(p.z)), i };
+    }
+    std::sort(cell_vertices.begin(), cell_vertices.end());
+
+    for (uint32_t i = 0; i < (uint32_t)vertices.size(); i++) {
+        const Vector3& p = vertices[i].pos;
+        int64_t min_cell[3], max_cell[3];
+        for (int k = 0; k < 3; k++) {
+            min_cell[k] = get_cell(p[k] - tolerance);
+            max_cell[k] = get_cell(p[k] + tolerance);
+        }
+        uint32_t target = i;
+        for (int64_t x = min_cell[0]; x <= max_cell[0]; x++) {
+            for (int64_t y = min_cell[1]; y <= max_cell[1]; y++) {
+                for (int64_t z = min_cell[2]; z <= max_cell[2]; z++) {
+                    auto it = std::lower_bound(cell_vertices.begin(), cell_vertices.end(), Cell_Vertex{ get_cell_key(x, y, z), 0 });
+                    // Vertices of the cell are sorted by index, only the earlier ones can be targets.
+                    for (; it != cell_vertices.end() && it->cell_key == get_cell_key(x, y, z) && it->vertex < target; ++it) {
+                        if (remap[it->vertex] == it->vertex && are_vertices_close(vertices[it->vertex], vertices[i], tolerance)) {
+                            target = it->vertex;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        remap[i] = target;
+    }
+    return remap;
+}
+
+// Rotates the triangle so the smallest index is first. Winding is preserved.
+Triangle get_canonical_triangle(const Triangle& t) {
+    if (t[1] < t[0] && t[1] < t[2])
+        return { t[1], t[2], t[0] };
+    if (t[2] < t[0] && t[2] < t[1])
+        return { t[2], t[0], t[1] };
+    return t;
+}
+} // namespace
+
+Mesh_Cleanup_Stats cleanup_mesh(Triangle_Mesh& mesh, float weld_tolerance) {
+    PROFILE_SCOPE("cleanup_mesh");
+    Mesh_Cleanup_Stats stats;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    vertices.reserve(mesh.vertices.size());
+    indices.reserve(mesh.indices.size());
+
+    for (Mesh_Shape& shape : mesh.shapes) {
+        std::span<const Vertex> shape_vertices = std::span(mesh.vertices).subspan(shape.first_vertex, shape.vertex_count);
+        std::span<const uint32_t> shape_indices = std::span(mesh.indices).subspan(shape.first_index, shape.index_count);
+
+        const std::vector<uint32_t> remap = weld_vertices(shape_vertices, weld_tolerance);
+        for (uint32_t i = 0; i < shape.vertex_count; i++)
+            stats.welded_vertices += (remap[i] != i);
+
+        // Remove degenerate triangles.
+        std::vector<Triangle> triangles;
+        triangles.reserve(shape.index_count / 3);
+        for (uint32_t i = 0; i + 2 < shape.index_count; i += 3) {
+            const Triangle t = { remap[shape_indices[i]], remap[shape_indices[i + 1]], remap[shape_indices[i + 2]] };
+            bool degenerate = (t[0] == t[1] || t[1] == t[2] || t[0] == t[2]);
+            if (!degenerate) {
+                const Vector3 n = cross(shape_vertices[t[1]].pos - shape_vertices[t[0]].pos, shape_vertices[t[2]].pos - shape_vertices[t[0]].pos);
+                degenerate = (dot(n, n) < weld_tolerance * weld_tolerance * weld_tolerance * weld_tolerance);
+            }
+            if (degenerate)
+                stats.degenerate_triangles++;
+            else
+                triangles.push_back(t);
+        }
+
+        // Remove duplicate triangles, the first occurrence is kept.
+        std::vector<bool> keep(triangles.size(), true);
+        {
+            std::vector<std::pair<Triangle, uint32_t>> sorted_triangles(triangles.size());
+            for (uint32_t i = 0; i < (uint32_t)triangles.size(); i++)
+                sorted_triangles[i] = { get_canonical_triangle(triangles[i]), i };
+            std::sort(sorted_triangles.begin(), sorted_triangles.end());
+            for (size_t i = 1; i < sorted_triangles.size(); i++) {
+                if (sorted_triangles[i].first == sorted_triangles[i - 1].first) {
+                    keep[sorted_triangles[i].second] = false;
+                    stats.duplicate_triangles++;
+                }
+            }
+        }
+
+        // Strip unused vertices. The original vertex order is preserved.
+        std::vector<uint32_t> new_index(shape.vertex_count, UINT32_MAX);
+        for (size_t i = 0; i < triangles.size(); i++) {
+            if (keep[i]) {
+                for (uint32_t v : triangles[i])
+                    new_index[v] = 0;
+            }
+        }
+        const uint32_t first_vertex = uint32_t(vertices.size());
+        for (uint32_t i = 0; i < shape.vertex_count; i++) {
+            if (new_index[i] == UINT32_MAX) {
+                stats.unused_vertices += (remap[i] == i);
+                continue;
+            }
+            new_index[i] = uint32_t(vertices.size()) - first_vertex;
+            vertices.push_back(shape_vertices[i]);
+        }
+
+        const uint32_t first_index = uint32_t(indices.size());
+        for (size_t i = 0; i < triangles.size(); i++) {
+            if (keep[i]) {
+                for (uint32_t v : triangles[i])
+                    indices.push_back(new_index[v]);
+            }
+        }
+
+        shape.first_vertex = first_vertex;
+        shape.vertex_count = uint32_t(vertices.size()) - first_vertex;
+        shape.first_index = first_index;
+        shape.index_count = uint32_t(indices.size()) - first_index;
+    }
+
+    // Shapes that lost all triangles are removed.
+    const size_t shape_count = mesh.shapes.size();
+    mesh.shapes.erase(std::remove_if(mesh.shapes.begin(), mesh.shapes.end(),
+        [](const Mesh_Shape& shape) { return shape.index_count == 0; }), mesh.shapes.end());
+    stats.removed_shapes = shape_count - mesh.shapes.size();
+
+    mesh.vertices = std::move(vertices);
+    mesh.indices = std::move(indices);
+    return stats;
+}
+
+void print_mesh_cleanup_stats(const std::string& mesh_name, const Mesh_Cleanup_Stats& stats) {
+    printf("%s: removed %llu degenerate and %llu duplicate triangles, welded %llu vertices, stripped %llu unused vertices\n",
+        mesh_name.c_str(),
+        (unsigned long long)stats.degenerate_triangles,
+        (unsigned long long)stats.duplicate_triangles,
+        (unsigned long long)stats.welded_vertices,
+        (unsigned long long)stats.unused_vertices);
+    if (stats.removed_shapes > 0) {
+        printf("%s: skipped %llu shapes that have no triangles left after cleanup\n",
+            mesh_name.c_str(), (unsigned long long)stats.removed_shapes);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "lib.h"
+
+struct Mesh_Cleanup_Stats {
+    uint64_t degenerate_triangles = 0; // including triangles collapsed by welding
+    uint64_t duplicate_triangles = 0;
+    uint64_t welded_vertices = 0;
+    uint64_t unused_vertices = 0;
+    uint64_t removed_shapes = 0; // shapes that had only degenerate or duplicate triangles
+};
+
+// Removes zero-area and duplicate triangles, welds vertices whose positions and texture coordinates
+// differ by no more than weld_tolerance (per component) and strips unreferenced vertices.
+// A triangle is zero-area when twice its area is below weld_tolerance^2. Triangles are duplicates
+// when they reference the same vertices with the same winding, opposite windings are preserved.
+// Shapes are processed independently and keep referencing only their own vertices. Shapes without
+// triangles left are removed from the mesh. The caller should check if the mesh became empty.
+Mesh_Cleanup_Stats cleanup_mesh(Triangle_Mesh& mesh, float weld_tolerance);
+
+// Weld tolerance for meshes normalized by load_obj_model/load_ply_model (the largest extent is a few units).
+constexpr float normalized_mesh_weld_tolerance = 1e-5f;
+
+// Also prints a warning if some shapes were removed.
+void print_mesh_cleanup_stats(const std::string& mesh_name, const Mesh_Cleanup_Stats& stats);
@@ -0,0 +1,813 @@
+#include "obj_parser.h"
+#include "lib.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+struct Attribute_Counts {
+    size_t positions = 0;
+    size_t texcoords = 0;
+    size_t normals = 0;
+};
+
+// Smaller files are parsed by fewer threads, so thread startup cost does not dominate.
+constexpr size_t min_chunk_size = 1024 * 1024;
+
+struct Chunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    Attribute_Counts count; // number of attribute records in the chunk
+    Attribute_Counts base; // number of attribute records in the preceding chunks
+
+    std::vector<Obj_Index> indices;
+    size_t index_base = 0;
+
+    // o/g, usemtl and mtllib records in the chunk. index_position is the chunk index count at the record.
+    struct Record {
+        enum class Type { name, material, material_library };
+        Type type;
+        size_t index_position;
+        std::string value;
+    };
+    std::vector<Record> records;
+
+    std::string error_message;
+    const char* error_line = nullptr; // the record that caused the error
+};
+} // namespace
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+// Parses decimal floating point number in [+-]digits[.digits][(e|E)[+-]digits] format.
+// The result is within one double rounding step from the correctly rounded value, which is
+// more than enough for float. Returns nullptr if there is no number at p.
+static const char* parse_float(const char* p, const char* end, float& value) {
+    static constexpr double powers_of_10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digit_count = 0;
+    int exponent = 0;
+    bool has_digits = false;
+
+    // Digits that do not fit into 64-bit mantissa only affect the exponent.
+    for (; p < end && is_digit(*p); p++) {
+        has_digits = true;
+        if (digit_count < 19) {
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+            if (mantissa != 0)
+                digit_count++;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        p++;
+        for (; p < end && is_digit(*p); p++) {
+            has_digits = true;
+            if (digit_count < 19) {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                if (mantissa != 0)
+                    digit_count++;
+                exponent--;
+            }
+        }
+    }
+    if (!has_digits)
+        return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negative_exponent = (*q == '-');
+            q++;
+        }
+        if (q < end && is_digit(*q)) {
+            int e = 0;
+            for (; q < end && is_digit(*q); q++) {
+                if (e < 10000)
+                    e = e * 10 + (*q - '0');
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double d = double(mantissa);
+    if (mantissa != 0 && exponent != 0) {
+        if (exponent > 0 && exponent <= 22)
+            d *= powers_of_10[exponent];
+        else if (exponent < 0 && exponent >= -22)
+            d /= powers_of_10[-exponent];
+        else
+            d *= std::pow(10.0, exponent);
+    }
+    value = float(negative ? -d : d);
+    return p;
+}
+
+// Parses up to count values. Returns the number of parsed values or -1 if the value is malformed.
+// Missing values are not modified. The values after the first count are ignored (optional w, vertex colors).
+static int parse_floats(const char* p, const char* line_end, float* values, int count) {
+    int parsed_count = 0;
+    for (; parsed_count < count; parsed_count++) {
+        p = skip_spaces(p, line_end);
+        if (p == line_end)
+            break;
+        p = parse_float(p, line_end, values[parsed_count]);
+        if (p == nullptr || (p < line_end && !is_space(*p)))
+            return -1;
+    }
+    return parsed_count;
+}
+
+static const char* parse_int(const char* p, const char* end, int64_t& value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p == end || !is_digit(*p))
+        return nullptr;
+    int64_t v = 0;
+    for (; p < end && is_digit(*p); p++) {
+        if (v < (int64_t(1) << 40))
+            v = v * 10 + (*p - '0');
+    }
+    value = negative ? -v : v;
+    return p;
+}
+
+// Converts 1-based or relative (negative) OBJ index to zero-based index.
+// current_count is the number of records of this type that precede the face.
+static bool resolve_index(int64_t obj_index, size_t current_count, size_t total_count, int32_t& index) {
+    int64_t i = (obj_index > 0) ? obj_index - 1 : int64_t(current_count) + obj_index;
+    if (obj_index == 0 || i < 0 || i >= int64_t(total_count))
+        return false;
+    index = int32_t(i);
+    return true;
+}
+
+static void check_attribute_counts(const Attribute_Counts& counts) {
+    if (counts.positions > size_t(INT32_MAX) || counts.texcoords > size_t(INT32_MAX) || counts.normals > size_t(INT32_MAX))
+        error("obj file has too many vertex attributes");
+}
+
+static bool operator==(const Obj_Index& a, const Obj_Index& b) {
+    return a.position == b.position && a.texcoord == b.texcoord && a.normal == b.normal;
+}
+
+static bool operator<(const Obj_Index& a, const Obj_Index& b) {
+    if (a.position != b.position)
+        return a.position < b.position;
+    if (a.texcoord != b.texcoord)
+        return a.texcoord < b.texcoord;
+    return a.normal < b.normal;
+}
+
+static uint64_t hash_obj_index(const Obj_Index& index) {
+    uint64_t h = uint64_t(uint32_t(index.position)) * 0x9e3779b97f4a7c15ull;
+    h ^= uint64_t(uint32_t(index.texcoord)) * 0xc2b2ae3d27d4eb4full;
+    h ^= uint64_t(uint32_t(index.normal)) * 0x165667b19e3779f9ull;
+    return h ^ (h >> 32);
+}
+
+namespace {
+// Open-addressing hash table with linear probing that maps face corner attributes to vertex index.
+// The slots store only vertex indices, the keys are looked up in the vertex list.
+struct Obj_Vertex_Table {
+    static constexpr uint32_t empty_slot = UINT32_MAX;
+    std::vector<uint32_t> slots;
+    size_t mask = 0;
+
+    // The table does not grow until it has vertex_count entries (load factor <= 0.5).
+    void reserve(size_t vertex_count, const std::vector<Obj_Index>& vertices) {
+        size_t table_size = 16;
+        while (table_size < 2 * vertex_count)
+            table_size *= 2;
+        if (table_size <= slots.size())
+            return;
+        slots.assign(table_size, empty_slot);
+        mask = table_size - 1;
+        for (uint32_t vertex = 0; vertex < uint32_t(vertices.size()); vertex++)
+            slots[find_slot(vertices[vertex], vertices)] = vertex;
+    }
+
+    // Returns index of the existing vertex or appends a new one.
+    uint32_t find_or_insert(const Obj_Index& index, std::vector<Obj_Index>& vertices) {
+        if (2 * (vertices.size() + 1) > slots.size())
+            reserve(std::max(size_t(1024), 2 * vertices.size()), vertices);
+        size_t slot = find_slot(index, vertices);
+        if (slots[slot] == empty_slot) {
+            slots[slot] = uint32_t(vertices.size());
+            vertices.push_back(index);
+        }
+        return slots[slot];
+    }
+
+    // The vertex should be in the table.
+    uint32_t find(const Obj_Index& index, const std::vector<Obj_Index>& vertices) const {
+        return slots[find_slot(index, vertices)];
+    }
+
+    // Returns the slot that contains the key or the empty slot where it should be inserted.
+    size_t find_slot(const Obj_Index& index, const std::vector<Obj_Index>& vertices) const {
+        size_t slot = hash_obj_index(index) & mask;
+        while (slots[slot] != empty_slot && !(vertices[slots[slot]] == index))
+            slot = (slot + 1) & mask;
+        return slot;
+    }
+};
+} // namespace
+
+template <typename Line_Handler>
+static void for_each_line(const char* p, const char* end, Line_Handler&& handler) {
+    while (p < end) {
+        const char* line_end = (const char*)memchr(p, '\n', size_t(end - p));
+        if (line_end == nullptr)
+            line_end = end;
+        const char* line = skip_spaces(p, line_end);
+        if (line < line_end)
+            handler(line, line_end);
+        p = line_end + 1;
+    }
+}
+
+static bool is_face_record(const char* line, const char* line_end) {
+    return line[0] == 'f' && line_end - line >= 2 && is_space(line[1]);
+}
+
+// Checks if the line is "keyword argument" record and returns the argument without surrounding spaces.
+static bool parse_keyword_record(const char* line, const char* line_end, const char* keyword, std::string& argument) {
+    const size_t keyword_length = strlen(keyword);
+    if (size_t(line_end - line) <= keyword_length || memcmp(line, keyword, keyword_length) != 0 || !is_space(line[keyword_length]))
+        return false;
+    const char* begin = skip_spaces(line + keyword_length, line_end);
+    const char* end = line_end;
+    while (end > begin && is_space(end[-1]))
+        end--;
+    argument.assign(begin, end);
+    return true;
+}
+
+// Returns 1 for "v", 2 for "vt", 3 for "vn" records and 0 otherwise.
+static int get_vertex_record_type(const char* line, const char* line_end) {
+    if (line_end - line < 2 || line[0] != 'v')
+        return 0;
+    if (is_space(line[1]))
+        return 1;
+    if (line_end - line >= 3 && is_space(line[2])) {
+        if (line[1] == 't')
+            return 2;
+        if (line[1] == 'n')
+            return 3;
+    }
+    return 0;
+}
+
+// Parses "v", "vt" or "vn" record. The v texture coordinate is optional, other components are required.
+static bool parse_vertex_record(int vertex_record_type, const char* line, const char* line_end, float* values) {
+    if (vertex_record_type == 1)
+        return parse_floats(line + 1, line_end, values, 3) == 3;
+    if (vertex_record_type == 2)
+        return parse_floats(line + 2, line_end, values, 2) >= 1;
+    return parse_floats(line + 2, line_end, values, 3) == 3;
+}
+
+// Returns "line N, offset M" location of the line in the file text.
+static std::string get_text_location(const char* text, const char* line) {
+    const size_t line_number = 1 + size_t(std::count(text, line, '\n'));
+    return "line " + std::to_string(line_number) + ", offset " + std::to_string(size_t(line - text));
+}
+
+// Parses corners of "f" record. current contains the number of attribute records that precede the face.
+static bool parse_face(const char* line, const char* line_end, const Attribute_Counts& current, const Attribute_Counts& total,
+    std::vector<Obj_Index>& polygon, std::string& error_message)
+{
+    polygon.clear();
+    const char* p = skip_spaces(line + 1, line_end);
+    while (p < line_end) {
+        Obj_Index index{ -1, -1, -1 };
+        int64_t value;
+        bool valid = false;
+
+        if ((p = parse_int(p, line_end, value)) != nullptr) {
+            valid = resolve_index(value, current.positions, total.positions, index.position);
+            if (valid && p < line_end && *p == '/') {
+                p++;
+                if (p < line_end && *p != '/') {
+                    p = parse_int(p, line_end, value);
+                    valid = p && resolve_index(value, current.texcoords, total.texcoords, index.texcoord);
+                }
+                if (valid && p < line_end && *p == '/') {
+                    p = parse_int(p + 1, line_end, value);
+                    valid = p && resolve_index(value, current.normals, total.normals, index.normal);
+                }
+            }
+        }
+        if (!valid || (p < line_end && !is_space(*p))) {
+            error_message = "invalid face definition: " + std::string(line, line_end);
+            return false;
+        }
+        polygon.push_back(index);
+        p = skip_spaces(p, line_end);
+    }
+    if (polygon.size() < 3) {
+        error_message = "face has less than 3 vertices: " + std::string(line, line_end);
+        return false;
+    }
+    return true;
+}
+
+static void count_records(Chunk& chunk) {
+    for_each_line(chunk.begin, chunk.end, [&chunk](const char* line, const char* line_end) {
+        switch (get_vertex_record_type(line, line_end)) {
+        case 1: chunk.count.positions++; break;
+        case 2: chunk.count.texcoords++; break;
+        case 3: chunk.count.normals++; break;
+        }
+    });
+}
+
+static void parse_records(Chunk& chunk, Obj_Data& data) {
+    const Attribute_Counts total{ data.positions.size() / 3, data.texcoords.size() / 2, data.normals.size() / 3 };
+
+    size_t position_index = chunk.base.positions;
+    size_t texcoord_index = chunk.base.texcoords;
+    size_t normal_index = chunk.base.normals;
+
+    // Typical OBJ files have ~2 faces per vertex and the face line is around 30-40 bytes.
+    chunk.indices.reserve(size_t(chunk.end - chunk.begin) / 12);
+    std::vector<Obj_Index> polygon;
+
+    for_each_line(chunk.begin, chunk.end, [&](const char* line, const char* line_end) {
+        if (!chunk.error_message.empty())
+            return;
+
+        const int vertex_record_type = get_vertex_record_type(line, line_end);
+        if (vertex_record_type != 0) {
+            float* values;
+            if (vertex_record_type == 1)
+                values = &data.positions[3 * position_index++];
+            else if (vertex_record_type == 2)
+                values = &data.texcoords[2 * texcoord_index++];
+            else
+                values = &data.normals[3 * normal_index++];
+            if (!parse_vertex_record(vertex_record_type, line, line_end, values)) {
+                chunk.error_message = "invalid vertex attribute: " + std::string(line, line_end);
+                chunk.error_line = line;
+            }
+        } else if (is_face_record(line, line_end)) {
+            const Attribute_Counts current{ position_index, texcoord_index, normal_index };
+            if (!parse_face(line, line_end, current, total, polygon, chunk.error_message)) {
+                chunk.error_line = line;
+                return;
+            }
+            // Fan triangulation.
+            for (size_t i = 2; i < polygon.size(); i++) {
+                chunk.indices.push_back(polygon[0]);
+                chunk.indices.push_back(polygon[i - 1]);
+                chunk.indices.push_back(polygon[i]);
+            }
+        } else if (line[0] == 'o' || line[0] == 'g' || line[0] == 'u' || line[0] == 'm') {
+            Chunk::Record record{ Chunk::Record::Type::name, chunk.indices.size() };
+            if (parse_keyword_record(line, line_end, "o", record.value) || parse_keyword_record(line, line_end, "g", record.value))
+                record.type = Chunk::Record::Type::name;
+            else if (parse_keyword_record(line, line_end, "usemtl", record.value))
+                record.type = Chunk::Record::Type::material;
+            else if (parse_keyword_record(line, line_end, "mtllib", record.value))
+                record.type = Chunk::Record::Type::material_library;
+            else
+                return;
+            chunk.records.push_back(std::move(record));
+        }
+    });
+}
+
+// Splits faces into shapes at o/g and usemtl records.
+static void create_shapes(const std::vector<Chunk>& chunks, Obj_Data& data) {
+    Obj_Shape shape;
+    for (const Chunk& chunk : chunks) {
+        for (const Chunk::Record& record : chunk.records) {
+            if (record.type == Chunk::Record::Type::material_library) {
+                data.material_libraries.push_back(record.value);
+                continue;
+            }
+            const std::string& current_value = (record.type == Chunk::Record::Type::name) ? shape.name : shape.material;
+            if (record.value == current_value)
+                continue;
+
+            const size_t index_position = chunk.index_base + record.index_position;
+            if (index_position > shape.first_index) {
+                shape.index_count = index_position - shape.first_index;
+                data.shapes.push_back(shape);
+                shape.first_index = index_position;
+            }
+            if (record.type == Chunk::Record::Type::name)
+                shape.name = record.value;
+            else
+                shape.material = record.value;
+        }
+    }
+    if (data.indices.size() > shape.first_index) {
+        shape.index_count = data.indices.size() - shape.first_index;
+        data.shapes.push_back(shape);
+    }
+}
+
+Obj_Data parse_obj(const char* text, size_t size, uint32_t thread_count) {
+    PROFILE_SCOPE("parse_obj");
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t chunk_count = std::clamp(size / min_chunk_size, size_t(1), size_t(thread_count));
+
+    // Split text into line-aligned chunks.
+    std::vector<Chunk> chunks(chunk_count);
+    const char* end = text + size;
+    const char* chunk_begin = text;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const char* chunk_end = end;
+        if (i + 1 < chunk_count) {
+            chunk_end = std::max(chunk_begin, text + size * (i + 1) / chunk_count);
+            const char* newline = (const char*)memchr(chunk_end, '\n', size_t(end - chunk_end));
+            chunk_end = newline ? newline + 1 : end;
+        }
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+
+    {
+        PROFILE_SCOPE("count records");
+        run_parallel(chunk_count, [&chunks](size_t i) {
+            PROFILE_SCOPE("count records chunk");
+            count_records(chunks[i]);
+        });
+    }
+
+    Obj_Data data;
+    {
+        Attribute_Counts total;
+        for (Chunk& chunk : chunks) {
+            chunk.base = total;
+            total.positions += chunk.count.positions;
+            total.texcoords += chunk.count.texcoords;
+            total.normals += chunk.count.normals;
+        }
+        check_attribute_counts(total);
+        data.positions.resize(total.positions * 3);
+        data.texcoords.resize(total.texcoords * 2);
+        data.normals.resize(total.normals * 3);
+    }
+
+    {
+        PROFILE_SCOPE("parse records");
+        run_parallel(chunk_count, [&chunks, &data](size_t i) {
+            PROFILE_SCOPE("parse records chunk");
+            parse_records(chunks[i], data);
+        });
+    }
+
+    size_t index_count = 0;
+    for (Chunk& chunk : chunks) {
+        if (!chunk.error_message.empty())
+            error(chunk.error_message + " (" + get_text_location(text, chunk.error_line) + ")");
+        chunk.index_base = index_count;
+        index_count += chunk.indices.size();
+    }
+
+    if (chunk_count == 1) {
+        data.indices = std::move(chunks[0].indices);
+    } else {
+        PROFILE_SCOPE("merge indices");
+        data.indices.resize(index_count);
+        run_parallel(chunk_count, [&chunks, &data](size_t i) {
+            Chunk& chunk = chunks[i];
+            if (!chunk.indices.empty())
+                memcpy(&data.indices[chunk.index_base], chunk.indices.data(), chunk.indices.size() * sizeof(Obj_Index));
+            chunk.indices = std::vector<Obj_Index>();
+        });
+    }
+    create_shapes(chunks, data);
+    return data;
+}
+
+std::vector<Obj_Material> parse_mtl(const char* text, size_t size) {
+    std::vector<Obj_Material> materials;
+    std::string argument;
+    for_each_line(text, text + size, [&materials, &argument](const char* line, const char* line_end) {
+        if (parse_keyword_record(line, line_end, "newmtl", argument)) {
+            materials.push_back(Obj_Material{ argument });
+        } else if (!materials.empty() && parse_keyword_record(line, line_end, "map_Kd", argument)) {
+            size_t last_space = argument.find_last_of(" \t");
+            materials.back().diffuse_texture = (last_space == std::string::npos) ? argument : argument.substr(last_space + 1);
+        }
+    });
+    return materials;
+}
+
+static void deduplicate_unordered_map(std::span<const Obj_Index> indices, Obj_Vertex_Mapping& mapping) {
+    struct Index_Hasher {
+        size_t operator()(const Obj_Index& index) const {
+            size_t hash = 0;
+            hash_combine(hash, index.position);
+            hash_combine(hash, index.normal);
+            hash_combine(hash, index.texcoord);
+            return hash;
+        }
+    };
+    std::unordered_map<Obj_Index, uint32_t, Index_Hasher> index_mapping;
+    for (size_t i = 0; i < indices.size(); i++) {
+        auto [it, inserted] = index_mapping.try_emplace(indices[i], uint32_t(mapping.unique_vertices.size()));
+        if (inserted)
+            mapping.unique_vertices.push_back(indices[i]);
+        mapping.indices[i] = it->second;
+    }
+}
+
+static void deduplicate_flat_hash(std::span<const Obj_Index> indices, Obj_Vertex_Mapping& mapping) {
+    // The number of unique vertices is not known in advance. Closed meshes have about 6 corners per vertex,
+    // the table is reserved for 4 corners per vertex (1-2 bytes per corner) and grows if the estimate is exceeded.
+    Obj_Vertex_Table table;
+    table.reserve(indices.size() / 4, mapping.unique_vertices);
+    for (size_t i = 0; i < indices.size(); i++)
+        mapping.indices[i] = table.find_or_insert(indices[i], mapping.unique_vertices);
+}
+
+// Sorts chunks in parallel, then merges pairs of sorted ranges in parallel until a single range is left.
+template <typename Compare>
+static void parallel_sort(std::vector<uint32_t>& values, Compare compare) {
+    const size_t chunk_count = get_parallel_chunk_count(values.size(), 64 * 1024);
+    std::vector<size_t> chunk_begin(chunk_count + 1);
+    for (size_t i = 0; i <= chunk_count; i++)
+        chunk_begin[i] = values.size() * i / chunk_count;
+
+    run_parallel(chunk_count, [&](size_t i) {
+        std::sort(values.begin() + chunk_begin[i], values.begin() + chunk_begin[i + 1], compare);
+    });
+    for (size_t width = 1; width < chunk_count; width *= 2) {
+        const size_t merge_count = (chunk_count + 2 * width - 1) / (2 * width);
+        run_parallel(merge_count, [&](size_t i) {
+            const size_t first = 2 * width * i;
+            const size_t middle = std::min(first + width, chunk_count);
+            const size_t last = std::min(first + 2 * width, chunk_count);
+            if (middle < last)
+                std::inplace_merge(values.begin() + chunk_begin[first], values.begin() + chunk_begin[middle],
+                    values.begin() + chunk_begin[last], compare);
+        });
+    }
+}
+
+static void deduplicate_sort(std::span<const Obj_Index> indices, Obj_Vertex_Mapping& mapping) {
+    std::vector<uint32_t> order(indices.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = uint32_t(i);
+
+    // Corners with equal attributes are ordered by position in the index buffer,
+    // so the first element of each group is the first occurrence. The order is total,
+    // so the parallel sort gives the same result as the serial one.
+    parallel_sort(order, [&indices](uint32_t a, uint32_t b) {
+        if (indices[a] == indices[b])
+            return a < b;
+        return indices[a] < indices[b];
+    });
+
+    // For each corner find its first occurrence.
+    std::vector<uint32_t> first_occurrence(indices.size());
+    for (size_t i = 0; i < order.size();) {
+        size_t group_end = i + 1;
+        while (group_end < order.size() && indices[order[group_end]] == indices[order[i]])
+            group_end++;
+        for (size_t k = i; k < group_end; k++)
+            first_occurrence[order[k]] = order[i];
+        i = group_end;
+    }
+
+    // Number first occurrences in index buffer order. A corner is processed after its first occurrence.
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (first_occurrence[i] == i) {
+            mapping.indices[i] = uint32_t(mapping.unique_vertices.size());
+            mapping.unique_vertices.push_back(indices[i]);
+        } else {
+            mapping.indices[i] = mapping.indices[first_occurrence[i]];
+        }
+    }
+}
+
+Obj_Vertex_Mapping deduplicate_obj_vertices(std::span<const Obj_Index> indices, Obj_Dedup_Method method) {
+    PROFILE_SCOPE("deduplicate_obj_vertices");
+    if (indices.size() >= size_t(UINT32_MAX))
+        error("obj file has too many face vertices");
+
+    Obj_Vertex_Mapping mapping;
+    mapping.indices.resize(indices.size());
+    // The number of unique vertices is usually much smaller than the number of corners.
+    mapping.unique_vertices.reserve(indices.size() / 4);
+
+    switch (method) {
+    case Obj_Dedup_Method::unordered_map:
+        deduplicate_unordered_map(indices, mapping);
+        break;
+    case Obj_Dedup_Method::flat_hash:
+        deduplicate_flat_hash(indices, mapping);
+        break;
+    case Obj_Dedup_Method::sort:
+        deduplicate_sort(indices, mapping);
+        break;
+    }
+    return mapping;
+}
+
+static size_t count_face_corners(const char* line, const char* line_end) {
+    size_t corner_count = 0;
+    const char* p = skip_spaces(line + 1, line_end);
+    while (p < line_end) {
+        corner_count++;
+        while (p < line_end && !is_space(*p))
+            p++;
+        p = skip_spaces(p, line_end);
+    }
+    return corner_count;
+}
+
+void stream_obj_model(const std::string& path, float additional_scale, const Mesh_Stream& stream) {
+    PROFILE_SCOPE("stream_obj_model");
+    // Size of vertex and index chunks passed to the stream.
+    constexpr size_t chunk_size = 64 * 1024;
+
+    Mapped_File file;
+    if (!file.map(path))
+        error("failed to load obj model: " + path);
+    const char* text = (const char*)file.data;
+    const char* text_end = text + file.size;
+
+    Attribute_Counts total;
+    size_t index_count = 0;
+    {
+        PROFILE_SCOPE("count records");
+        for_each_line(text, text_end, [&total, &index_count](const char* line, const char* line_end) {
+            switch (get_vertex_record_type(line, line_end)) {
+            case 1: total.positions++; break;
+            case 2: total.texcoords++; break;
+            case 3: total.normals++; break;
+            default:
+                if (is_face_record(line, line_end))
+                    index_count += 3 * (std::max(count_face_corners(line, line_end), size_t(2)) - 2);
+            }
+        });
+    }
+    check_attribute_counts(total);
+    if (index_count >= size_t(UINT32_MAX))
+        error("obj file has too many face vertices");
+
+    // Normals are not stored since they are not used by Vertex, only their indices participate in deduplication.
+    std::vector<float> positions(total.positions * 3);
+    std::vector<float> texcoords(total.texcoords * 2);
+    std::vector<Obj_Index> unique_vertices;
+    Obj_Vertex_Table table;
+    std::vector<Obj_Index> polygon;
+    std::string error_message;
+    const char* error_line = nullptr;
+    {
+        PROFILE_SCOPE("parse attributes and deduplicate");
+        Attribute_Counts current;
+        for_each_line(text, text_end, [&](const char* line, const char* line_end) {
+            if (!error_message.empty())
+                return;
+            const int vertex_record_type = get_vertex_record_type(line, line_end);
+            if (vertex_record_type == 1 || vertex_record_type == 2) {
+                float* values = (vertex_record_type == 1) ? &positions[3 * current.positions++] : &texcoords[2 * current.texcoords++];
+                if (!parse_vertex_record(vertex_record_type, line, line_end, values)) {
+                    error_message = "invalid vertex attribute: " + std::string(line, line_end);
+                    error_line = line;
+                }
+            } else if (vertex_record_type == 3) {
+                float normal[3];
+                if (!parse_vertex_record(vertex_record_type, line, line_end, normal)) {
+                    error_message = "invalid vertex attribute: " + std::string(line, line_end);
+                    error_line = line;
+                }
+                current.normals++;
+            } else if (is_face_record(line, line_end)) {
+                if (!parse_face(line, line_end, current, total, polygon, error_message)) {
+                    error_line = line;
+                    return;
+                }
+                // Fan triangulation references the corners in polygon order, so the vertices are numbered
+                // in the order of the first occurrence of each corner in the file (global, not per shape).
+                for (const Obj_Index& index : polygon)
+                    table.find_or_insert(index, unique_vertices);
+            }
+        });
+        if (!error_message.empty())
+            error(error_message + " (" + get_text_location(text, error_line) + ")");
+    }
+
+    // Scale and center the mesh to the bounds of the referenced positions (the same normalization formula
+    // as load_obj_model).
+    Vector3 mesh_min(Infinity);
+    Vector3 mesh_max(-Infinity);
+    for (const Obj_Index& index : unique_vertices) {
+        for (int i = 0; i < 3; i++) {
+            mesh_min[i] = std::min(mesh_min[i], positions[3 * index.position + i]);
+            mesh_max[i] = std::max(mesh_max[i], positions[3 * index.position + i]);
+        }
+    }
+    Vector3 diag = mesh_max - mesh_min;
+    float max_size = std::max(diag.x, std::max(diag.y, diag.z));
+    float scale = (2.f / max_size) * additional_scale;
+    Vector3 center = (mesh_min + mesh_max) * 0.5f;
+
+    Mesh_Stream_Info info;
+    info.vertex_count = uint32_t(unique_vertices.size());
+    info.index_count = uint32_t(index_count);
+    info.bounds_min = unique_vertices.empty() ? Vector3() : (mesh_min - center) * scale;
+    info.bounds_max = unique_vertices.empty() ? Vector3() : (mesh_max - center) * scale;
+    info.shapes.push_back(Mesh_Shape{ 0, info.vertex_count, 0, info.index_count });
+    stream.begin(info);
+
+    {
+        PROFILE_SCOPE("write vertices");
+        std::vector<Vertex> vertices;
+        vertices.reserve(chunk_size);
+        for (size_t i = 0; i < unique_vertices.size(); i++) {
+            const Obj_Index& index = unique_vertices[i];
+            Vertex vertex;
+            vertex.pos = Vector3(positions[3 * index.position + 0], positions[3 * index.position + 1], positions[3 * index.position + 2]);
+            vertex.pos -= center;
+            vertex.pos *= scale;
+            if (index.texcoord != -1)
+                vertex.uv = Vector2(texcoords[2 * index.texcoord + 0], 1.f - texcoords[2 * index.texcoord + 1]);
+            vertices.push_back(vertex);
+
+            if (vertices.size() == chunk_size || i + 1 == unique_vertices.size()) {
+                stream.write_vertices(vertices);
+                vertices.clear();
+            }
+        }
+    }
+    positions = std::vector<float>();
+    texcoords = std::vector<float>();
+
+    {
+        PROFILE_SCOPE("write indices");
+        std::vector<uint32_t> indices;
+        indices.reserve(chunk_size);
+        Attribute_Counts current;
+        for_each_line(text, text_end, [&](const char* line, const char* line_end) {
+            switch (get_vertex_record_type(line, line_end)) {
+            case 1: current.positions++; break;
+            case 2: current.texcoords++; break;
+            case 3: current.normals++; break;
+            default:
+                if (is_face_record(line, line_end)) {
+                    // The faces were validated by the previous pass.
+                    parse_face(line, line_end, current, total, polygon, error_message);
+                    const uint32_t first = table.find(polygon[0], unique_vertices);
+                    uint32_t prev = table.find(polygon[1], unique_vertices);
+                    for (size_t i = 2; i < polygon.size(); i++) {
+                        uint32_t vertex = table.find(polygon[i], unique_vertices);
+                        indices.push_back(first);
+                        indices.push_back(prev);
+                        indices.push_back(vertex);
+                        prev = vertex;
+                    }
+                    if (indices.size() >= chunk_size) {
+                        stream.write_indices(indices);
+                        indices.clear();
+                    }
+                }
+            }
+        });
+        if (!indices.empty())
+            stream.write_indices(indices);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "lib.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// Zero-based indices of the face corner attributes. -1 if the attribute is not specified.
+struct Obj_Index {
+    int32_t position;
+    int32_t texcoord;
+    int32_t normal;
+};
+
+// Range of faces with the same object/group name ("o"/"g") and material ("usemtl").
+struct Obj_Shape {
+    std::string name;
+    std::string material;
+    size_t first_index = 0;
+    size_t index_count = 0;
+};
+
+// Geometry of OBJ file. Polygons are triangulated as fans, so indices contain 3 entries per triangle.
+// v/vt/vn/f, o/g, usemtl and mtllib records are parsed, other records (smoothing, lines) are skipped.
+struct Obj_Data {
+    std::vector<float> positions; // xyz
+    std::vector<float> texcoords; // uv
+    std::vector<float> normals; // xyz
+    std::vector<Obj_Index> indices;
+
+    // Shapes cover the indices in order without gaps. A new shape starts when the name or
+    // the material changes. Shapes without faces are not created.
+    std::vector<Obj_Shape> shapes;
+    // "mtllib" file names, relative to the OBJ file location.
+    std::vector<std::string> material_libraries;
+};
+
+// Parses OBJ file contents in parallel. The text is split into line-aligned chunks that are
+// processed by separate threads. The first pass counts attribute records per chunk, so the
+// second pass can write attributes directly into the final arrays and resolve relative (negative)
+// indices. Per-chunk face indices are merged using prefix sums. Throws on malformed faces
+// and vertex attribute records, the error message contains the line number.
+// thread_count = 0 means use all hardware threads.
+Obj_Data parse_obj(const char* text, size_t size, uint32_t thread_count = 0);
+
+struct Obj_Material {
+    std::string name;
+    // "map_Kd" file name, relative to the MTL file location. Empty if not specified.
+    std::string diffuse_texture;
+};
+
+// Parses MTL file contents. Only material names and diffuse texture maps are read.
+// Texture map options (-s, -o, etc.) are skipped, the last argument is used as a file name.
+std::vector<Obj_Material> parse_mtl(const char* text, size_t size);
+
+enum class Obj_Dedup_Method {
+    unordered_map, // std::unordered_map, node per entry (reference implementation)
+    flat_hash, // open-addressing table with linear probing, reserved for the expected vertex count
+    sort // parallel sort of face corners by attribute indices, then assign ids to groups
+};
+
+// Result of face corner deduplication. Unique vertices are in the order of the first occurrence,
+// so all methods produce identical results.
+struct Obj_Vertex_Mapping {
+    std::vector<Obj_Index> unique_vertices;
+    std::vector<uint32_t> indices; // unique vertex index for each face corner
+};
+
+Obj_Vertex_Mapping deduplicate_obj_vertices(std::span<const Obj_Index> indices, Obj_Dedup_Method method = Obj_Dedup_Method::flat_hash);
+
+// Streams the model as a single shape without materials and without keeping the face data in memory. Face corners
+// are deduplicated globally (not per shape), vertices are numbered in the order of the first occurrence, and
+// cleanup_mesh is not applied. So the output differs from load_obj_model, which splits the model into shapes with
+// their own vertices, and from the cached load_obj_model path, which also runs the cleanup. The file is
+// read sequentially in three passes: count records, parse attributes and deduplicate vertices, then parse faces
+// again to emit indices in 64K chunks. The memory is not bounded by a constant: all positions and texture
+// coordinates (20 bytes per v/vt pair), the unique vertex list (12 bytes per vertex) and the deduplication table
+// (4-8 bytes per vertex) stay resident until the vertices are written. Only the index data, the largest part for
+// typical meshes (about 6 face corners per vertex), is bounded by the chunk size. It's slower than parse_obj, so
+// it's intended for large models.
+void stream_obj_model(const std::string& path, float additional_scale, const Mesh_Stream& stream);
@@ -0,0 +1,137 @@
+#include "profiler.h"
+#include "lib.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+struct Profiler_Event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+struct Thread_Events {
+    // Limits memory usage when profiling runs for a long time. Events after the limit are dropped.
+    static constexpr size_t max_event_count = 1 << 20;
+
+    uint32_t thread_id = 0;
+    const char* track_name = nullptr;
+    std::vector<Profiler_Event> events;
+};
+
+struct Profiler {
+    std::atomic<bool> enabled = false;
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    std::mutex mutex; // protects thread_events list and gpu_events
+    std::vector<std::unique_ptr<Thread_Events>> thread_events;
+    Thread_Events* gpu_events = nullptr;
+};
+} // namespace
+
+static Profiler profiler;
+
+// Thread buffers are owned by the profiler, so events of finished threads are preserved.
+// Should be called under profiler.mutex.
+static Thread_Events* register_track(const char* track_name) {
+    profiler.thread_events.push_back(std::make_unique<Thread_Events>());
+    Thread_Events* events = profiler.thread_events.back().get();
+    events->thread_id = (uint32_t)profiler.thread_events.size();
+    events->track_name = track_name;
+    return events;
+}
+
+static Thread_Events* get_thread_events() {
+    thread_local Thread_Events* events = nullptr;
+    if (events == nullptr) {
+        std::lock_guard<std::mutex> lock(profiler.mutex);
+        events = register_track(nullptr);
+    }
+    return events;
+}
+
+void profiler_enable(bool enable) {
+    profiler.enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool profiler_is_enabled() {
+    return profiler.enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t profiler_get_time_ns() {
+    auto duration = std::chrono::steady_clock::now() - profiler.epoch;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+uint64_t profiler_get_epoch_ns() {
+    auto duration = profiler.epoch.time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+void profiler_add_event(const char* name, uint64_t start_ns, uint64_t duration_ns) {
+    Thread_Events* thread_events = get_thread_events();
+    if (thread_events->events.size() < Thread_Events::max_event_count) {
+        thread_events->events.push_back(Profiler_Event{ name, start_ns, duration_ns });
+    }
+}
+
+void profiler_add_gpu_event(const char* name, uint64_t start_ns, uint64_t duration_ns) {
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    if (profiler.gpu_events == nullptr) {
+        profiler.gpu_events = register_track("GPU");
+    }
+    if (profiler.gpu_events->events.size() < Thread_Events::max_event_count) {
+        profiler.gpu_events->events.push_back(Profiler_Event{ name, start_ns, duration_ns });
+    }
+}
+
+void profiler_write_chrome_trace(const std::string& file_name) {
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (!file)
+        error("failed to open file for writing: " + file_name);
+
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    fprintf(file, "{\n\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n");
+
+    bool first_event = true;
+    for (const std::unique_ptr<Thread_Events>& thread_events : profiler.thread_events) {
+        const char* track_name = thread_events->track_name;
+        if (track_name == nullptr) {
+            track_name = (thread_events->thread_id == 1) ? "main" : "worker";
+        }
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+            first_event ? "" : ",\n", thread_events->thread_id, track_name);
+        first_event = false;
+
+        for (const Profiler_Event& event : thread_events->events) {
+            // Chrome trace format uses microseconds.
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                event.name, thread_events->thread_id, double(event.start_ns) * 1e-3, double(event.duration_ns) * 1e-3);
+        }
+    }
+    fprintf(file, "\n]\n}\n");
+    fclose(file);
+    printf("Trace saved to %s\n", file_name.c_str());
+}
+
+uint32_t profiler_get_event_thread_count(const char* name) {
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    uint32_t thread_count = 0;
+    for (const std::unique_ptr<Thread_Events>& thread_events : profiler.thread_events) {
+        if (thread_events.get() == profiler.gpu_events)
+            continue;
+        for (const Profiler_Event& event : thread_events->events) {
+            if (strcmp(event.name, name) == 0) {
+                thread_count++;
+                break;
+            }
+        }
+    }
+    return thread_count;
+}
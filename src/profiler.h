@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// CPU profiler that records scopes into thread-local buffers. Recording is disabled by default
+// and the scope cost in this case is a single branch. The collected events can be written as
+// Chrome trace JSON which can be opened in chrome://tracing or https://ui.perfetto.dev.
+void profiler_enable(bool enable);
+bool profiler_is_enabled();
+
+// Nanoseconds since profiler epoch (steady_clock).
+uint64_t profiler_get_time_ns();
+
+// Profiler epoch as steady_clock time since epoch in nanoseconds. Allows to convert
+// timestamps from other sources that are mapped to steady_clock to profiler time.
+uint64_t profiler_get_epoch_ns();
+
+// Records already measured event (for example, an event that was measured on a different timeline).
+void profiler_add_event(const char* name, uint64_t start_ns, uint64_t duration_ns);
+
+// Records GPU event. The events are shown on a separate "GPU" track. It's thread-safe but it's
+// expected that GPU events are submitted from one thread, so they do not overlap in time.
+void profiler_add_gpu_event(const char* name, uint64_t start_ns, uint64_t duration_ns);
+
+// Should be called when other threads do not record events.
+void profiler_write_chrome_trace(const std::string& file_name);
+
+// Number of threads that recorded at least one event with the given name. Used by the checks that verify
+// that work is distributed between threads. Should be called when other threads do not record events.
+uint32_t profiler_get_event_thread_count(const char* name);
+
+struct Profiler_Scope {
+    Profiler_Scope(const char* name)
+    {
+        if (profiler_is_enabled()) {
+            this->name = name;
+            start_ns = profiler_get_time_ns();
+        }
+    }
+    ~Profiler_Scope()
+    {
+        if (name) {
+            profiler_add_event(name, start_ns, profiler_get_time_ns() - start_ns);
+        }
+    }
+
+private:
+    const char* name = nullptr;
+    uint64_t start_ns = 0;
+};
+
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+
+// The name should be a string literal or other string with static storage duration.
+#define PROFILE_SCOPE(name) Profiler_Scope PROFILER_CONCAT(profiler_scope, __LINE__)(name)
@@ -18,6 +18,12 @@ vec3 color_encode_lod(float lod) {
     return mix(color0, color1, fract(lod));
 }
 
+// Maps t from [0, 1] to blue-cyan-green-yellow-red gradient. Values outside of the range are clamped.
+vec3 color_encode_heatmap(float t) {
+    t = clamp(t, 0.0, 1.0);
+    return clamp(vec3(1.5) - abs(4.0 * t - vec3(3, 2, 1)), 0.0, 1.0);
+}
+
 float ray_plane_intersection(vec3 ray_o, vec3 ray_d, vec3 plane_n, float plane_d) {
     return (-plane_d - dot(plane_n, ray_o)) / dot(plane_n, ray_d);
 }
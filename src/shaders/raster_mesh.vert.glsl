@@ -11,7 +11,13 @@ layout(std140, binding=0) uniform Uniform_Block {
     mat4x4 model_view_proj;
 };
 
+// Maps quantized positions to object space (identity for float positions).
+layout(push_constant) uniform Push_Constants {
+    layout(offset = 16) vec4 position_scale;
+    vec4 position_bias;
+};
+
 void main() {
     frag_uv = in_uv;
-    gl_Position = model_view_proj * in_position;
+    gl_Position = model_view_proj * vec4(in_position.xyz * position_scale.xyz + position_bias.xyz, 1.0);
 }
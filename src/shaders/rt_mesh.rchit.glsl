@@ -1,6 +1,8 @@
 #version 460
 #extension GL_GOOGLE_include_directive : require
 #extension GL_EXT_ray_tracing : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
 
 #include "common.glsl"
 
@@ -9,48 +11,77 @@
 
 hitAttributeEXT vec2 attribs;
 
-struct Buffer_Vertex {
-    float x, y, z;
-    float u, v;
-};
-
 layout(push_constant) uniform Push_Constants {
-      layout(offset = 4) uint show_texture_lods;
+      layout(offset = 16) uint show_texture_lods;
 };
 
 layout (location=0) rayPayloadInEXT Ray_Payload payload;
 
-layout(std430, binding=3) readonly buffer Indices {
-    uint index_buffer[];
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Index_Buffer {
+    uint indices[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertex_Buffer {
+    uint vertices[];
 };
 
-layout(std430, binding=4) readonly buffer Vertices {
-    Buffer_Vertex vertex_buffer[];
+// Vertex layout parameters are in bytes. Should match RT_Instance_Info.
+// Quantized positions are returned in normalized space, gl_ObjectToWorldEXT includes dequantization.
+struct Instance_Info {
+    Index_Buffer index_buffer;
+    Vertex_Buffer vertex_buffer;
+    uint index_type_uint16;
+    uint position_offset;
+    uint position_stride;
+    uint uv_offset;
+    uint uv_stride;
+    uint texture_index;
+    uint quantized_vertices;
+    uint padding;
 };
 
-layout(binding=5) uniform texture2D image;
-layout(binding=6) uniform sampler image_sampler;
+layout(std430, binding=3) readonly buffer Instance_Infos {
+    Instance_Info instance_infos[];
+};
 
-Vertex fetch_vertex(int vertex_index) {
-    uint i = index_buffer[vertex_index];
-    Buffer_Vertex bv = vertex_buffer[i];
+layout(binding=4) uniform texture2D images[];
+layout(binding=5) uniform sampler image_sampler;
+
+uint fetch_index(Instance_Info instance, int vertex_index) {
+    if (instance.index_type_uint16 != 0) {
+        uint packed_indices = instance.index_buffer.indices[vertex_index >> 1];
+        return (vertex_index & 1) != 0 ? (packed_indices >> 16) : (packed_indices & 0xffff);
+    }
+    return instance.index_buffer.indices[vertex_index];
+}
+
+Vertex fetch_vertex(Instance_Info instance, int vertex_index) {
+    uint i = fetch_index(instance, vertex_index);
+    uint p = (instance.position_offset + i * instance.position_stride) >> 2;
+    uint t = (instance.uv_offset + i * instance.uv_stride) >> 2;
 
     Vertex v;
-    v.p = vec3(bv.x, bv.y, bv.z);
-    v.uv = fract(vec2(bv.u, bv.v));
+    if (instance.quantized_vertices != 0) {
+        v.p = vec3(unpackSnorm2x16(instance.vertex_buffer.vertices[p]), unpackSnorm2x16(instance.vertex_buffer.vertices[p + 1]).x);
+        v.uv = fract(unpackHalf2x16(instance.vertex_buffer.vertices[t]));
+    } else {
+        v.p = uintBitsToFloat(uvec3(instance.vertex_buffer.vertices[p], instance.vertex_buffer.vertices[p + 1], instance.vertex_buffer.vertices[p + 2]));
+        v.uv = fract(uintBitsToFloat(uvec2(instance.vertex_buffer.vertices[t], instance.vertex_buffer.vertices[t + 1])));
+    }
     return v;
 }
 
 void main() {
-    Vertex v0 = fetch_vertex(gl_PrimitiveID*3 + 0);
-    Vertex v1 = fetch_vertex(gl_PrimitiveID*3 + 1);
-    Vertex v2 = fetch_vertex(gl_PrimitiveID*3 + 2);
+    Instance_Info instance = instance_infos[gl_InstanceCustomIndexEXT];
+    Vertex v0 = fetch_vertex(instance, gl_PrimitiveID*3 + 0);
+    Vertex v1 = fetch_vertex(instance, gl_PrimitiveID*3 + 1);
+    Vertex v2 = fetch_vertex(instance, gl_PrimitiveID*3 + 2);
 
     v0.p = gl_ObjectToWorldEXT * vec4(v0.p, 1);
     v1.p = gl_ObjectToWorldEXT * vec4(v1.p, 1);
     v2.p = gl_ObjectToWorldEXT * vec4(v2.p, 1);
 
-    int mip_levels = textureQueryLevels(sampler2D(image, image_sampler));
+    int mip_levels = textureQueryLevels(sampler2D(images[nonuniformEXT(instance.texture_index)], image_sampler));
     float lod = compute_texture_lod(v0, v1, v2, payload.rx_dir, payload.ry_dir, mip_levels);
 
     vec3 color;
@@ -58,7 +89,7 @@ void main() {
         color = color_encode_lod(lod);
     } else {
         vec2 uv = fract(barycentric_interpolate(attribs.x, attribs.y, v0.uv, v1.uv, v2.uv));
-        color = textureLod(sampler2D(image, image_sampler), uv, lod).rgb;
+        color = textureLod(sampler2D(images[nonuniformEXT(instance.texture_index)], image_sampler), uv, lod).rgb;
     }
 
     payload.color = srgb_encode(color);
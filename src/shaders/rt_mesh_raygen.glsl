@@ -0,0 +1,82 @@
+// Ray generation shader, included by rt_mesh.rgen.glsl and rt_mesh_traversal_cost.rgen.glsl.
+// With TRAVERSAL_COST defined the shader measures the time spent in traceRayEXT calls with the device
+// realtime clock and outputs the heatmap. It's a separate shader, so the shading path does not read
+// the clock and the pipeline can be created without VK_KHR_shader_clock.
+
+#include "common.glsl"
+
+#define RGEN_SHADER
+#include "rt_utils.glsl"
+
+layout(push_constant) uniform Push_Constants {
+      layout(offset = 0) uint spp4;
+      layout(offset = 4) float traversal_cost_scale;
+      layout(offset = 8) uint histogram_index;
+};
+
+layout(binding = 0, rgba8) uniform image2D image;
+layout(set=0, binding = 1) uniform accelerationStructureEXT accel;
+
+layout(std140, binding=2) uniform Uniform_Block {
+    mat4x3 camera_to_world;
+};
+
+// Should match Traversal_Cost_Histogram in raytrace_scene.h
+struct Traversal_Cost_Histogram {
+    uint bins[32];
+    uint max_cost;
+};
+
+layout(std430, binding=6) buffer Traversal_Cost_Histograms {
+    Traversal_Cost_Histogram histograms[];
+};
+
+layout(location = 0) rayPayloadEXT Ray_Payload payload;
+
+#ifdef TRAVERSAL_COST
+// Device clock ticks spent in traceRayEXT calls for the current pixel.
+uint traversal_cost = 0;
+#endif
+
+const float tmin = 1e-3f;
+const float tmax = 1e+3f;
+
+vec3 trace_ray(vec2 sample_pos) {
+    Ray ray = generate_ray(camera_to_world, sample_pos);
+    payload.rx_dir = ray.rx_dir;
+    payload.ry_dir = ray.ry_dir;
+    payload.color = vec3(0);
+#ifdef TRAVERSAL_COST
+    uvec2 start_time = clockRealtime2x32EXT();
+#endif
+    traceRayEXT(accel, gl_RayFlagsOpaqueEXT, 0xff, 0, 0, 0, ray.origin, tmin, ray.dir, tmax, 0);
+#ifdef TRAVERSAL_COST
+    uvec2 end_time = clockRealtime2x32EXT();
+    // Low 32 bits are enough for the duration of a single trace call (unsigned subtraction handles wrap around).
+    traversal_cost += end_time.x - start_time.x;
+#endif
+    return payload.color;
+}
+
+void main() {
+    const vec2 sample_origin = vec2(gl_LaunchIDEXT.xy);
+    vec3 color = vec3(0);
+
+    if (spp4 != 0) {
+        color += trace_ray(sample_origin + vec2(0.125, 0.375));
+        color += trace_ray(sample_origin + vec2(0.375, 0.875));
+        color += trace_ray(sample_origin + vec2(0.625, 0.125));
+        color += trace_ray(sample_origin + vec2(0.875, 0.625));
+        color *= 0.25;
+    } else
+        color = trace_ray(sample_origin + vec2(0.5));
+
+#ifdef TRAVERSAL_COST
+    color = srgb_encode(color_encode_heatmap(float(traversal_cost) * traversal_cost_scale));
+    uint bin = findMSB(max(traversal_cost, 1u));
+    atomicAdd(histograms[histogram_index].bins[bin], 1);
+    atomicMax(histograms[histogram_index].max_cost, traversal_cost);
+#endif
+
+    imageStore(image, ivec2(gl_LaunchIDEXT.xy), vec4(color, 1.0));
+}
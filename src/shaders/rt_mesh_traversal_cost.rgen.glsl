@@ -0,0 +1,7 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_ray_tracing : require
+#extension GL_EXT_shader_realtime_clock : require
+
+#define TRAVERSAL_COST
+#include "rt_mesh_raygen.glsl"
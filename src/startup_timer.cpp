@@ -0,0 +1,68 @@
+#include "startup_timer.h"
+#include "lib.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace {
+struct Startup_Phase {
+    const char* name;
+    double ms;
+};
+
+struct Startup_Timer {
+    bool active = false;
+    Timestamp start_time;
+    Timestamp phase_start_time;
+    std::vector<Startup_Phase> phases;
+};
+} // namespace
+
+static Startup_Timer startup_timer;
+
+void startup_timer_start() {
+    startup_timer.active = true;
+    startup_timer.start_time = Timestamp();
+    startup_timer.phase_start_time = startup_timer.start_time;
+    startup_timer.phases.clear();
+}
+
+void startup_phase_done(const char* name) {
+    if (!startup_timer.active)
+        return;
+    Timestamp now;
+    double ms = double(std::chrono::duration_cast<std::chrono::nanoseconds>(now.t - startup_timer.phase_start_time.t).count()) * 1e-6;
+    startup_timer.phases.push_back(Startup_Phase{ name, ms });
+    startup_timer.phase_start_time = now;
+}
+
+void startup_timer_finish(const char* last_phase_name, const std::string& json_file_name) {
+    if (!startup_timer.active)
+        return;
+    startup_phase_done(last_phase_name);
+    startup_timer.active = false;
+
+    const double total_ms = double(elapsed_nanoseconds(startup_timer.start_time)) * 1e-6;
+
+    printf("\nTime to first frame: %.1f ms\n", total_ms);
+    for (const Startup_Phase& phase : startup_timer.phases) {
+        printf("  %-28s %8.1f ms %5.1f%%\n", phase.name, phase.ms, total_ms > 0.0 ? 100.0 * phase.ms / total_ms : 0.0);
+    }
+
+    if (json_file_name.empty())
+        return;
+
+    FILE* file = fopen(json_file_name.c_str(), "w");
+    if (!file)
+        error("failed to open file for writing: " + json_file_name);
+
+    fprintf(file, "{\n  \"time_to_first_frame_ms\": %s,\n  \"phases\": [\n", format_json_number(total_ms, 3).c_str());
+    for (size_t i = 0; i < startup_timer.phases.size(); i++) {
+        const Startup_Phase& phase = startup_timer.phases[i];
+        fprintf(file, "    { \"name\": \"%s\", \"ms\": %s }%s\n", phase.name, format_json_number(phase.ms, 3).c_str(),
+            (i + 1 < startup_timer.phases.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("Startup report: %s\n", json_file_name.c_str());
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+// Measures time-to-first-frame as a sequence of startup phases. Each phase ends when
+// startup_phase_done is called and the next phase starts at the same moment, so the
+// phases cover the whole startup without gaps. The time before main() is not included.
+void startup_timer_start();
+
+// The name should be a string literal or other string with static storage duration.
+void startup_phase_done(const char* name);
+
+// Ends the last phase and prints the breakdown. If json_file_name is not empty then
+// the breakdown is also saved as JSON. Subsequent startup_phase_done calls are ignored.
+void startup_timer_finish(const char* last_phase_name, const std::string& json_file_name);
@@ -0,0 +1,399 @@
+#include "texture_cache.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+// Increment when the mip filter or the encoders change.
+constexpr uint32_t texture_cache_version = 2;
+
+constexpr uint8_t ktx2_identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+struct KTX2_Header {
+    uint8_t identifier[12];
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint64_t sgd_byte_offset;
+    uint64_t sgd_byte_length;
+};
+static_assert(sizeof(KTX2_Header) == 80);
+
+struct KTX2_Level {
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t uncompressed_byte_length;
+};
+
+// Stored in the key/value data of the cache file under source_info_key.
+constexpr char source_info_key[] = "VkDemoSourceInfo";
+struct Source_Info {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t cache_version;
+    uint32_t padding;
+};
+
+struct Format_Info {
+    uint32_t block_dimension; // 1 for uncompressed formats
+    uint32_t block_size; // in bytes
+};
+
+Format_Info get_format_info(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_SRGB: return { 1, 4 };
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return { 4, 8 };
+    case VK_FORMAT_BC7_SRGB_BLOCK: return { 4, 16 };
+    default:
+        error("unsupported texture cache format: " + std::to_string(format));
+        return {};
+    }
+}
+
+uint32_t get_mip_level_count(int width, int height) {
+    uint32_t level_count = 0;
+    for (int k = std::max(width, height); k > 0; k >>= 1)
+        level_count++;
+    return level_count;
+}
+
+uint64_t get_level_size(const Format_Info& format_info, int width, int height, uint32_t level) {
+    const uint64_t w = std::max(width >> level, 1);
+    const uint64_t h = std::max(height >> level, 1);
+    const uint64_t d = format_info.block_dimension;
+    return ((w + d - 1) / d) * ((h + d - 1) / d) * format_info.block_size;
+}
+
+// Basic data format descriptor block (Khronos Data Format Specification) with sRGB transfer function.
+std::vector<uint32_t> create_data_format_descriptor(VkFormat format) {
+    struct Sample {
+        uint32_t bit_offset;
+        uint32_t bit_length;
+        uint32_t channel_type;
+        uint32_t upper;
+    };
+    uint32_t color_model;
+    uint32_t texel_block_dimensions;
+    std::vector<Sample> samples;
+
+    const Format_Info format_info = get_format_info(format);
+    if (format == VK_FORMAT_R8G8B8A8_SRGB) {
+        color_model = 1; // KHR_DF_MODEL_RGBSDA
+        texel_block_dimensions = 0;
+        // Alpha is marked as linear (0x10), the transfer function applies only to color channels.
+        samples = { { 0, 8, 0, 255 }, { 8, 8, 1, 255 }, { 16, 8, 2, 255 }, { 24, 8, 15 | 0x10, 255 } };
+    }
+    else {
+        color_model = (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK) ? 128 /* KHR_DF_MODEL_BC1A */ : 134 /* KHR_DF_MODEL_BC7 */;
+        texel_block_dimensions = 0x00000303; // 4x4 (stored as dimension - 1)
+        samples = { { 0, format_info.block_size * 8, 0, UINT32_MAX } };
+    }
+
+    const uint32_t block_size = 24 + 16 * uint32_t(samples.size());
+    std::vector<uint32_t> words;
+    words.push_back(4 + block_size); // total size
+    words.push_back(0); // vendor id (Khronos) and descriptor type (basic)
+    words.push_back(2 | (block_size << 16)); // version and block size
+    words.push_back(color_model | (1 << 8) /* BT709 primaries */ | (2 << 16) /* sRGB transfer */);
+    words.push_back(texel_block_dimensions);
+    words.push_back(format_info.block_size); // bytes in plane 0
+    words.push_back(0);
+    for (const Sample& sample : samples) {
+        words.push_back(sample.bit_offset | ((sample.bit_length - 1) << 16) | (sample.channel_type << 24));
+        words.push_back(0); // sample position
+        words.push_back(0); // lower
+        words.push_back(sample.upper);
+    }
+    return words;
+}
+
+bool get_source_info(const std::string& path, Source_Info& info) {
+    std::error_code ec;
+    info = Source_Info{};
+    info.size = fs::file_size(path, ec);
+    if (ec)
+        return false;
+    fs::file_time_type mtime = fs::last_write_time(path, ec);
+    if (ec)
+        return false;
+    info.mtime = (int64_t)mtime.time_since_epoch().count();
+    info.cache_version = texture_cache_version;
+    return true;
+}
+
+uint64_t hash_source_file(const std::string& path) {
+    PROFILE_SCOPE("hash texture source");
+    Mapped_File file;
+    if (!file.map(path))
+        return 0;
+    return hash_bytes(file.data, file.size);
+}
+
+std::string get_cache_file_path(const std::string& path, VkFormat format, const Mip_Filter_Params& mip_filter) {
+    std::error_code ec;
+    std::string key = fs::absolute(path, ec).generic_string();
+    if (ec)
+        key = path;
+    uint64_t key_hash = hash_bytes(key.data(), key.size());
+    key_hash = hash_bytes(&format, sizeof(format), key_hash);
+    // Hashed field by field, the struct can have padding.
+    key_hash = hash_bytes(&mip_filter.filter, sizeof(mip_filter.filter), key_hash);
+    key_hash = hash_bytes(&mip_filter.radius, sizeof(mip_filter.radius), key_hash);
+    key_hash = hash_bytes(&mip_filter.kaiser_alpha, sizeof(mip_filter.kaiser_alpha), key_hash);
+
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016llx", (unsigned long long)key_hash);
+    std::string file_name = fs::path(path).stem().string() + "_" + hash_str + ".ktx2";
+    return get_resource_path("cache/" + file_name);
+}
+
+// Returns offset of the source info value in the file or 0 if the file is not a valid cache entry.
+uint64_t validate_cache_file(const Mapped_File& file, VkFormat format, std::vector<std::span<const uint8_t>>& levels) {
+    if (file.size < sizeof(KTX2_Header))
+        return 0;
+    const KTX2_Header* header = (const KTX2_Header*)file.data;
+    if (memcmp(header->identifier, ktx2_identifier, sizeof(ktx2_identifier)) != 0 ||
+        header->vk_format != uint32_t(format) || header->type_size != 1 ||
+        header->pixel_width == 0 || header->pixel_height == 0 || header->pixel_depth != 0 ||
+        header->layer_count != 0 || header->face_count != 1 || header->supercompression_scheme != 0 ||
+        header->pixel_width > 65536 || header->pixel_height > 65536 ||
+        header->level_count != get_mip_level_count(header->pixel_width, header->pixel_height))
+        return 0;
+
+    const uint64_t level_index_end = sizeof(KTX2_Header) + uint64_t(header->level_count) * sizeof(KTX2_Level);
+    if (level_index_end > file.size)
+        return 0;
+    const Format_Info format_info = get_format_info(format);
+    const KTX2_Level* level_index = (const KTX2_Level*)(file.data + sizeof(KTX2_Header));
+    levels.resize(header->level_count);
+    for (uint32_t i = 0; i < header->level_count; i++) {
+        const KTX2_Level& level = level_index[i];
+        if (level.byte_length != get_level_size(format_info, header->pixel_width, header->pixel_height, i) ||
+            level.byte_offset > file.size || level.byte_length > file.size - level.byte_offset)
+            return 0;
+        levels[i] = std::span(file.data + level.byte_offset, level.byte_length);
+    }
+
+    // Find source info in the key/value data.
+    if (uint64_t(header->kvd_byte_offset) + header->kvd_byte_length > file.size)
+        return 0;
+    uint64_t offset = header->kvd_byte_offset;
+    const uint64_t kvd_end = offset + header->kvd_byte_length;
+    while (offset + 4 <= kvd_end) {
+        uint32_t entry_length;
+        memcpy(&entry_length, file.data + offset, 4);
+        if (entry_length > kvd_end - offset - 4)
+            return 0;
+        const char* key = (const char*)file.data + offset + 4;
+        if (entry_length == sizeof(source_info_key) + sizeof(Source_Info) && memcmp(key, source_info_key, sizeof(source_info_key)) == 0)
+            return offset + 4 + sizeof(source_info_key);
+        offset += round_up(4 + uint64_t(entry_length), uint64_t(4));
+    }
+    return 0;
+}
+
+void write_cache_file(const std::string& cache_path, const Texture_Mips& mips, const Source_Info& source_info) {
+    const Format_Info format_info = get_format_info(mips.format);
+    const std::vector<uint32_t> dfd = create_data_format_descriptor(mips.format);
+    const uint32_t level_count = uint32_t(mips.levels.size());
+
+    KTX2_Header header{};
+    memcpy(header.identifier, ktx2_identifier, sizeof(ktx2_identifier));
+    header.vk_format = mips.format;
+    header.type_size = 1;
+    header.pixel_width = mips.width;
+    header.pixel_height = mips.height;
+    header.face_count = 1;
+    header.level_count = level_count;
+    header.dfd_byte_offset = uint32_t(sizeof(KTX2_Header) + level_count * sizeof(KTX2_Level));
+    header.dfd_byte_length = uint32_t(dfd.size() * sizeof(uint32_t));
+    header.kvd_byte_offset = header.dfd_byte_offset + header.dfd_byte_length;
+    header.kvd_byte_length = uint32_t(round_up(4 + sizeof(source_info_key) + sizeof(Source_Info), size_t(4)));
+
+    // Levels are stored from the smallest to the largest, aligned to the block size.
+    std::vector<KTX2_Level> level_index(level_count);
+    uint64_t offset = header.kvd_byte_offset + header.kvd_byte_length;
+    for (int i = int(level_count) - 1; i >= 0; i--) {
+        offset = round_up(offset, uint64_t(std::max(format_info.block_size, 4u)));
+        level_index[i].byte_offset = offset;
+        level_index[i].byte_length = mips.levels[i].size();
+        level_index[i].uncompressed_byte_length = mips.levels[i].size();
+        offset += mips.levels[i].size();
+    }
+
+    std::vector<uint8_t> data(offset);
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), level_index.data(), level_count * sizeof(KTX2_Level));
+    memcpy(data.data() + header.dfd_byte_offset, dfd.data(), header.dfd_byte_length);
+    {
+        uint8_t* kvd = data.data() + header.kvd_byte_offset;
+        const uint32_t entry_length = uint32_t(sizeof(source_info_key) + sizeof(Source_Info));
+        memcpy(kvd, &entry_length, 4);
+        memcpy(kvd + 4, source_info_key, sizeof(source_info_key));
+        memcpy(kvd + 4 + sizeof(source_info_key), &source_info, sizeof(Source_Info));
+    }
+    for (uint32_t i = 0; i < level_count; i++)
+        memcpy(data.data() + level_index[i].byte_offset, mips.levels[i].data(), mips.levels[i].size());
+
+    // Written to a temporary file which is renamed when complete, so other processes never observe partial data.
+    std::error_code ec;
+    fs::create_directories(fs::path(cache_path).parent_path(), ec);
+    const std::string temp_path = get_unique_temp_path(cache_path);
+    bool ok = false;
+    if (FILE* file = fopen(temp_path.c_str(), "wb")) {
+        ok = fwrite(data.data(), data.size(), 1, file) == 1;
+        ok = (fclose(file) == 0) && ok;
+        if (ok) {
+            fs::rename(temp_path, cache_path, ec);
+            ok = !ec;
+        }
+        if (!ok)
+            fs::remove(temp_path, ec);
+    }
+    if (!ok)
+        printf("Warning: failed to write texture cache: %s\n", cache_path.c_str());
+}
+
+// The cache file should not be mapped: on Windows the mapping does not allow write access to the file.
+void update_cache_mtime(const std::string& cache_path, uint64_t source_info_offset, int64_t mtime) {
+    if (FILE* file = fopen(cache_path.c_str(), "r+b")) {
+        if (fseek(file, long(source_info_offset + offsetof(Source_Info, mtime)), SEEK_SET) == 0)
+            fwrite(&mtime, sizeof(mtime), 1, file);
+        fclose(file);
+    }
+}
+
+std::vector<uint8_t> encode_level(VkFormat format, int width, int height, const uint8_t* rgba) {
+    if (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+        return encode_bc1(width, height, rgba);
+    if (format == VK_FORMAT_BC7_SRGB_BLOCK)
+        return encode_bc7(width, height, rgba);
+    return std::vector<uint8_t>(rgba, rgba + size_t(width) * height * 4);
+}
+} // namespace
+
+Texture_Mips load_texture_cached(const std::string& image_file, VkFormat format, const Mip_Filter_Params& mip_filter) {
+    PROFILE_SCOPE("load_texture_cached");
+    const std::string cache_path = get_cache_file_path(image_file, format, mip_filter);
+
+    Source_Info source;
+    if (!get_source_info(image_file, source))
+        error("failed to load texture: " + image_file);
+
+    Texture_Mips mips;
+    mips.format = format;
+    {
+        Mapped_File file;
+        std::vector<std::span<const uint8_t>> levels;
+        const uint64_t source_info_offset = file.map(cache_path) ? validate_cache_file(file, format, levels) : 0;
+        if (source_info_offset != 0) {
+            Source_Info cached_source;
+            memcpy(&cached_source, file.data + source_info_offset, sizeof(Source_Info));
+            bool valid = cached_source.size == source.size && cached_source.cache_version == source.cache_version;
+
+            // Content hash is checked only when the timestamp does not match (e.g. after git checkout).
+            if (valid && cached_source.mtime != source.mtime) {
+                source.hash = hash_source_file(image_file);
+                valid = cached_source.hash == source.hash;
+                if (valid) {
+                    // The mapping is kept by the returned mips, so the file is remapped after the update.
+                    file.unmap();
+                    update_cache_mtime(cache_path, source_info_offset, source.mtime);
+                    valid = file.map(cache_path) && validate_cache_file(file, format, levels) == source_info_offset;
+                }
+            }
+            if (valid) {
+                const KTX2_Header* header = (const KTX2_Header*)file.data;
+                mips.width = header->pixel_width;
+                mips.height = header->pixel_height;
+                mips.levels = std::move(levels);
+                mips.file = std::move(file);
+                return mips;
+            }
+        }
+    }
+
+    // Cache miss.
+    if (source.hash == 0)
+        source.hash = hash_source_file(image_file);
+
+    Image_Pixels image = decode_image(image_file);
+    mips.width = image.width;
+    mips.height = image.height;
+    {
+        PROFILE_SCOPE("encode texture mips");
+        // Levels are processed one after another, each level is filtered and encoded in parallel.
+        std::vector<RGBA8_Image> mip_chain = build_mip_chain(image.width, image.height, image.rgba, mip_filter);
+        mips.level_data.push_back(encode_level(format, image.width, image.height, image.rgba));
+        image.release();
+        for (const RGBA8_Image& level : mip_chain)
+            mips.level_data.push_back(encode_level(format, level.width, level.height, level.pixels.data()));
+    }
+    for (const std::vector<uint8_t>& data : mips.level_data)
+        mips.levels.push_back(data);
+
+    write_cache_file(cache_path, mips, source);
+    return mips;
+}
+
+void check_texture_encode_threads() {
+    if (std::thread::hardware_concurrency() <= 1) {
+        printf("Texture encode thread check skipped: single hardware thread\n");
+        return;
+    }
+    // Pseudo-random pixels, the file name is unique, so the texture is not in the cache.
+    const int size = 1024;
+    const std::string image_file = get_unique_temp_path((fs::temp_directory_path() / "texture_encode_check.ppm").string());
+    {
+        FILE* file = fopen(image_file.c_str(), "wb");
+        if (!file)
+            error("failed to open file for writing: " + image_file);
+        std::vector<uint8_t> pixels(size_t(size) * size * 3);
+        uint32_t random = 12345;
+        for (uint8_t& value : pixels) {
+            random = random * 1664525u + 1013904223u;
+            value = uint8_t(random >> 24);
+        }
+        fprintf(file, "P6\n%d %d\n255\n", size, size);
+        const bool ok = fwrite(pixels.data(), pixels.size(), 1, file) == 1;
+        if (fclose(file) != 0 || !ok)
+            error("failed to write file: " + image_file);
+    }
+
+    const Mip_Filter_Params mip_filter;
+    const bool profiler_enabled = profiler_is_enabled();
+    profiler_enable(true);
+    run_async([&image_file, &mip_filter] { return load_texture_cached(image_file, VK_FORMAT_BC7_SRGB_BLOCK, mip_filter); }).get();
+    profiler_enable(profiler_enabled);
+
+    std::error_code ec;
+    fs::remove(get_cache_file_path(image_file, VK_FORMAT_BC7_SRGB_BLOCK, mip_filter), ec);
+    fs::remove(image_file, ec);
+
+    const uint32_t filter_threads = profiler_get_event_thread_count("downsample chunk");
+    const uint32_t encode_threads = profiler_get_event_thread_count("encode blocks chunk");
+    if (filter_threads < 2 || encode_threads < 2) {
+        error("texture encode thread check failed: mip filtering used " + std::to_string(filter_threads) +
+            " threads, block encoding used " + std::to_string(encode_threads) + " threads");
+    }
+    printf("Texture encode thread check passed: mip filtering used %u threads, block encoding used %u threads\n",
+        filter_threads, encode_threads);
+}
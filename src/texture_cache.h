@@ -0,0 +1,33 @@
+#pragma once
+
+#include "lib.h"
+#include "texture_compression.h"
+#include "vk.h"
+
+#include <span>
+
+// Mip chain of the texture in GPU format, can be uploaded with vk_create_texture_from_mips.
+// Level data points to the memory-mapped cache file or to the memory owned by this object.
+struct Texture_Mips {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    int width = 0;
+    int height = 0;
+    std::vector<std::span<const uint8_t>> levels; // level 0 is the base level
+
+private:
+    friend Texture_Mips load_texture_cached(const std::string& image_file, VkFormat format, const Mip_Filter_Params& mip_filter);
+    Mapped_File file;
+    std::vector<std::vector<uint8_t>> level_data;
+};
+
+// Loads the full mip chain from the KTX2 cache stored in the "cache" resource directory.
+// On a miss the image is decoded, mips are built and encoded on the CPU and a new cache entry is
+// written. Supported formats: VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_BC1_RGB_SRGB_BLOCK and
+// VK_FORMAT_BC7_SRGB_BLOCK. Mip filter parameters are part of the cache key. The cache entry is validated
+// against the source file size, modification time and content hash. Can be called from any thread.
+Texture_Mips load_texture_cached(const std::string& image_file, VkFormat format, const Mip_Filter_Params& mip_filter);
+
+// Loads a generated texture on the worker pool (as the demo does) with a cache miss and checks that mip filtering
+// and block encoding of the single texture ran on more than one thread. Calls error() on failure. Enables the profiler
+// for the duration of the check. Skipped if there is only one hardware thread.
+void check_texture_encode_threads();
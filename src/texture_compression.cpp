@@ -0,0 +1,698 @@
+#include "texture_compression.h"
+#include "lib.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+namespace {
+struct SRGB_Tables {
+    float to_linear[256];
+    uint8_t from_linear[4096];
+
+    SRGB_Tables() {
+        for (int i = 0; i < 256; i++) {
+            float c = float(i) / 255.f;
+            to_linear[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; i++)
+            from_linear[i] = uint8_t(srgb_encode(float(i) / 4095.f) * 255.f + 0.5f);
+    }
+};
+
+const SRGB_Tables& get_srgb_tables() {
+    static const SRGB_Tables tables;
+    return tables;
+}
+
+// 4-wide float vector, holds one RGBA pixel. SSE2 and NEON are available on all x64 and arm64 targets.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+struct Float4 {
+    __m128 v;
+    static Float4 zero() { return { _mm_setzero_ps() }; }
+    static Float4 set(float x) { return { _mm_set1_ps(x) }; }
+    static Float4 set(float x, float y, float z, float w) { return { _mm_setr_ps(x, y, z, w) }; }
+    static Float4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    // Converts to integers with truncation.
+    void store_int(int32_t* p) const { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(v)); }
+};
+inline Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+inline Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline Float4 min(Float4 a, Float4 b) { return { _mm_min_ps(a.v, b.v) }; }
+inline Float4 max(Float4 a, Float4 b) { return { _mm_max_ps(a.v, b.v) }; }
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+struct Float4 {
+    float32x4_t v;
+    static Float4 zero() { return { vdupq_n_f32(0.f) }; }
+    static Float4 set(float x) { return { vdupq_n_f32(x) }; }
+    static Float4 set(float x, float y, float z, float w) { const float f[4] = { x, y, z, w }; return { vld1q_f32(f) }; }
+    static Float4 load(const float* p) { return { vld1q_f32(p) }; }
+    void store(float* p) const { vst1q_f32(p, v); }
+    void store_int(int32_t* p) const { vst1q_s32(p, vcvtq_s32_f32(v)); }
+};
+inline Float4 operator+(Float4 a, Float4 b) { return { vaddq_f32(a.v, b.v) }; }
+inline Float4 operator*(Float4 a, Float4 b) { return { vmulq_f32(a.v, b.v) }; }
+inline Float4 min(Float4 a, Float4 b) { return { vminq_f32(a.v, b.v) }; }
+inline Float4 max(Float4 a, Float4 b) { return { vmaxq_f32(a.v, b.v) }; }
+#endif
+
+// Portable implementation. It's used when SIMD is not available and as the reference in check_mip_filter.
+struct Scalar_Float4 {
+    float v[4];
+    static Scalar_Float4 zero() { return { { 0.f, 0.f, 0.f, 0.f } }; }
+    static Scalar_Float4 set(float x) { return { { x, x, x, x } }; }
+    static Scalar_Float4 set(float x, float y, float z, float w) { return { { x, y, z, w } }; }
+    static Scalar_Float4 load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+    void store(float* p) const { memcpy(p, v, sizeof(v)); }
+    void store_int(int32_t* p) const { for (int i = 0; i < 4; i++) p[i] = int32_t(v[i]); }
+};
+inline Scalar_Float4 operator+(Scalar_Float4 a, Scalar_Float4 b) { return { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } }; }
+inline Scalar_Float4 operator*(Scalar_Float4 a, Scalar_Float4 b) { return { { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } }; }
+inline Scalar_Float4 min(Scalar_Float4 a, Scalar_Float4 b) { return { { std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3]) } }; }
+inline Scalar_Float4 max(Scalar_Float4 a, Scalar_Float4 b) { return { { std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3]) } }; }
+
+#if !(defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !(defined(__ARM_NEON) || defined(_M_ARM64))
+using Float4 = Scalar_Float4;
+#endif
+
+float sinc(float x) {
+    if (std::abs(x) < 1e-6f)
+        return 1.f;
+    x *= 3.14159265f;
+    return std::sin(x) / x;
+}
+
+// Modified Bessel function of the first kind of order 0.
+float bessel_i0(float x) {
+    float sum = 1.f;
+    float term = 1.f;
+    for (int k = 1; k < 32; k++) {
+        term *= (x * 0.5f / float(k)) * (x * 0.5f / float(k));
+        sum += term;
+        if (term < sum * 1e-8f)
+            break;
+    }
+    return sum;
+}
+
+// Kernel radius in destination pixels.
+float get_filter_radius(const Mip_Filter_Params& params) {
+    return params.filter == Mip_Filter::box ? 0.5f : params.radius;
+}
+
+// t is the distance in destination pixels.
+float evaluate_filter(const Mip_Filter_Params& params, float t) {
+    const float radius = get_filter_radius(params);
+    if (std::abs(t) > radius)
+        return 0.f;
+    switch (params.filter) {
+    case Mip_Filter::box:
+        return 1.f;
+    case Mip_Filter::kaiser: {
+        const float alpha = params.kaiser_alpha;
+        const float r = t / radius;
+        return sinc(t) * bessel_i0(alpha * std::sqrt(1.f - r * r)) / bessel_i0(alpha);
+    }
+    case Mip_Filter::lanczos:
+        return sinc(t) * sinc(t / radius);
+    }
+    return 0.f;
+}
+
+// Normalized 1D filter weights. Destination pixel i is computed from the source pixels
+// [first[i], first[i] + tap_count) with weights[i * tap_count + k]. Taps outside of the
+// source image are clamped to the edge.
+struct Filter_Taps {
+    int tap_count = 0;
+    std::vector<int> first;
+    std::vector<float> weights;
+};
+
+Filter_Taps compute_filter_taps(const Mip_Filter_Params& filter, int src_size, int dst_size) {
+    const float scale = float(src_size) / float(dst_size);
+    const float support = get_filter_radius(filter) * scale;
+    const int window_size = int(std::ceil(2.f * support)) + 2;
+
+    // Weights of the taps outside of the image are merged into the edge pixels.
+    std::vector<float> window_weights(size_t(dst_size) * window_size, 0.f);
+    std::vector<int> window_first(dst_size);
+    std::vector<int> first(dst_size, src_size);
+    std::vector<int> last(dst_size, -1);
+    for (int i = 0; i < dst_size; i++) {
+        const float center = (float(i) + 0.5f) * scale;
+        const int begin = int(std::floor(center - support - 0.5f));
+        window_first[i] = std::clamp(begin, 0, src_size - 1);
+        float* weights = window_weights.data() + size_t(i) * window_size;
+        float weight_sum = 0.f;
+        for (int k = begin; k < begin + window_size; k++) {
+            const float w = evaluate_filter(filter, (float(k) + 0.5f - center) / scale);
+            if (w == 0.f)
+                continue;
+            const int index = std::clamp(k, 0, src_size - 1);
+            weights[index - window_first[i]] += w;
+            weight_sum += w;
+            first[i] = std::min(first[i], index);
+            last[i] = std::max(last[i], index);
+        }
+        for (int k = 0; k < window_size; k++)
+            weights[k] /= weight_sum;
+    }
+
+    // All destination pixels use the same number of taps, the unused taps have zero weight.
+    Filter_Taps taps;
+    for (int i = 0; i < dst_size; i++)
+        taps.tap_count = std::max(taps.tap_count, last[i] - first[i] + 1);
+    taps.first.resize(dst_size);
+    taps.weights.resize(size_t(dst_size) * taps.tap_count, 0.f);
+    for (int i = 0; i < dst_size; i++) {
+        taps.first[i] = std::min(first[i], src_size - taps.tap_count);
+        for (int index = first[i]; index <= last[i]; index++)
+            taps.weights[size_t(i) * taps.tap_count + (index - taps.first[i])] = window_weights[size_t(i) * window_size + (index - window_first[i])];
+    }
+    return taps;
+}
+
+// Separable resampling to the next mip level. The source rows are converted to linear float RGBA and
+// filtered horizontally once, each parallel chunk keeps the rows that are still referenced in a ring buffer.
+// Float4 is either the SIMD vector or Scalar_Float4.
+template <typename Float4>
+RGBA8_Image downsample(int width, int height, const uint8_t* rgba, const Mip_Filter_Params& filter, bool srgb) {
+    const SRGB_Tables& srgb_tables = get_srgb_tables();
+    float unorm_to_float[256];
+    for (int i = 0; i < 256; i++)
+        unorm_to_float[i] = float(i) / 255.f;
+    const float* color_to_linear = srgb ? srgb_tables.to_linear : unorm_to_float;
+
+    RGBA8_Image image;
+    image.width = std::max(width / 2, 1);
+    image.height = std::max(height / 2, 1);
+    image.pixels.resize(size_t(image.width) * image.height * 4);
+
+    const Filter_Taps horizontal_taps = compute_filter_taps(filter, width, image.width);
+    const Filter_Taps vertical_taps = compute_filter_taps(filter, height, image.height);
+
+    // Color channels are converted to 12-bit indices of the sRGB table, alpha to 8 bits.
+    const Float4 output_scale = srgb ? Float4::set(4095.f, 4095.f, 4095.f, 255.f) : Float4::set(255.f);
+
+    const size_t chunk_count = get_parallel_chunk_count(image.height, 16);
+    const int rows_per_chunk = int((image.height + chunk_count - 1) / chunk_count);
+    run_parallel(chunk_count, [&](size_t chunk_index) {
+        PROFILE_SCOPE("downsample chunk");
+        const int first_row = int(chunk_index) * rows_per_chunk;
+        const int last_row = std::min(first_row + rows_per_chunk, image.height);
+        const int ring_size = vertical_taps.tap_count;
+        const size_t filtered_row_size = size_t(image.width) * 4;
+
+        std::vector<float> source_row(size_t(width) * 4);
+        std::vector<float> ring(ring_size * filtered_row_size);
+        std::vector<int> ring_rows(ring_size, -1);
+        std::vector<float> sum_row(filtered_row_size);
+
+        for (int y = first_row; y < last_row; y++) {
+            const int first_source_row = vertical_taps.first[y];
+            for (int k = 0; k < vertical_taps.tap_count; k++) {
+                const int src_y = first_source_row + k;
+                const int slot = src_y % ring_size;
+                if (ring_rows[slot] == src_y)
+                    continue;
+                ring_rows[slot] = src_y;
+
+                const uint8_t* src = rgba + size_t(src_y) * width * 4;
+                for (int x = 0; x < width * 4; x += 4) {
+                    source_row[x + 0] = color_to_linear[src[x + 0]];
+                    source_row[x + 1] = color_to_linear[src[x + 1]];
+                    source_row[x + 2] = color_to_linear[src[x + 2]];
+                    source_row[x + 3] = unorm_to_float[src[x + 3]];
+                }
+                float* filtered_row = ring.data() + slot * filtered_row_size;
+                for (int x = 0; x < image.width; x++) {
+                    const float* weights = horizontal_taps.weights.data() + size_t(x) * horizontal_taps.tap_count;
+                    const float* pixels = source_row.data() + size_t(horizontal_taps.first[x]) * 4;
+                    Float4 sum = Float4::zero();
+                    for (int t = 0; t < horizontal_taps.tap_count; t++)
+                        sum = sum + Float4::set(weights[t]) * Float4::load(pixels + t * 4);
+                    sum.store(filtered_row + x * 4);
+                }
+            }
+
+            const float* weights = vertical_taps.weights.data() + size_t(y) * vertical_taps.tap_count;
+            std::fill(sum_row.begin(), sum_row.end(), 0.f);
+            for (int k = 0; k < vertical_taps.tap_count; k++) {
+                if (weights[k] == 0.f)
+                    continue;
+                const Float4 weight = Float4::set(weights[k]);
+                const float* filtered_row = ring.data() + ((first_source_row + k) % ring_size) * filtered_row_size;
+                for (size_t i = 0; i < filtered_row_size; i += 4)
+                    (Float4::load(sum_row.data() + i) + weight * Float4::load(filtered_row + i)).store(sum_row.data() + i);
+            }
+
+            uint8_t* dst = image.pixels.data() + size_t(y) * image.width * 4;
+            for (int x = 0; x < image.width; x++) {
+                // Negative lobes of the kernel can produce values outside of [0, 1].
+                const Float4 sum = min(max(Float4::load(sum_row.data() + x * 4), Float4::zero()), Float4::set(1.f));
+                int32_t values[4];
+                (sum * output_scale + Float4::set(0.5f)).store_int(values);
+                if (srgb) {
+                    dst[x * 4 + 0] = srgb_tables.from_linear[values[0]];
+                    dst[x * 4 + 1] = srgb_tables.from_linear[values[1]];
+                    dst[x * 4 + 2] = srgb_tables.from_linear[values[2]];
+                }
+                else {
+                    dst[x * 4 + 0] = uint8_t(values[0]);
+                    dst[x * 4 + 1] = uint8_t(values[1]);
+                    dst[x * 4 + 2] = uint8_t(values[2]);
+                }
+                dst[x * 4 + 3] = uint8_t(values[3]);
+            }
+        }
+    });
+    return image;
+}
+
+using Block_Pixels = float[16][4];
+
+// Pixels outside of the image are clamped to the edge.
+void load_block(int width, int height, const uint8_t* rgba, int block_x, int block_y, Block_Pixels& pixels) {
+    for (int y = 0; y < 4; y++) {
+        const int py = std::min(block_y * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+            const int px = std::min(block_x * 4 + x, width - 1);
+            const uint8_t* p = rgba + (size_t(py) * width + px) * 4;
+            for (int c = 0; c < 4; c++)
+                pixels[y * 4 + x][c] = p[c];
+        }
+    }
+}
+
+// Endpoints are the extreme projections of the pixels on the principal axis of the first C channels.
+template <int C>
+void fit_endpoints_pca(const Block_Pixels& pixels, float e0[4], float e1[4]) {
+    float mean[C] = {};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < C; c++)
+            mean[c] += pixels[i][c] / 16.f;
+
+    float covariance[C][C] = {};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < C; a++)
+            for (int b = 0; b < C; b++)
+                covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+
+    // Power iteration starting from the channel with the largest variance.
+    int max_channel = 0;
+    for (int c = 1; c < C; c++)
+        if (covariance[c][c] > covariance[max_channel][max_channel])
+            max_channel = c;
+    float axis[C];
+    for (int c = 0; c < C; c++)
+        axis[c] = covariance[max_channel][c];
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[C] = {};
+        for (int a = 0; a < C; a++)
+            for (int b = 0; b < C; b++)
+                next[a] += covariance[a][b] * axis[b];
+        float length_squared = 0.f;
+        for (int c = 0; c < C; c++)
+            length_squared += next[c] * next[c];
+        if (length_squared < 1e-12f)
+            break;
+        const float inv_length = 1.f / std::sqrt(length_squared);
+        for (int c = 0; c < C; c++)
+            axis[c] = next[c] * inv_length;
+    }
+
+    float min_t = 0.f, max_t = 0.f;
+    if (covariance[max_channel][max_channel] > 0.f) {
+        min_t = FLT_MAX;
+        max_t = -FLT_MAX;
+        for (int i = 0; i < 16; i++) {
+            float t = 0.f;
+            for (int c = 0; c < C; c++)
+                t += (pixels[i][c] - mean[c]) * axis[c];
+            min_t = std::min(min_t, t);
+            max_t = std::max(max_t, t);
+        }
+    }
+    for (int c = 0; c < C; c++) {
+        e0[c] = std::clamp(mean[c] + axis[c] * min_t, 0.f, 255.f);
+        e1[c] = std::clamp(mean[c] + axis[c] * max_t, 0.f, 255.f);
+    }
+}
+
+// Least squares endpoints for the given per-pixel interpolation weights (0 selects e0, 1 selects e1).
+template <int C>
+bool fit_endpoints_least_squares(const Block_Pixels& pixels, const float weights[16], float e0[4], float e1[4]) {
+    float aa = 0.f, ab = 0.f, bb = 0.f;
+    float ax[C] = {}, bx[C] = {};
+    for (int i = 0; i < 16; i++) {
+        const float a = 1.f - weights[i];
+        const float b = weights[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < C; c++) {
+            ax[c] += a * pixels[i][c];
+            bx[c] += b * pixels[i][c];
+        }
+    }
+    const float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f)
+        return false;
+    const float inv_det = 1.f / det;
+    for (int c = 0; c < C; c++) {
+        e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) * inv_det, 0.f, 255.f);
+        e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) * inv_det, 0.f, 255.f);
+    }
+    return true;
+}
+
+//
+// BC1
+//
+struct BC1_Block {
+    uint16_t color0 = 0;
+    uint16_t color1 = 0;
+    uint8_t indices[16] = {};
+    float error = FLT_MAX;
+};
+
+uint16_t pack_565(const float color[4]) {
+    const uint32_t r = uint32_t(color[0] * (31.f / 255.f) + 0.5f);
+    const uint32_t g = uint32_t(color[1] * (63.f / 255.f) + 0.5f);
+    const uint32_t b = uint32_t(color[2] * (31.f / 255.f) + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+void unpack_565(uint16_t color, float rgb[3]) {
+    const uint32_t r = (color >> 11) & 31;
+    const uint32_t g = (color >> 5) & 63;
+    const uint32_t b = color & 31;
+    rgb[0] = float((r << 3) | (r >> 2));
+    rgb[1] = float((g << 2) | (g >> 4));
+    rgb[2] = float((b << 3) | (b >> 2));
+}
+
+// Selects the closest palette entries. color0 > color1 (4-color mode) unless they are equal.
+BC1_Block evaluate_bc1(const Block_Pixels& pixels, uint16_t color0, uint16_t color1) {
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    float palette[4][3];
+    unpack_565(color0, palette[0]);
+    unpack_565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+        palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+    }
+    const int palette_size = (color0 == color1) ? 1 : 4;
+
+    BC1_Block block;
+    block.color0 = color0;
+    block.color1 = color1;
+    block.error = 0.f;
+    for (int i = 0; i < 16; i++) {
+        float best_error = FLT_MAX;
+        for (int k = 0; k < palette_size; k++) {
+            float error = 0.f;
+            for (int c = 0; c < 3; c++) {
+                const float d = pixels[i][c] - palette[k][c];
+                error += d * d;
+            }
+            if (error < best_error) {
+                best_error = error;
+                block.indices[i] = uint8_t(k);
+            }
+        }
+        block.error += best_error;
+    }
+    return block;
+}
+
+void encode_bc1_block(const Block_Pixels& pixels, uint8_t* output) {
+    float e0[4], e1[4];
+    fit_endpoints_pca<3>(pixels, e0, e1);
+    BC1_Block block = evaluate_bc1(pixels, pack_565(e1), pack_565(e0));
+
+    // Refine endpoints for the selected indices.
+    if (block.color0 != block.color1) {
+        static constexpr float index_weights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+        float weights[16];
+        for (int i = 0; i < 16; i++)
+            weights[i] = index_weights[block.indices[i]];
+        if (fit_endpoints_least_squares<3>(pixels, weights, e0, e1)) {
+            BC1_Block refined_block = evaluate_bc1(pixels, pack_565(e0), pack_565(e1));
+            if (refined_block.error < block.error)
+                block = refined_block;
+        }
+    }
+
+    uint32_t indices = 0;
+    for (int i = 0; i < 16; i++)
+        indices |= uint32_t(block.indices[i]) << (2 * i);
+    output[0] = uint8_t(block.color0);
+    output[1] = uint8_t(block.color0 >> 8);
+    output[2] = uint8_t(block.color1);
+    output[3] = uint8_t(block.color1 >> 8);
+    memcpy(output + 4, &indices, 4); // little-endian
+}
+
+//
+// BC7 mode 6
+//
+constexpr uint32_t bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7_Mode6_Block {
+    uint8_t endpoints[2][4] = {}; // 7-bit values
+    uint8_t p_bits[2] = {};
+    uint8_t indices[16] = {};
+    float error = FLT_MAX;
+};
+
+// Chooses the p-bit that gives the smallest quantization error for the endpoint.
+void quantize_bc7_endpoint(const float endpoint[4], uint8_t quantized[4], uint8_t& p_bit) {
+    float best_error = FLT_MAX;
+    for (uint8_t p = 0; p < 2; p++) {
+        uint8_t q[4];
+        float error = 0.f;
+        for (int c = 0; c < 4; c++) {
+            q[c] = (uint8_t)std::clamp(int((endpoint[c] - p) * 0.5f + 0.5f), 0, 127);
+            const float d = float((q[c] << 1) | p) - endpoint[c];
+            error += d * d;
+        }
+        if (error < best_error) {
+            best_error = error;
+            memcpy(quantized, q, 4);
+            p_bit = p;
+        }
+    }
+}
+
+BC7_Mode6_Block evaluate_bc7_mode6(const Block_Pixels& pixels, const float e0[4], const float e1[4]) {
+    BC7_Mode6_Block block;
+    quantize_bc7_endpoint(e0, block.endpoints[0], block.p_bits[0]);
+    quantize_bc7_endpoint(e1, block.endpoints[1], block.p_bits[1]);
+
+    uint32_t decoded[2][4];
+    for (int e = 0; e < 2; e++)
+        for (int c = 0; c < 4; c++)
+            decoded[e][c] = (uint32_t(block.endpoints[e][c]) << 1) | block.p_bits[e];
+
+    float palette[16][4];
+    for (int k = 0; k < 16; k++)
+        for (int c = 0; c < 4; c++)
+            palette[k][c] = float(((64 - bc7_weights[k]) * decoded[0][c] + bc7_weights[k] * decoded[1][c] + 32) >> 6);
+
+    block.error = 0.f;
+    for (int i = 0; i < 16; i++) {
+        float best_error = FLT_MAX;
+        for (int k = 0; k < 16; k++) {
+            float error = 0.f;
+            for (int c = 0; c < 4; c++) {
+                const float d = pixels[i][c] - palette[k][c];
+                error += d * d;
+            }
+            if (error < best_error) {
+                best_error = error;
+                block.indices[i] = uint8_t(k);
+            }
+        }
+        block.error += best_error;
+    }
+    return block;
+}
+
+struct Bit_Writer {
+    uint8_t* output;
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t bit_count) {
+        for (uint32_t i = 0; i < bit_count; i++, position++) {
+            if (value & (1u << i))
+                output[position >> 3] |= uint8_t(1u << (position & 7));
+        }
+    }
+};
+
+void encode_bc7_block(const Block_Pixels& pixels, uint8_t* output) {
+    float e0[4], e1[4];
+    fit_endpoints_pca<4>(pixels, e0, e1);
+    BC7_Mode6_Block block = evaluate_bc7_mode6(pixels, e0, e1);
+
+    // Refine endpoints for the selected indices.
+    float weights[16];
+    for (int i = 0; i < 16; i++)
+        weights[i] = float(bc7_weights[block.indices[i]]) / 64.f;
+    if (fit_endpoints_least_squares<4>(pixels, weights, e0, e1)) {
+        BC7_Mode6_Block refined_block = evaluate_bc7_mode6(pixels, e0, e1);
+        if (refined_block.error < block.error)
+            block = refined_block;
+    }
+
+    // The most significant bit of the first (anchor) index is implicitly zero.
+    if (block.indices[0] & 8) {
+        std::swap(block.endpoints[0], block.endpoints[1]);
+        std::swap(block.p_bits[0], block.p_bits[1]);
+        for (uint8_t& index : block.indices)
+            index = 15 - index;
+    }
+
+    memset(output, 0, 16);
+    Bit_Writer writer{ output };
+    writer.write(1u << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++) {
+        writer.write(block.endpoints[0][c], 7);
+        writer.write(block.endpoints[1][c], 7);
+    }
+    writer.write(block.p_bits[0], 1);
+    writer.write(block.p_bits[1], 1);
+    writer.write(block.indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        writer.write(block.indices[i], 4);
+}
+
+std::vector<uint8_t> encode_blocks(int width, int height, const uint8_t* rgba, size_t block_size,
+    void (*encode_block)(const Block_Pixels& pixels, uint8_t* output))
+{
+    const int block_width = (width + 3) / 4;
+    const int block_height = (height + 3) / 4;
+    std::vector<uint8_t> blocks(size_t(block_width) * block_height * block_size);
+
+    const size_t chunk_count = get_parallel_chunk_count(block_height, 16);
+    const int rows_per_chunk = int((block_height + chunk_count - 1) / chunk_count);
+    run_parallel(chunk_count, [&](size_t chunk_index) {
+        PROFILE_SCOPE("encode blocks chunk");
+        const int first_row = int(chunk_index) * rows_per_chunk;
+        const int last_row = std::min(first_row + rows_per_chunk, block_height);
+        Block_Pixels pixels;
+        for (int y = first_row; y < last_row; y++) {
+            for (int x = 0; x < block_width; x++) {
+                load_block(width, height, rgba, x, y, pixels);
+                encode_block(pixels, blocks.data() + (size_t(y) * block_width + x) * block_size);
+            }
+        }
+    });
+    return blocks;
+}
+} // namespace
+
+bool is_valid_mip_filter(const Mip_Filter_Params& params) {
+    // The upper limits keep the tap count small for large downsampling factors of non-power-of-two sizes.
+    return params.radius >= 1.f && params.radius <= 8.f && params.kaiser_alpha >= 0.f && params.kaiser_alpha <= 20.f;
+}
+
+std::vector<RGBA8_Image> build_mip_chain(int width, int height, const uint8_t* rgba, const Mip_Filter_Params& filter, bool srgb) {
+    PROFILE_SCOPE("build_mip_chain");
+    if (!is_valid_mip_filter(filter))
+        error("build_mip_chain: invalid mip filter parameters");
+    std::vector<RGBA8_Image> levels;
+    while (width > 1 || height > 1) {
+        levels.push_back(downsample<Float4>(width, height, rgba, filter, srgb));
+        width = levels.back().width;
+        height = levels.back().height;
+        rgba = levels.back().pixels.data();
+    }
+    return levels;
+}
+
+void check_mip_filter() {
+    // Gradients with a high frequency pattern and pseudo-random alpha. Odd sizes exercise non-2x scale factors.
+    const int sizes[][2] = { { 64, 64 }, { 37, 21 }, { 1, 9 }, { 130, 1 } };
+    const Mip_Filter_Params filters[] = {
+        { Mip_Filter::box }, { Mip_Filter::kaiser }, { Mip_Filter::lanczos },
+        { Mip_Filter::kaiser, 2.f, 8.f }, { Mip_Filter::lanczos, 4.f },
+    };
+    int checked_levels = 0;
+    for (const auto& size : sizes) {
+        const int width = size[0];
+        const int height = size[1];
+        std::vector<uint8_t> image(size_t(width) * height * 4);
+        uint32_t random = 12345;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint8_t* p = &image[(size_t(y) * width + x) * 4];
+                random = random * 1664525u + 1013904223u;
+                p[0] = uint8_t(x * 255 / std::max(width - 1, 1));
+                p[1] = uint8_t(y * 255 / std::max(height - 1, 1));
+                p[2] = ((x + y) & 1) ? 255 : 0;
+                p[3] = uint8_t(random >> 24);
+            }
+        }
+        const std::vector<uint8_t> constant_image(image.size(), 100);
+
+        for (bool srgb : { true, false }) {
+            for (const Mip_Filter_Params& filter : filters) {
+                const RGBA8_Image simd = downsample<Float4>(width, height, image.data(), filter, srgb);
+                const RGBA8_Image scalar = downsample<Scalar_Float4>(width, height, image.data(), filter, srgb);
+                // Summation order is the same, but SIMD and scalar code can round differently (e.g. FMA contraction).
+                for (size_t i = 0; i < simd.pixels.size(); i++) {
+                    if (std::abs(int(simd.pixels[i]) - int(scalar.pixels[i])) > 1)
+                        error("mip filter check failed: SIMD and scalar results differ for " +
+                            std::to_string(width) + "x" + std::to_string(height) + " image");
+                }
+
+                const RGBA8_Image constant = downsample<Float4>(width, height, constant_image.data(), filter, srgb);
+                for (uint8_t value : constant.pixels) {
+                    if (std::abs(int(value) - 100) > 1)
+                        error("mip filter check failed: constant image is not preserved");
+                }
+
+                // Box filter of even sizes is a 2x2 average.
+                if (filter.filter == Mip_Filter::box && !srgb && width % 2 == 0 && height % 2 == 0) {
+                    for (int y = 0; y < simd.height; y++) {
+                        for (int x = 0; x < simd.width; x++) {
+                            for (int c = 0; c < 4; c++) {
+                                auto source = [&](int sx, int sy) { return int(image[(size_t(sy) * width + sx) * 4 + c]); };
+                                const int sum = source(2 * x, 2 * y) + source(2 * x + 1, 2 * y) + source(2 * x, 2 * y + 1) + source(2 * x + 1, 2 * y + 1);
+                                const int value = simd.pixels[(size_t(y) * simd.width + x) * 4 + c];
+                                if (std::abs(value * 4 - sum) > 4)
+                                    error("mip filter check failed: box filter differs from 2x2 average");
+                            }
+                        }
+                    }
+                }
+                checked_levels++;
+            }
+        }
+    }
+    printf("Mip filter check passed (%d levels)\n", checked_levels);
+}
+
+std::vector<uint8_t> encode_bc1(int width, int height, const uint8_t* rgba) {
+    PROFILE_SCOPE("encode_bc1");
+    return encode_blocks(width, height, rgba, 8, encode_bc1_block);
+}
+
+std::vector<uint8_t> encode_bc7(int width, int height, const uint8_t* rgba) {
+    PROFILE_SCOPE("encode_bc7");
+    return encode_blocks(width, height, rgba, 16, encode_bc7_block);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Pixels of a single mip level, 4 bytes per pixel.
+struct RGBA8_Image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+enum class Mip_Filter {
+    box,        // average of the 2x2 source pixels
+    kaiser,     // Kaiser-windowed sinc
+    lanczos,    // Lanczos windowed sinc
+};
+
+struct Mip_Filter_Params {
+    Mip_Filter filter = Mip_Filter::kaiser;
+    float radius = 3.f;         // kernel radius in destination pixels [1, 8], not used by the box filter
+    float kaiser_alpha = 4.f;   // Kaiser window shape [0, 20], larger values give less ringing and more blur
+};
+
+// Returns false if the parameters are outside of the supported ranges.
+bool is_valid_mip_filter(const Mip_Filter_Params& params);
+
+// Builds mip levels 1..N (down to 1x1), each level is filtered from the previous one with a separable
+// kernel, edges are clamped. When srgb is true RGB is sRGB encoded and is filtered in linear space.
+// Alpha is always filtered as is. The base level is not included in the result. Rows of each level
+// are split into chunks that are filtered in parallel with run_parallel, including calls from worker
+// pool tasks such as load_texture_cached (verified by check_texture_encode_threads).
+std::vector<RGBA8_Image> build_mip_chain(int width, int height, const uint8_t* rgba,
+    const Mip_Filter_Params& filter = Mip_Filter_Params(), bool srgb = true);
+
+// Checks the SIMD mip filter against the scalar implementation and the box filter against a naive 2x2
+// average on synthetic images, also checks that constant images stay constant. Calls error() on mismatch.
+void check_mip_filter();
+
+// Block compression. Images of any size are supported, the pixels of partial edge blocks are
+// replicated from the last row/column. Rows of blocks are split into chunks that are encoded in parallel
+// with run_parallel, including calls from worker pool tasks (load_texture_cached runs on the pool in the demo).
+//
+// BC1: 8 bytes per 4x4 block, opaque (alpha is ignored).
+// BC7: 16 bytes per 4x4 block, mode 6 (single subset RGBA with 4-bit indices).
+std::vector<uint8_t> encode_bc1(int width, int height, const uint8_t* rgba);
+std::vector<uint8_t> encode_bc7(int width, int height, const uint8_t* rgba);
@@ -1,5 +1,8 @@
 #define VMA_IMPLEMENTATION
 #include "vk.h"
+#include "lib.h"
+#include "profiler.h"
+#include "texture_compression.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -9,10 +12,26 @@
 #include "vulkan/vk_enum_string_helper.h"
 const char* vk_result_to_string(VkResult result) { return string_VkResult(result); }
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <format>
-#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
 
 constexpr uint32_t max_timestamp_queries = 64;
+constexpr uint32_t max_pipeline_statistics_queries = 16;
+
+constexpr VkQueryPipelineStatisticFlags pipeline_statistics_flags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+constexpr uint32_t pipeline_statistics_count = 5; // number of bits in pipeline_statistics_flags
 
 //
 // Vk_Instance is a container that stores common Vulkan resources like vulkan instance,
@@ -94,8 +113,10 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
         vk.timestamp_period_ms = (double)gpu_properties.limits.timestampPeriod * 1e-6;
     }
 
-    VK_CHECK(glfwCreateWindowSurface(vk.instance, window, nullptr, &vk.surface));
-    vk.surface_usage_flags = params.surface_usage_flags;
+    if (!vk.headless) {
+        VK_CHECK(glfwCreateWindowSurface(vk.instance, window, nullptr, &vk.surface));
+        vk.surface_usage_flags = params.surface_usage_flags;
+    }
 
     // select queue family
     {
@@ -108,8 +129,10 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
         // select queue family with presentation and graphics support
         vk.queue_family_index = -1;
         for (uint32_t i = 0; i < queue_family_count; i++) {
-            VkBool32 presentation_supported;
-            VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(vk.physical_device, i, vk.surface, &presentation_supported));
+            VkBool32 presentation_supported = VK_TRUE;
+            if (!vk.headless) {
+                VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(vk.physical_device, i, vk.surface, &presentation_supported));
+            }
 
             if (presentation_supported && (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0) {
                 vk.queue_family_index = i;
@@ -119,6 +142,8 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
         if (vk.queue_family_index == uint32_t(-1)) {
             vk.error("Vulkan: failed to find queue family");
         }
+        const uint32_t timestamp_valid_bits = queue_families[vk.queue_family_index].timestampValidBits;
+        vk.timestamp_mask = timestamp_valid_bits >= 64 ? ~0ull : (1ull << timestamp_valid_bits) - 1;
     }
 
     // create VkDevice
@@ -141,6 +166,60 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
                 vk.error("Vulkan: required device extension is not available: " + std::string(required_extension));
             }
         }
+        std::vector<const char*> device_extensions(params.device_extensions.begin(), params.device_extensions.end());
+        auto enable_extension = [&device_extensions](const char* extension_name) {
+            if (std::find_if(device_extensions.begin(), device_extensions.end(),
+                [extension_name](const char* name) { return !strcmp(name, extension_name); }) == device_extensions.end())
+            {
+                device_extensions.push_back(extension_name);
+            }
+        };
+
+        // Calibrated timestamps are used only for profiling, so the extension is optional.
+#ifdef _WIN32
+        vk.host_time_domain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+        vk.host_time_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+        vk.calibrated_timestamps = false;
+        if (is_extension_supported(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)) {
+            uint32_t time_domain_count = 0;
+            VK_CHECK(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(vk.physical_device, &time_domain_count, nullptr));
+            std::vector<VkTimeDomainEXT> time_domains(time_domain_count);
+            VK_CHECK(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(vk.physical_device, &time_domain_count, time_domains.data()));
+
+            bool device_domain_supported = std::find(time_domains.begin(), time_domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != time_domains.end();
+            bool host_domain_supported = std::find(time_domains.begin(), time_domains.end(), vk.host_time_domain) != time_domains.end();
+            if (device_domain_supported && host_domain_supported) {
+                vk.calibrated_timestamps = true;
+                enable_extension(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+            }
+        }
+
+        // Pipeline executable properties are used only to report shader statistics.
+        VkPhysicalDevicePipelineExecutablePropertiesFeaturesKHR pipeline_executable_features{
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_EXECUTABLE_PROPERTIES_FEATURES_KHR };
+        vk.pipeline_executable_info = false;
+        if (params.capture_pipeline_statistics && is_extension_supported(VK_KHR_PIPELINE_EXECUTABLE_PROPERTIES_EXTENSION_NAME)) {
+            VkPhysicalDeviceFeatures2 supported_features2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+            supported_features2.pNext = &pipeline_executable_features;
+            vkGetPhysicalDeviceFeatures2(vk.physical_device, &supported_features2);
+            vk.pipeline_executable_info = pipeline_executable_features.pipelineExecutableInfo == VK_TRUE;
+        }
+
+        // Shader clock is used only by the debug visualization, so the extension is optional.
+        VkPhysicalDeviceShaderClockFeaturesKHR shader_clock_features{
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR };
+        vk.shader_clock = false;
+        if (params.shader_clock && is_extension_supported(VK_KHR_SHADER_CLOCK_EXTENSION_NAME)) {
+            VkPhysicalDeviceFeatures2 supported_features2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+            supported_features2.pNext = &shader_clock_features;
+            vkGetPhysicalDeviceFeatures2(vk.physical_device, &supported_features2);
+            vk.shader_clock = shader_clock_features.shaderDeviceClock == VK_TRUE;
+            shader_clock_features = VkPhysicalDeviceShaderClockFeaturesKHR{
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR };
+            shader_clock_features.shaderDeviceClock = VK_TRUE;
+        }
 
         const float priority = 1.0;
         VkDeviceQueueCreateInfo queue_create_info { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
@@ -150,10 +229,47 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
 
         VkDeviceCreateInfo device_create_info { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
         device_create_info.pNext = params.device_create_info_pnext;
+
+        VkPhysicalDeviceFeatures supported_features;
+        vkGetPhysicalDeviceFeatures(vk.physical_device, &supported_features);
+        vk.pipeline_statistics = false;
+        vk.texture_compression_bc = false;
+
+        // Make a copy of the application's VkPhysicalDeviceFeatures2 to enable optional features.
+        VkPhysicalDeviceFeatures2 features2;
+        if (params.device_create_info_pnext && params.device_create_info_pnext->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2) {
+            features2 = *(const VkPhysicalDeviceFeatures2*)params.device_create_info_pnext;
+            if (supported_features.pipelineStatisticsQuery) {
+                features2.features.pipelineStatisticsQuery = VK_TRUE;
+                vk.pipeline_statistics = true;
+            }
+            if (params.texture_compression_bc && supported_features.textureCompressionBC) {
+                features2.features.textureCompressionBC = VK_TRUE;
+                vk.texture_compression_bc = true;
+            }
+            if (vk.pipeline_executable_info) {
+                pipeline_executable_features.pNext = features2.pNext;
+                features2.pNext = &pipeline_executable_features;
+                enable_extension(VK_KHR_PIPELINE_EXECUTABLE_PROPERTIES_EXTENSION_NAME);
+            }
+            if (vk.shader_clock) {
+                shader_clock_features.pNext = features2.pNext;
+                features2.pNext = &shader_clock_features;
+                enable_extension(VK_KHR_SHADER_CLOCK_EXTENSION_NAME);
+            }
+            device_create_info.pNext = &features2;
+        }
+        else {
+            vk.pipeline_executable_info = false;
+            vk.shader_clock = false;
+        }
+        if (params.capture_pipeline_statistics && !vk.pipeline_executable_info) {
+            printf("Pipeline executable statistics are not supported\n");
+        }
         device_create_info.queueCreateInfoCount = 1;
         device_create_info.pQueueCreateInfos = &queue_create_info;
-        device_create_info.enabledExtensionCount = (uint32_t)params.device_extensions.size();
-        device_create_info.ppEnabledExtensionNames = params.device_extensions.data();
+        device_create_info.enabledExtensionCount = (uint32_t)device_extensions.size();
+        device_create_info.ppEnabledExtensionNames = device_extensions.data();
 
         VK_CHECK(vkCreateDevice(vk.physical_device, &device_create_info, nullptr, &vk.device));
     }
@@ -174,7 +290,10 @@ void Vk_Buffer::destroy()
 
 void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
 {
+    PROFILE_SCOPE("vk_initialize");
     vk.error = init_params.error_reporter;
+    vk.headless = init_params.headless;
+    assert(vk.headless || window != nullptr);
     VK_CHECK(volkInitialize());
     uint32_t instance_version = volkGetInstanceVersion();
 
@@ -186,10 +305,16 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
     if (!instance_version_higher_than_or_equal_to_1_1) {
         vk.error("The supported instance version is Vulkan 1.1 or higher, but Vulkan 1.0 loader is detected");
     }
-    create_instance(init_params.instance_extensions);
-    volkLoadInstance(vk.instance);
-    create_device(init_params, window);
-    volkLoadDevice(vk.device);
+    {
+        PROFILE_SCOPE("create_instance");
+        create_instance(init_params.instance_extensions);
+        volkLoadInstance(vk.instance);
+    }
+    {
+        PROFILE_SCOPE("create_device");
+        create_device(init_params, window);
+        volkLoadDevice(vk.device);
+    }
 
     vkGetDeviceQueue(vk.device, vk.queue_family_index, 0, &vk.queue);
 
@@ -281,7 +406,7 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
     }
 
     // Select surface format.
-    {
+    if (!vk.headless) {
         uint32_t format_count;
         VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(vk.physical_device, vk.surface, &format_count, nullptr));
         assert(format_count > 0);
@@ -307,7 +432,13 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
         } ();
     }
 
-    vk_create_swapchain(true);
+    if (vk.headless) {
+        vk.surface_size = init_params.headless_surface_size;
+        assert(vk.surface_size.width != 0 && vk.surface_size.height != 0);
+    }
+    else {
+        vk_create_swapchain(init_params.vsync);
+    }
 
     // Query pool.
     {
@@ -317,6 +448,14 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
         VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.timestamp_query_pools[0]));
         VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.timestamp_query_pools[1]));
     }
+    if (vk.pipeline_statistics) {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        create_info.queryCount = max_pipeline_statistics_queries;
+        create_info.pipelineStatistics = pipeline_statistics_flags;
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.pipeline_statistics_query_pools[0]));
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.pipeline_statistics_query_pools[1]));
+    }
 }
 
 void vk_shutdown()
@@ -337,11 +476,17 @@ void vk_shutdown()
     vkDestroyFence(vk.device, vk.frame_fence[1], nullptr);
     vkDestroyQueryPool(vk.device, vk.timestamp_query_pools[0], nullptr);
     vkDestroyQueryPool(vk.device, vk.timestamp_query_pools[1], nullptr);
+    vkDestroyQueryPool(vk.device, vk.pipeline_statistics_query_pools[0], nullptr);
+    vkDestroyQueryPool(vk.device, vk.pipeline_statistics_query_pools[1], nullptr);
     vkDestroyDescriptorPool(vk.device, vk.imgui_descriptor_pool, nullptr);
-    vk_destroy_swapchain();
+    if (!vk.headless) {
+        vk_destroy_swapchain();
+    }
     vmaDestroyAllocator(vk.allocator);
     vkDestroyDevice(vk.device, nullptr);
-    vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
+    if (!vk.headless) {
+        vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
+    }
     vkDestroyDebugUtilsMessengerEXT(vk.instance, vk.debug_utils_messenger, nullptr);
     vkDestroyInstance(vk.instance, nullptr);
 }
@@ -474,6 +619,9 @@ Vk_Buffer vk_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const vo
 Vk_Buffer vk_create_buffer_with_alignment(VkDeviceSize size, VkBufferUsageFlags usage, uint32_t min_alignment,
     const void* data, const char* name)
 {
+    if (size == 0)
+        vk.error("Vulkan: buffer size is zero: " + std::string(name ? name : "unnamed buffer"));
+
     VkBufferCreateInfo buffer_create_info{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     buffer_create_info.size = size;
     buffer_create_info.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
@@ -491,17 +639,108 @@ Vk_Buffer vk_create_buffer_with_alignment(VkDeviceSize size, VkBufferUsageFlags
     buffer.device_address = vkGetBufferDeviceAddress(vk.device, &buffer_address_info);
 
     if (data != nullptr) {
-        vk_ensure_staging_buffer_allocation(size);
-        memcpy(vk.staging_buffer_ptr, data, size);
-        vk_execute(vk.command_pools[0], vk.queue, [size, &buffer](VkCommandBuffer command_buffer) {
-            VkBufferCopy region{};
-            region.size = size;
-            vkCmdCopyBuffer(command_buffer, vk.staging_buffer, buffer.handle, 1, &region);
-        });
+        Vk_Buffer_Uploader uploader;
+        uploader.begin(std::min(size, Vk_Buffer_Uploader::default_staging_size));
+        uploader.write(buffer.handle, 0, data, size);
+        uploader.end();
     }
     return buffer;
 }
 
+void Vk_Buffer_Uploader::begin(VkDeviceSize staging_size)
+{
+    assert(staging_size > 0);
+    vk_ensure_staging_buffer_allocation(staging_size * chunk_count);
+    this->staging_size = staging_size;
+    staging_used = 0;
+    current_chunk = 0;
+    regions.clear();
+
+    VkFenceCreateInfo fence_desc{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    for (Chunk_Submit& submit : chunk_submits)
+        VK_CHECK(vkCreateFence(vk.device, &fence_desc, nullptr, &submit.fence));
+}
+
+void Vk_Buffer_Uploader::write(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0) {
+        if (staging_used == staging_size)
+            flush();
+
+        VkDeviceSize chunk_size = std::min(size, staging_size - staging_used);
+        const VkDeviceSize staging_offset = current_chunk * staging_size + staging_used;
+        memcpy(vk.staging_buffer_ptr + staging_offset, bytes, chunk_size);
+
+        // Consecutive writes to the same buffer are merged into a single copy region.
+        if (!regions.empty() && regions.back().buffer == buffer &&
+            regions.back().copy.dstOffset + regions.back().copy.size == offset)
+        {
+            regions.back().copy.size += chunk_size;
+        } else {
+            regions.push_back(Region{ buffer, VkBufferCopy{ staging_offset, offset, chunk_size } });
+        }
+        staging_used += chunk_size;
+        offset += chunk_size;
+        bytes += chunk_size;
+        size -= chunk_size;
+    }
+}
+
+void Vk_Buffer_Uploader::end()
+{
+    flush();
+    for (int i = 0; i < chunk_count; i++) {
+        wait_for_chunk(i);
+        vkDestroyFence(vk.device, chunk_submits[i].fence, nullptr);
+        chunk_submits[i].fence = VK_NULL_HANDLE;
+    }
+}
+
+void Vk_Buffer_Uploader::flush()
+{
+    if (regions.empty())
+        return;
+
+    Chunk_Submit& submit = chunk_submits[current_chunk];
+    VkCommandBufferAllocateInfo alloc_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+    alloc_info.commandPool = vk.command_pools[0];
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+    VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &submit.command_buffer));
+
+    VkCommandBufferBeginInfo begin_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(submit.command_buffer, &begin_info));
+    for (const Region& region : regions)
+        vkCmdCopyBuffer(submit.command_buffer, vk.staging_buffer, region.buffer, 1, &region.copy);
+    VK_CHECK(vkEndCommandBuffer(submit.command_buffer));
+
+    VkCommandBufferSubmitInfo cmd_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO };
+    cmd_info.commandBuffer = submit.command_buffer;
+    VkSubmitInfo2 submit_info{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
+    submit_info.commandBufferInfoCount = 1;
+    submit_info.pCommandBufferInfos = &cmd_info;
+    VK_CHECK(vkQueueSubmit2(vk.queue, 1, &submit_info, submit.fence));
+
+    // The next chunk is filled while the copy runs.
+    current_chunk = (current_chunk + 1) % chunk_count;
+    staging_used = 0;
+    regions.clear();
+    wait_for_chunk(current_chunk);
+}
+
+void Vk_Buffer_Uploader::wait_for_chunk(int chunk)
+{
+    Chunk_Submit& submit = chunk_submits[chunk];
+    if (submit.command_buffer == VK_NULL_HANDLE)
+        return;
+    VK_CHECK(vkWaitForFences(vk.device, 1, &submit.fence, VK_TRUE, UINT64_MAX));
+    VK_CHECK(vkResetFences(vk.device, 1, &submit.fence));
+    vkFreeCommandBuffers(vk.device, vk.command_pools[0], 1, &submit.command_buffer);
+    submit.command_buffer = VK_NULL_HANDLE;
+}
+
 Vk_Buffer vk_create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage, void** buffer_ptr, const char* name)
 {
     VkBufferCreateInfo buffer_create_info { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
@@ -574,16 +813,9 @@ Vk_Image vk_create_image(int width, int height, VkFormat format, VkImageUsageFla
     return image;
 }
 
-Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate_mipmaps, const uint8_t* pixels, int bytes_per_pixel, const char* name)
+static Vk_Image create_texture_image(int width, int height, VkFormat format, uint32_t mip_levels, VkImageUsageFlags usage, const char* name)
 {
     Vk_Image image;
-    uint32_t mip_levels = 1;
-    if (generate_mipmaps) {
-        mip_levels = 0;
-        for (int k = std::max(width, height); k > 0; k >>= 1)
-            mip_levels++;
-    }
-
     // create image
     {
         VkImageCreateInfo image_create_info { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
@@ -596,7 +828,7 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
         image_create_info.arrayLayers    = 1;
         image_create_info.samples        = VK_SAMPLE_COUNT_1_BIT;
         image_create_info.tiling         = VK_IMAGE_TILING_OPTIMAL;
-        image_create_info.usage          = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | (generate_mipmaps ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+        image_create_info.usage          = usage;
         image_create_info.sharingMode    = VK_SHARING_MODE_EXCLUSIVE;
         image_create_info.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
 
@@ -625,149 +857,93 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
         VK_CHECK(vkCreateImageView(vk.device, &create_info, nullptr, &image.view));
         vk_set_debug_name(image.view, (name + std::string(" (ImageView)")).c_str());
     }
-
-    // upload image data
-    {
-        int buffer_size = width * height * bytes_per_pixel;
-        vk_ensure_staging_buffer_allocation(buffer_size);
-        memcpy(vk.staging_buffer_ptr, pixels, buffer_size);
-
-        VkBufferImageCopy region;
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = VkOffset3D{ 0, 0, 0 };
-        region.imageExtent = VkExtent3D{ (uint32_t)width, (uint32_t)height, 1 };
-
-        VkImageSubresourceRange subresource_range{};
-        subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subresource_range.levelCount = 1;
-        subresource_range.layerCount = VK_REMAINING_ARRAY_LAYERS;
-
-        vk_execute(vk.command_pools[0], vk.queue,
-            [&image, &region, &subresource_range, width, height, mip_levels](VkCommandBuffer command_buffer) {
-
-            subresource_range.baseMipLevel = 0;
-
-            vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-            vkCmdCopyBufferToImage(command_buffer, vk.staging_buffer, image.handle,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-            if (mip_levels == 1) {
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-                return;
-            }
-
-            VkImageBlit blit{};
-            blit.srcSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.srcSubresource.baseArrayLayer  = 0;
-            blit.srcSubresource.layerCount      = 1;
-            blit.dstSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.dstSubresource.baseArrayLayer  = 0;
-            blit.dstSubresource.layerCount      = 1;
-
-            int32_t w = (int32_t)width;
-            int32_t h = (int32_t)height;
-
-            for (uint32_t i = 1; i < mip_levels; i++) {
-                blit.srcSubresource.mipLevel = i - 1;
-                blit.srcOffsets[1] = VkOffset3D { w, h, 1 };
-
-                w = std::max(w >> 1, 1);
-                h = std::max(h >> 1, 1);
-
-                blit.dstSubresource.mipLevel = i;
-                blit.dstOffsets[1] = VkOffset3D { w, h, 1 };
-
-                subresource_range.baseMipLevel = i-1;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-                subresource_range.baseMipLevel = i;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
-                    VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-                vkCmdBlitImage(command_buffer,
-                    image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    1, &blit, VK_FILTER_LINEAR);
-
-                subresource_range.baseMipLevel = i-1;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                    VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-            }
-
-            subresource_range.baseMipLevel = mip_levels - 1;
-            vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
-                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        });
-    }
-
     return image;
 }
 
-Vk_Image vk_load_texture(const std::string& texture_file)
+Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate_mipmaps, const uint8_t* pixels, int bytes_per_pixel, const char* name)
 {
-    int w, h;
-    int component_count;
+    std::vector<std::span<const uint8_t>> levels;
+    levels.push_back(std::span(pixels, size_t(width) * height * bytes_per_pixel));
 
-    auto rgba_pixels = stbi_load(texture_file.c_str(), &w, &h, &component_count,STBI_rgb_alpha);
-    if (rgba_pixels == nullptr) {
-        vk.error("failed to load image file: " + texture_file);
+    // Mips are filtered on the CPU and uploaded together with the base level.
+    std::vector<RGBA8_Image> mip_chain;
+    if (generate_mipmaps) {
+        if (bytes_per_pixel != 4)
+            vk.error("vk_create_texture: mipmap generation supports only 4 bytes per pixel formats");
+        const bool srgb = (format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB);
+        mip_chain = build_mip_chain(width, height, pixels, Mip_Filter_Params(), srgb);
+        for (const RGBA8_Image& level : mip_chain)
+            levels.push_back(level.pixels);
     }
-
-    Vk_Image texture = vk_create_texture(w, h, VK_FORMAT_R8G8B8A8_SRGB, true, rgba_pixels, 4, texture_file.c_str());
-    stbi_image_free(rgba_pixels);
-    return texture;
+    return vk_create_texture_from_mips(width, height, format, levels, name);
 }
 
-static std::vector<uint8_t> read_binary_file(const std::string& file_name)
+Vk_Image vk_create_texture_from_mips(int width, int height, VkFormat format, std::span<const std::span<const uint8_t>> mip_levels, const char* name)
 {
-    std::ifstream file(file_name, std::ios_base::in | std::ios_base::binary);
-    if (!file) {
-        vk.error("failed to open file: " + file_name);
+    Vk_Image image = create_texture_image(width, height, format, (uint32_t)mip_levels.size(),
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, name);
+
+    // All levels are copied to the staging buffer. Offsets are aligned for any texel block size.
+    std::vector<VkBufferImageCopy> regions(mip_levels.size());
+    VkDeviceSize staging_size = 0;
+    for (uint32_t i = 0; i < (uint32_t)mip_levels.size(); i++) {
+        staging_size = round_up(staging_size, VkDeviceSize(16));
+        VkBufferImageCopy& region = regions[i];
+        region = VkBufferImageCopy{};
+        region.bufferOffset = staging_size;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = i;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = VkExtent3D{ (uint32_t)std::max(width >> i, 1), (uint32_t)std::max(height >> i, 1), 1 };
+        staging_size += mip_levels[i].size();
     }
-    // get file size
-    file.seekg(0, std::ios_base::end);
-    std::streampos file_size = file.tellg();
-    file.seekg(0, std::ios_base::beg);
+    vk_ensure_staging_buffer_allocation(staging_size);
+    for (uint32_t i = 0; i < (uint32_t)mip_levels.size(); i++)
+        memcpy(vk.staging_buffer_ptr + regions[i].bufferOffset, mip_levels[i].data(), mip_levels[i].size());
+
+    VkImageSubresourceRange subresource_range{};
+    subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresource_range.levelCount = VK_REMAINING_MIP_LEVELS;
+    subresource_range.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+    vk_execute(vk.command_pools[0], vk.queue, [&image, &regions, &subresource_range](VkCommandBuffer command_buffer) {
+        vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        vkCmdCopyBufferToImage(command_buffer, vk.staging_buffer, image.handle,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+
+        vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    });
+    return image;
+}
 
-    if (file_size == std::streampos(-1) || !file) {
-        vk.error("failed to read file stats: " + file_name);
-    }
-    // read file content
-    std::vector<uint8_t> file_content(static_cast<size_t>(file_size));
-    file.read(reinterpret_cast<char*>(file_content.data()), file_size);
-    if (!file) {
-        vk.error("failed to read file content: " + file_name);
-    }
-    return file_content;
+Vk_Image vk_load_texture(const std::string& texture_file)
+{
+    PROFILE_SCOPE("vk_load_texture");
+    Image_Pixels image = decode_image(texture_file);
+    PROFILE_SCOPE("vk_create_texture");
+    return vk_create_texture(image.width, image.height, VK_FORMAT_R8G8B8A8_SRGB, true, image.rgba, 4, texture_file.c_str());
 }
 
 VkShaderModule vk_load_spirv(const std::string& spirv_file)
 {
-    std::vector<uint8_t> bytes = read_binary_file(spirv_file);
-
-    if (bytes.size() % 4 != 0) {
+    // The mapping is page aligned, so the code is passed to the driver without a copy.
+    Mapped_File file;
+    if (!file.map(spirv_file, File_Access::whole_file)) {
+        vk.error("failed to open file: " + spirv_file);
+    }
+    if (file.size % 4 != 0) {
         vk.error("Vulkan: SPIR-V binary buffer size is not multiple of 4");
     }
 
     VkShaderModuleCreateInfo create_info { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO } ;
-    create_info.codeSize = bytes.size();
-    create_info.pCode = reinterpret_cast<const uint32_t*>(bytes.data());
+    create_info.codeSize = file.size;
+    create_info.pCode = reinterpret_cast<const uint32_t*>(file.data);
 
     VkShaderModule shader_module;
     VK_CHECK(vkCreateShaderModule(vk.device, &create_info, nullptr, &shader_module));
@@ -907,7 +1083,7 @@ VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
 
     VkGraphicsPipelineCreateInfo create_info { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
     create_info.pNext                                   = &rendering_create_info;
-    create_info.flags                                   = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    create_info.flags                                   = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT | vk_get_pipeline_capture_flags();
     create_info.stageCount                              = (uint32_t)std::size(shader_stages_state);
     create_info.pStages                                 = shader_stages_state;
     create_info.pVertexInputState                       = &vertex_input_state;
@@ -924,6 +1100,7 @@ VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
     VkPipeline pipeline{};
     VK_CHECK(vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
     vk_set_debug_name(pipeline, name);
+    vk_collect_pipeline_executable_statistics(pipeline, name);
     return pipeline;
 }
 
@@ -935,25 +1112,134 @@ VkPipeline vk_create_compute_pipeline(VkShaderModule compute_shader, VkPipelineL
     compute_stage.pName = "main";
 
     VkComputePipelineCreateInfo create_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-    create_info.flags = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    create_info.flags = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT | vk_get_pipeline_capture_flags();
     create_info.stage = compute_stage;
     create_info.layout = pipeline_layout;
 
     VkPipeline pipeline{};
     VK_CHECK(vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
     vk_set_debug_name(pipeline, name);
+    vk_collect_pipeline_executable_statistics(pipeline, name);
     return pipeline;
 }
 
+VkPipelineCreateFlags vk_get_pipeline_capture_flags()
+{
+    return vk.pipeline_executable_info ? VK_PIPELINE_CREATE_CAPTURE_STATISTICS_BIT_KHR : 0;
+}
+
+static void write_json_string(std::string& json, const char* str)
+{
+    json += '"';
+    for (const char* c = str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            json += '\\';
+        if (*c == '\n')
+            json += "\\n";
+        else if ((unsigned char)*c >= 0x20)
+            json += *c;
+    }
+    json += '"';
+}
+
+void vk_collect_pipeline_executable_statistics(VkPipeline pipeline, const char* pipeline_name)
+{
+    if (!vk.pipeline_executable_info)
+        return;
+
+    VkPipelineInfoKHR pipeline_info{ VK_STRUCTURE_TYPE_PIPELINE_INFO_KHR };
+    pipeline_info.pipeline = pipeline;
+
+    uint32_t executable_count = 0;
+    VK_CHECK(vkGetPipelineExecutablePropertiesKHR(vk.device, &pipeline_info, &executable_count, nullptr));
+    std::vector<VkPipelineExecutablePropertiesKHR> executables(executable_count, { VK_STRUCTURE_TYPE_PIPELINE_EXECUTABLE_PROPERTIES_KHR });
+    VK_CHECK(vkGetPipelineExecutablePropertiesKHR(vk.device, &pipeline_info, &executable_count, executables.data()));
+
+    std::string json = "    {\n      \"pipeline\": ";
+    write_json_string(json, pipeline_name ? pipeline_name : "");
+    json += ",\n      \"executables\": [\n";
+
+    for (uint32_t i = 0; i < executable_count; i++) {
+        const VkPipelineExecutablePropertiesKHR& executable = executables[i];
+        json += "        {\n          \"name\": ";
+        write_json_string(json, executable.name);
+        json += ",\n          \"description\": ";
+        write_json_string(json, executable.description);
+        json += std::format(",\n          \"stages\": \"{}\",\n          \"subgroup_size\": {},\n          \"statistics\": {{",
+            string_VkShaderStageFlags(executable.stages), executable.subgroupSize);
+
+        VkPipelineExecutableInfoKHR executable_info{ VK_STRUCTURE_TYPE_PIPELINE_EXECUTABLE_INFO_KHR };
+        executable_info.pipeline = pipeline;
+        executable_info.executableIndex = i;
+
+        uint32_t statistic_count = 0;
+        VK_CHECK(vkGetPipelineExecutableStatisticsKHR(vk.device, &executable_info, &statistic_count, nullptr));
+        std::vector<VkPipelineExecutableStatisticKHR> statistics(statistic_count, { VK_STRUCTURE_TYPE_PIPELINE_EXECUTABLE_STATISTIC_KHR });
+        VK_CHECK(vkGetPipelineExecutableStatisticsKHR(vk.device, &executable_info, &statistic_count, statistics.data()));
+
+        for (uint32_t k = 0; k < statistic_count; k++) {
+            const VkPipelineExecutableStatisticKHR& statistic = statistics[k];
+            json += (k == 0) ? "\n            " : ",\n            ";
+            write_json_string(json, statistic.name);
+            json += ": ";
+            switch (statistic.format) {
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_BOOL32_KHR:
+                json += statistic.value.b32 ? "true" : "false";
+                break;
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_INT64_KHR:
+                json += std::to_string(statistic.value.i64);
+                break;
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_UINT64_KHR:
+                json += std::to_string(statistic.value.u64);
+                break;
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_FLOAT64_KHR:
+                // JSON can't represent infinity and NaN.
+                json += std::isfinite(statistic.value.f64) ? std::format("{}", statistic.value.f64) : std::string("null");
+                break;
+            default:
+                json += "null";
+                break;
+            }
+        }
+        json += (statistic_count > 0) ? "\n          }\n        }" : "}\n        }";
+        json += (i + 1 < executable_count) ? ",\n" : "\n";
+    }
+    json += "      ]\n    }";
+    vk.pipeline_executable_statistics.push_back(std::move(json));
+}
+
+void vk_write_pipeline_executable_statistics(const std::string& file_name)
+{
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (!file) {
+        vk.error("failed to open file for writing: " + file_name);
+        return;
+    }
+    fprintf(file, "{\n  \"pipelines\": [\n");
+    for (size_t i = 0; i < vk.pipeline_executable_statistics.size(); i++) {
+        fprintf(file, "%s%s\n", vk.pipeline_executable_statistics[i].c_str(), (i + 1 < vk.pipeline_executable_statistics.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf("Pipeline executable statistics saved to %s\n", file_name.c_str());
+}
+
 void vk_begin_frame()
 {
-    VK_CHECK(vkWaitForFences(vk.device, 1, &vk.frame_fence[vk.frame_index], VK_FALSE, std::numeric_limits<uint64_t>::max()));
+    {
+        PROFILE_SCOPE("wait_frame_fence");
+        VK_CHECK(vkWaitForFences(vk.device, 1, &vk.frame_fence[vk.frame_index], VK_FALSE, std::numeric_limits<uint64_t>::max()));
+    }
     VK_CHECK(vkResetFences(vk.device, 1, &vk.frame_fence[vk.frame_index]));
     vkResetCommandPool(vk.device, vk.command_pools[vk.frame_index], 0);
     vk.command_buffer = vk.command_buffers[vk.frame_index];
     vk.timestamp_query_pool = vk.timestamp_query_pools[vk.frame_index];
+    vk.pipeline_statistics_query_pool = vk.pipeline_statistics_query_pools[vk.frame_index];
 
-    VK_CHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index));
+    if (!vk.headless) {
+        PROFILE_SCOPE("vkAcquireNextImageKHR");
+        VK_CHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index));
+    }
 
     VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -975,24 +1261,33 @@ void vk_end_frame()
     signal_info.semaphore = vk.rendering_finished_semaphore[vk.frame_index];
     signal_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
 
+    // In headless mode there is no swapchain image to wait for and nothing to present.
+    const uint32_t semaphore_count = vk.headless ? 0 : 1;
+
     VkSubmitInfo2 submit_info{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
-    submit_info.waitSemaphoreInfoCount = 1;
+    submit_info.waitSemaphoreInfoCount = semaphore_count;
     submit_info.pWaitSemaphoreInfos = &wait_info;
     submit_info.commandBufferInfoCount = 1;
     submit_info.pCommandBufferInfos = &cmd_info;
-    submit_info.signalSemaphoreInfoCount = 1;
+    submit_info.signalSemaphoreInfoCount = semaphore_count;
     submit_info.pSignalSemaphoreInfos = &signal_info;
 
-    VK_CHECK(vkQueueSubmit2(vk.queue, 1, &submit_info, vk.frame_fence[vk.frame_index]));
+    {
+        PROFILE_SCOPE("vkQueueSubmit2");
+        VK_CHECK(vkQueueSubmit2(vk.queue, 1, &submit_info, vk.frame_fence[vk.frame_index]));
+    }
 
-    VkPresentInfoKHR present_info { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-    present_info.waitSemaphoreCount = 1;
-    present_info.pWaitSemaphores    = &vk.rendering_finished_semaphore[vk.frame_index];
-    present_info.swapchainCount     = 1;
-    present_info.pSwapchains        = &vk.swapchain_info.handle;
-    present_info.pImageIndices      = &vk.swapchain_image_index;
+    if (!vk.headless) {
+        PROFILE_SCOPE("vkQueuePresentKHR");
+        VkPresentInfoKHR present_info { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+        present_info.waitSemaphoreCount = 1;
+        present_info.pWaitSemaphores    = &vk.rendering_finished_semaphore[vk.frame_index];
+        present_info.swapchainCount     = 1;
+        present_info.pSwapchains        = &vk.swapchain_info.handle;
+        present_info.pImageIndices      = &vk.swapchain_image_index;
 
-    VK_CHECK(vkQueuePresentKHR(vk.queue, &present_info));
+        VK_CHECK(vkQueuePresentKHR(vk.queue, &present_info));
+    }
 
     vk.frame_index = 1 - vk.frame_index;
 }
@@ -1082,6 +1377,13 @@ uint32_t vk_allocate_timestamp_queries(uint32_t count)
     return first_query;
 }
 
+uint32_t vk_allocate_pipeline_statistics_query()
+{
+    assert(vk.pipeline_statistics);
+    assert(vk.pipeline_statistics_query_count < max_pipeline_statistics_queries);
+    return vk.pipeline_statistics_query_count++;
+}
+
 void set_debug_name_impl(VkObjectType object_type, uint64_t object_handle, const char* name)
 {
     if (name) {
@@ -1188,23 +1490,65 @@ VkDescriptorSetLayout Vk_Descriptor_Set_Layout::create(const char* name)
     return set_layout;
 }
 
+// The start timestamp is written as soon as the command is processed and the end timestamp is
+// written when all previous commands complete. The interval includes the work that overlaps
+// with the previous commands, but does not include the work that was finished before the interval.
 void Vk_GPU_Time_Interval::begin()
 {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
+    vk_begin_gpu_marker_scope(vk.command_buffer, name);
+    vkCmdWriteTimestamp2(vk.command_buffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
+    if (pipeline_statistics_query != uint32_t(-1)) {
+        vkCmdBeginQuery(vk.command_buffer, vk.pipeline_statistics_query_pool, pipeline_statistics_query, 0);
+    }
 }
 
 void Vk_GPU_Time_Interval::end()
 {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
+    if (pipeline_statistics_query != uint32_t(-1)) {
+        vkCmdEndQuery(vk.command_buffer, vk.pipeline_statistics_query_pool, pipeline_statistics_query);
+    }
+    vkCmdWriteTimestamp2(vk.command_buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
+    vk_end_gpu_marker_scope(vk.command_buffer);
+}
+
+Vk_GPU_Time_Stats Vk_GPU_Time_Interval::get_stats() const
+{
+    Vk_GPU_Time_Stats stats;
+    if (history_count == 0)
+        return stats;
+
+    float sorted_samples[history_size];
+    std::copy(history_ms, history_ms + history_count, sorted_samples);
+    std::sort(sorted_samples, sorted_samples + history_count);
+
+    // nearest-rank percentile
+    auto percentile = [&sorted_samples, this](float p) {
+        uint32_t rank = (uint32_t)std::ceil(p * float(history_count));
+        return sorted_samples[std::clamp(rank, 1u, history_count) - 1];
+    };
+    stats.min_ms = sorted_samples[0];
+    stats.max_ms = sorted_samples[history_count - 1];
+    stats.median_ms = percentile(0.50f);
+    stats.p95_ms = percentile(0.95f);
+    stats.p99_ms = percentile(0.99f);
+    return stats;
 }
 
-Vk_GPU_Time_Interval* Vk_GPU_Time_Keeper::allocate_time_interval()
+Vk_GPU_Time_Interval* Vk_GPU_Time_Keeper::allocate_time_interval(const char* name, bool pipeline_statistics)
 {
     assert(time_interval_count < max_time_intervals);
     Vk_GPU_Time_Interval* time_interval = &time_intervals[time_interval_count++];
 
+    time_interval->name = name;
     time_interval->start_query[0] = time_interval->start_query[1] = vk_allocate_timestamp_queries(2);
     time_interval->length_ms = 0.f;
+    time_interval->last_length_ms = 0.f;
+    time_interval->last_frame_measured = false;
+    time_interval->pipeline_statistics_query = (pipeline_statistics && vk.pipeline_statistics) ? vk_allocate_pipeline_statistics_query() : uint32_t(-1);
+    time_interval->last_pipeline_statistics = Vk_Pipeline_Statistics{};
+    time_interval->history_count = 0;
+    time_interval->history_pos = 0;
+    time_interval->hitch_count = 0;
     return time_interval;
 }
 
@@ -1213,15 +1557,66 @@ void Vk_GPU_Time_Keeper::initialize_time_intervals()
     vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
         vkCmdResetQueryPool(command_buffer, vk.timestamp_query_pools[0], 0, 2 * time_interval_count);
         vkCmdResetQueryPool(command_buffer, vk.timestamp_query_pools[1], 0, 2 * time_interval_count);
+        if (vk.pipeline_statistics_query_count > 0) {
+            vkCmdResetQueryPool(command_buffer, vk.pipeline_statistics_query_pools[0], 0, vk.pipeline_statistics_query_count);
+            vkCmdResetQueryPool(command_buffer, vk.pipeline_statistics_query_pools[1], 0, vk.pipeline_statistics_query_count);
+        }
         for (uint32_t i = 0; i < time_interval_count; i++) {
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[0], time_intervals[i].start_query[0]);
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[0], time_intervals[i].start_query[0] + 1);
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1]);
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1] + 1);
+            vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, vk.timestamp_query_pools[0], time_intervals[i].start_query[0]);
+            vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, vk.timestamp_query_pools[0], time_intervals[i].start_query[0] + 1);
+            vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1]);
+            vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1] + 1);
         }
         });
 }
 
+// Converts timestamp from vk.host_time_domain to nanoseconds.
+static uint64_t host_timestamp_to_ns(uint64_t host_timestamp)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    const uint64_t ticks_per_second = (uint64_t)frequency.QuadPart;
+    const uint64_t seconds = host_timestamp / ticks_per_second;
+    const uint64_t remainder = host_timestamp % ticks_per_second;
+    return seconds * 1'000'000'000ull + remainder * 1'000'000'000ull / ticks_per_second;
+#else
+    // CLOCK_MONOTONIC has nanosecond units.
+    return host_timestamp;
+#endif
+}
+
+static uint64_t get_steady_clock_ns()
+{
+    auto duration = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+// Measures offset between vk.host_time_domain and steady_clock. The standard does not guarantee that
+// steady_clock uses the same clock (or epoch), so the host timestamp is paired with steady_clock samples
+// taken right before and after it. The pair with the smallest window is the most accurate one.
+static int64_t measure_host_to_steady_clock_offset_ns()
+{
+    VkCalibratedTimestampInfoEXT timestamp_info{ VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT };
+    timestamp_info.timeDomain = vk.host_time_domain;
+
+    int64_t offset_ns = 0;
+    uint64_t min_window_ns = UINT64_MAX;
+    for (int i = 0; i < 8; i++) {
+        uint64_t host_timestamp;
+        uint64_t max_deviation;
+        const uint64_t before_ns = get_steady_clock_ns();
+        VK_CHECK(vkGetCalibratedTimestampsEXT(vk.device, 1, &timestamp_info, &host_timestamp, &max_deviation));
+        const uint64_t after_ns = get_steady_clock_ns();
+
+        if (after_ns - before_ns < min_window_ns) {
+            min_window_ns = after_ns - before_ns;
+            offset_ns = int64_t(before_ns + (after_ns - before_ns) / 2) - int64_t(host_timestamp_to_ns(host_timestamp));
+        }
+    }
+    return offset_ns;
+}
+
 void Vk_GPU_Time_Keeper::next_frame()
 {
     uint64_t query_results[2/*query_result + availability*/ * 2/*start + end*/ * max_time_intervals];
@@ -1229,16 +1624,129 @@ void Vk_GPU_Time_Keeper::next_frame()
     VkResult result = vkGetQueryPoolResults(vk.device, vk.timestamp_query_pool, 0, query_count,
         query_count * 2 * sizeof(uint64_t), query_results, 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
     VK_CHECK_RESULT(result);
-    assert(result != VK_NOT_READY);
+
+    uint64_t statistics_results[(pipeline_statistics_count + 1/*availability*/) * max_pipeline_statistics_queries];
+    const uint32_t statistics_query_count = vk.pipeline_statistics_query_count;
+    if (statistics_query_count > 0) {
+        const size_t stride = (pipeline_statistics_count + 1) * sizeof(uint64_t);
+        result = vkGetQueryPoolResults(vk.device, vk.pipeline_statistics_query_pool, 0, statistics_query_count,
+            statistics_query_count * stride, statistics_results, stride, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        VK_CHECK_RESULT(result);
+    }
+
+    // Get a pair of GPU/CPU timestamps sampled at the same moment. It's used to map query results
+    // to the CPU timeline when a trace is recorded. Calibration is done each frame, so GPU clock drift
+    // is not an issue.
+    const bool map_to_cpu_timeline = vk.calibrated_timestamps && profiler_is_enabled();
+    uint64_t calibration_gpu_ticks = 0;
+    uint64_t calibration_cpu_ns = 0;
+    if (map_to_cpu_timeline) {
+        if (!host_to_steady_clock_offset_measured) {
+            host_to_steady_clock_offset_ns = measure_host_to_steady_clock_offset_ns();
+            host_to_steady_clock_offset_measured = true;
+        }
+        VkCalibratedTimestampInfoEXT timestamp_infos[2];
+        timestamp_infos[0] = VkCalibratedTimestampInfoEXT{ VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT };
+        timestamp_infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+        timestamp_infos[1] = VkCalibratedTimestampInfoEXT{ VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT };
+        timestamp_infos[1].timeDomain = vk.host_time_domain;
+        uint64_t timestamps[2];
+        uint64_t max_deviation;
+        VK_CHECK(vkGetCalibratedTimestampsEXT(vk.device, 2, timestamp_infos, timestamps, &max_deviation));
+        calibration_gpu_ticks = timestamps[0];
+        calibration_cpu_ns = uint64_t(int64_t(host_timestamp_to_ns(timestamps[1])) + host_to_steady_clock_offset_ns);
+    }
+    const double timestamp_period_ns = vk.timestamp_period_ms * 1e6;
+    const uint64_t profiler_epoch_ns = profiler_get_epoch_ns();
 
     const float influence = 0.25f;
 
     for (uint32_t i = 0; i < time_interval_count; i++) {
-        assert(query_results[4 * i + 2] >= query_results[4 * i]);
-        time_intervals[i].length_ms = (1.f - influence) * time_intervals[i].length_ms + influence * float(double(query_results[4 * i + 2] - query_results[4 * i]) * vk.timestamp_period_ms);
+        Vk_GPU_Time_Interval& interval = time_intervals[i];
+
+        // Interval was not recorded during the frame (for example, the pass was skipped).
+        interval.last_frame_measured = query_results[4 * i + 1] != 0 && query_results[4 * i + 3] != 0;
+        if (!interval.last_frame_measured)
+            continue;
+
+        if (interval.pipeline_statistics_query != uint32_t(-1)) {
+            const uint64_t* statistics = &statistics_results[(pipeline_statistics_count + 1) * interval.pipeline_statistics_query];
+            if (statistics[pipeline_statistics_count] != 0) {
+                interval.last_pipeline_statistics.input_assembly_vertices = statistics[0];
+                interval.last_pipeline_statistics.vertex_shader_invocations = statistics[1];
+                interval.last_pipeline_statistics.clipping_primitives = statistics[2];
+                interval.last_pipeline_statistics.fragment_shader_invocations = statistics[3];
+                interval.last_pipeline_statistics.compute_shader_invocations = statistics[4];
+            }
+        }
+        // Timestamps can wrap around when not all 64 bits are valid.
+        const uint64_t duration_ticks = (query_results[4 * i + 2] - query_results[4 * i]) & vk.timestamp_mask;
+        float sample_ms = float(double(duration_ticks) * vk.timestamp_period_ms);
+
+        if (interval.history_count == Vk_GPU_Time_Interval::history_size &&
+            sample_ms > Vk_GPU_Time_Interval::hitch_threshold * interval.length_ms) {
+            interval.hitch_count++;
+        }
+        interval.history_ms[interval.history_pos] = sample_ms;
+        interval.history_pos = (interval.history_pos + 1) % Vk_GPU_Time_Interval::history_size;
+        interval.history_count = std::min(interval.history_count + 1, Vk_GPU_Time_Interval::history_size);
+
+        interval.last_length_ms = sample_ms;
+        interval.length_ms = (1.f - influence) * interval.length_ms + influence * sample_ms;
+
+        if (map_to_cpu_timeline) {
+            // Queries were written before calibration.
+            const uint64_t ticks_before_calibration = (calibration_gpu_ticks - query_results[4 * i]) & vk.timestamp_mask;
+            interval.last_start_ns = calibration_cpu_ns - uint64_t(double(ticks_before_calibration) * timestamp_period_ns);
+
+            if (interval.last_start_ns >= profiler_epoch_ns) {
+                uint64_t duration_ns = uint64_t(double(duration_ticks) * timestamp_period_ns);
+                profiler_add_gpu_event(interval.name, interval.last_start_ns - profiler_epoch_ns, duration_ns);
+            }
+        }
     }
 
     vkCmdResetQueryPool(vk.command_buffer, vk.timestamp_query_pool, 0, query_count);
+    if (statistics_query_count > 0) {
+        vkCmdResetQueryPool(vk.command_buffer, vk.pipeline_statistics_query_pool, 0, statistics_query_count);
+    }
+}
+
+void Vk_GPU_Time_Keeper::write_history(const std::string& file_name) const
+{
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (!file) {
+        vk.error("failed to open file for writing: " + file_name);
+        return;
+    }
+    fprintf(file, "sample");
+    for (uint32_t i = 0; i < time_interval_count; i++) {
+        fprintf(file, ",%s_ms", time_intervals[i].name);
+    }
+    fprintf(file, "\n");
+
+    // Intervals that were not recorded in some frames have fewer samples.
+    // The rows are aligned by the most recent sample.
+    uint32_t sample_count = 0;
+    for (uint32_t i = 0; i < time_interval_count; i++) {
+        sample_count = std::max(sample_count, time_intervals[i].history_count);
+    }
+    for (uint32_t k = 0; k < sample_count; k++) {
+        fprintf(file, "%u", k);
+        for (uint32_t i = 0; i < time_interval_count; i++) {
+            const Vk_GPU_Time_Interval& interval = time_intervals[i];
+            const uint32_t skip_count = sample_count - interval.history_count;
+            if (k >= skip_count) {
+                uint32_t index = (interval.get_history_offset() + k - skip_count) % Vk_GPU_Time_Interval::history_size;
+                fprintf(file, ",%.4f", interval.history_ms[index]);
+            }
+            else {
+                fprintf(file, ",");
+            }
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
 }
 
 void vk_begin_gpu_marker_scope(VkCommandBuffer command_buffer, const char* name)
@@ -30,6 +30,21 @@ struct Vk_Init_Params {
     const VkBaseInStructure* device_create_info_pnext = nullptr;
     std::span<VkFormat> supported_surface_formats;
     VkImageUsageFlags surface_usage_flags = 0;
+
+    // In headless mode no surface and swapchain are created. The application renders
+    // into its own images and vk.surface_size is initialized from headless_surface_size.
+    bool headless = false;
+    VkExtent2D headless_surface_size = {};
+
+    // Enables VK_KHR_pipeline_executable_properties (if supported), so the driver's shader
+    // statistics are collected for the pipelines created with vk_create_*_pipeline functions.
+    bool capture_pipeline_statistics = false;
+
+    // Enables textureCompressionBC feature if it's supported (see Vk_Instance::texture_compression_bc).
+    bool texture_compression_bc = false;
+
+    // Enables VK_KHR_shader_clock with shaderDeviceClock feature if it's supported (see Vk_Instance::shader_clock).
+    bool shader_clock = false;
 };
 
 struct Vk_Image {
@@ -69,6 +84,7 @@ struct GLFWwindow;
 
 // Initializes VK_Instance structure.
 // After calling this function we get fully functional vulkan subsystem.
+// The window can be null if init_params.headless is set.
 void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params);
 
 // Shutdown vulkan subsystem by releasing resources acquired by Vk_Instance.
@@ -80,7 +96,7 @@ void vk_destroy_swapchain();
 
 void vk_ensure_staging_buffer_allocation(VkDeviceSize size);
 
-// Buffers
+// Buffers. Zero size is reported as an error.
 Vk_Buffer vk_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
     const void* data = nullptr, const char* name = nullptr);
 Vk_Buffer vk_create_buffer_with_alignment(VkDeviceSize size, VkBufferUsageFlags usage, uint32_t min_alignment,
@@ -88,9 +104,44 @@ Vk_Buffer vk_create_buffer_with_alignment(VkDeviceSize size, VkBufferUsageFlags
 Vk_Buffer vk_create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
     void** buffer_ptr, const char* name = nullptr);
 
+// Copies data to device buffers through the staging buffer. The data is accumulated in the staging
+// buffer and copied when it's full, so the amount of uploaded data is not limited by the staging size
+// and the source data does not need to be in memory all at once. The staging buffer is split into
+// chunks of staging_size bytes. A full chunk is submitted without waiting and the next chunk is filled
+// while the copy runs, the CPU waits only when the chunk is about to be reused. end() waits for all copies.
+struct Vk_Buffer_Uploader {
+    static constexpr VkDeviceSize default_staging_size = 16 * 1024 * 1024;
+    static constexpr int chunk_count = 2;
+
+    void begin(VkDeviceSize staging_size = default_staging_size);
+    void write(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+    void end();
+
+private:
+    void flush();
+    void wait_for_chunk(int chunk);
+
+    struct Region {
+        VkBuffer buffer;
+        VkBufferCopy copy;
+    };
+    struct Chunk_Submit {
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE; // not null while the copy is in flight
+        VkFence fence = VK_NULL_HANDLE;
+    };
+    VkDeviceSize staging_size = 0;
+    VkDeviceSize staging_used = 0; // in the current chunk
+    int current_chunk = 0;
+    Chunk_Submit chunk_submits[chunk_count];
+    std::vector<Region> regions;
+};
+
 // Images
 Vk_Image vk_create_image(int width, int height, VkFormat format, VkImageUsageFlags usage_flags, const char* name);
+// Mipmaps are filtered on the CPU with build_mip_chain, mipmap generation supports only 4 bytes per pixel formats.
 Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate_mipmaps, const uint8_t* pixels, int bytes_per_pixel, const char*  name);
+// Uploads precomputed mip levels (level 0 first) with a single copy command. Supports block-compressed formats.
+Vk_Image vk_create_texture_from_mips(int width, int height, VkFormat format, std::span<const std::span<const uint8_t>> mip_levels, const char* name);
 Vk_Image vk_load_texture(const std::string& texture_file);
 
 VkShaderModule vk_load_spirv(const std::string& spirv_file);
@@ -109,6 +160,14 @@ VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
 VkPipeline vk_create_compute_pipeline(VkShaderModule compute_shader,
     VkPipelineLayout pipeline_layout, const char* name);
 
+// Pipeline executable statistics (register usage, spilling, instruction counts, etc.) as reported by the driver.
+// The functions do nothing if statistics capture is not enabled or not supported.
+// vk_get_pipeline_capture_flags should be added to VkPipelineCreateFlags of pipelines that are created
+// manually and then vk_collect_pipeline_executable_statistics should be called for the created pipeline.
+VkPipelineCreateFlags vk_get_pipeline_capture_flags();
+void vk_collect_pipeline_executable_statistics(VkPipeline pipeline, const char* pipeline_name);
+void vk_write_pipeline_executable_statistics(const std::string& file_name);
+
 void vk_begin_frame();
 void vk_end_frame();
 
@@ -126,6 +185,7 @@ void vk_cmd_image_barrier_for_subresource(VkCommandBuffer command_buffer, VkImag
 
 
 uint32_t vk_allocate_timestamp_queries(uint32_t count);
+uint32_t vk_allocate_pipeline_statistics_query();
 
 // Workaround for static_assert(false). It should be used like this: static_assert(dependent_false_v<T>)
 template<typename>
@@ -192,6 +252,29 @@ struct Vk_Instance {
     VkDevice                        device;
     VkQueue                         queue;
     double                          timestamp_period_ms;
+    uint64_t                        timestamp_mask; // valid bits of timestamp queries (timestampValidBits)
+    bool                            headless;
+
+    // VK_EXT_calibrated_timestamps is optional. When it's available, GPU timestamps are
+    // mapped to the steady_clock timeline (see Vk_GPU_Time_Interval::last_start_ns).
+    bool                            calibrated_timestamps;
+    VkTimeDomainEXT                 host_time_domain;
+
+    // pipelineStatisticsQuery feature is optional. It's enabled when it's supported and
+    // VkPhysicalDeviceFeatures2 is the first structure in Vk_Init_Params::device_create_info_pnext chain.
+    bool                            pipeline_statistics;
+
+    // textureCompressionBC feature is enabled (see Vk_Init_Params::texture_compression_bc). Requires
+    // VkPhysicalDeviceFeatures2 to be the first structure in Vk_Init_Params::device_create_info_pnext chain.
+    bool                            texture_compression_bc;
+
+    // VK_KHR_shader_clock with shaderDeviceClock feature is enabled (see Vk_Init_Params::shader_clock).
+    // Has the same requirement for Vk_Init_Params::device_create_info_pnext as texture_compression_bc.
+    bool                            shader_clock;
+
+    // VK_KHR_pipeline_executable_properties is enabled (see Vk_Init_Params::capture_pipeline_statistics).
+    bool                            pipeline_executable_info;
+    std::vector<std::string>        pipeline_executable_statistics; // JSON object per pipeline
 
     VmaAllocator                    allocator;
 
@@ -216,6 +299,10 @@ struct Vk_Instance {
     VkQueryPool                     timestamp_query_pool; // timestamp_query_pool[frame_index]
     uint32_t                        timestamp_query_count;
 
+    VkQueryPool                     pipeline_statistics_query_pools[2]; // VK_NULL_HANDLE if pipeline statistics are not supported
+    VkQueryPool                     pipeline_statistics_query_pool; // pipeline_statistics_query_pools[frame_index]
+    uint32_t                        pipeline_statistics_query_count;
+
     // Host visible memory used to copy image data to device local memory.
     VkBuffer                        staging_buffer;
     VmaAllocation                   staging_buffer_allocation;
@@ -274,12 +361,57 @@ struct Vk_Descriptor_Set_Layout {
 //
 // GPU time queries.
 //
+struct Vk_GPU_Time_Stats {
+    float min_ms = 0.f;
+    float max_ms = 0.f;
+    float median_ms = 0.f;
+    float p95_ms = 0.f;
+    float p99_ms = 0.f;
+};
+
+// Pipeline statistics that are collected for the time intervals.
+struct Vk_Pipeline_Statistics {
+    uint64_t input_assembly_vertices = 0;
+    uint64_t vertex_shader_invocations = 0;
+    uint64_t clipping_primitives = 0; // primitives output by the clipping stage
+    uint64_t fragment_shader_invocations = 0;
+    uint64_t compute_shader_invocations = 0;
+};
+
 struct Vk_GPU_Time_Interval {
-    uint32_t start_query[2]; // end query == (start_query[frame_index] + 1)
-    float length_ms;
+    static constexpr uint32_t history_size = 256;
+    // The sample is counted as a hitch if it exceeds the moving average by this factor.
+    static constexpr float hitch_threshold = 2.f;
 
+    const char* name;
+    uint32_t start_query[2]; // end query == (start_query[frame_index] + 1)
+    float length_ms; // exponential moving average
+    float last_length_ms; // the most recent measurement without averaging
+    bool last_frame_measured; // false if the interval was not recorded in the last completed frame
+
+    // Pipeline statistics query is active between begin/end calls. Ray tracing shaders are not
+    // counted by pipeline statistics queries. Intervals with pipeline statistics can't be nested.
+    uint32_t pipeline_statistics_query; // -1 if the interval does not collect pipeline statistics
+    Vk_Pipeline_Statistics last_pipeline_statistics;
+    // Start of the most recent measurement as steady_clock time since epoch in nanoseconds.
+    // Updated only while the profiler records a trace and calibrated timestamps are supported.
+    uint64_t last_start_ns;
+
+    // Ring buffer of raw measurements.
+    float history_ms[history_size];
+    uint32_t history_count; // number of valid samples
+    uint32_t history_pos; // position of the next sample
+    uint32_t hitch_count;
+
+    // Begin/end write timestamps and also open/close a debug label with the interval name,
+    // so the intervals are visible in graphics debuggers and GPU profilers.
     void begin();
     void end();
+
+    // History offset to pass together with history_ms/history_count to functions that accept
+    // ring buffers (e.g. ImGui::PlotLines), so the samples are ordered from oldest to newest.
+    uint32_t get_history_offset() const { return history_count == history_size ? history_pos : 0; }
+    Vk_GPU_Time_Stats get_stats() const;
 };
 
 struct Vk_GPU_Time_Keeper {
@@ -288,9 +420,17 @@ struct Vk_GPU_Time_Keeper {
     Vk_GPU_Time_Interval time_intervals[max_time_intervals];
     uint32_t time_interval_count;
 
-    Vk_GPU_Time_Interval* allocate_time_interval();
+    // Pipeline statistics are collected only if the device supports them.
+    Vk_GPU_Time_Interval* allocate_time_interval(const char* name, bool pipeline_statistics = false);
     void initialize_time_intervals();
     void next_frame();
+
+    // Maps vk.host_time_domain to steady_clock. Measured once when the first traced frame is processed.
+    int64_t host_to_steady_clock_offset_ns = 0;
+    bool host_to_steady_clock_offset_measured = false;
+
+    // Writes sample history of all intervals as CSV table (oldest samples first).
+    void write_history(const std::string& file_name) const;
 };
 
 struct Vk_GPU_Time_Scope {
@@ -306,7 +446,10 @@ private:
     Vk_GPU_Time_Interval* time_interval;
 };
 
-#define VK_GPU_TIME_SCOPE(time_interval) Vk_GPU_Time_Scope gpu_time_scope##__LINE__(time_interval)
+#define VK_CONCAT_IMPL(a, b) a##b
+#define VK_CONCAT(a, b) VK_CONCAT_IMPL(a, b)
+
+#define VK_GPU_TIME_SCOPE(time_interval) Vk_GPU_Time_Scope VK_CONCAT(gpu_time_scope, __LINE__)(time_interval)
 
 //
 // GPU debug markers.
@@ -328,4 +471,4 @@ private:
     VkCommandBuffer command_buffer;
 };
 
-#define VK_GPU_MARKER_SCOPE(command_buffer, name) GPU_Marker_Scope gpu_marker_scope##__LINE__(command_buffer, name)
+#define VK_GPU_MARKER_SCOPE(command_buffer, name) Vk_GPU_Marker_Scope VK_CONCAT(gpu_marker_scope, __LINE__)(command_buffer, name)